@@ -12,6 +12,7 @@
   IMPORTANT: Don't forget to call init() to intialize the array of user
   defined constants and finish() to cleanup the array
 */
+#define _GNU_SOURCE /* pipe2(), before any header */
 #include "Parser.h"
 
 char ***consts; /* Array of string pairs to store user defined constants. If we have more time, this should be replaced with a BST */
@@ -557,27 +558,58 @@ int evalInvoke(char *s)
     if (!ok) /* Failed to parse */
         return 1;
     if (numPipes == 0) /* No pipes, just a single command */
-        r = evalCmd(0, 1, cmds[0]);
+        r = evalCmd(0, 1, cmds[0], NULL);
     /* Process pipes */
     else
     {
-        for (unsigned int i = 0; i < numCmds - 1; ++i)
+        pid_t pids[MAX_ARGS]; /* Processes of the stages, -1 for stages that aren't one */
+        pthread_t threads[MAX_ARGS]; /* pv stages running in the shell */
+        bool pvFailed[MAX_ARGS]; /* Their results, one per thread */
+        unsigned int numThreads = 0;
+        bool stageFailed = false; /* A pv stage in the shell failed, which fails the pipeline */
+        unsigned int started = 0; /* Number of stages started */
+        /* Start every stage before waiting on any, a stage that fills its pipe needs the next one reading */
+        for (; started < numCmds; ++started)
         {
-            r = pipe(fd);
-            if (r == -1) /* Failed to pipe */
+            int out = 1;
+            if (started < numCmds - 1)
             {
-                fprintf(stderr, "evalInvoke: failed to create pipe\n");
-                /* Free cmds */
-                for (unsigned int i = 0; i < numCmds; ++i)
-                    free(cmds[i]);
-                return 1;
+                /* Close on exec, so the stages only get the pipe ends dup'd onto their stdin and stdout */
+                if (pipe2(fd, O_CLOEXEC) == -1) /* Failed to pipe */
+                {
+                    fprintf(stderr, "evalInvoke: failed to create pipe\n");
+                    if (in != 0)
+                        close(in);
+                    r = 1;
+                    break;
+                }
+                out = fd[1];
+            }
+            pids[started] = -1;
+            /* A pv between two stages runs on a thread, which closes in and out when it's done */
+            int pv = started == 0 || started == numCmds - 1 ? -1 : evalPv(in, out, cmds[started], threads, pvFailed, &numThreads);
+            if (pv == 1)
+                stageFailed = true;
+            if (pv == -1)
+            {
+                r = evalCmd(in, out, cmds[started], &pids[started]);
+                if (out != 1)
+                    close(out); /* No longer need write end of pipe */
+                if (in != 0)
+                    close(in);
             }
-            evalCmd(in, fd[1], cmds[i]);
-            close(fd[1]); /* No longer need write end of pipe */
             in = fd[0]; /* Keep read end of pipe */
         }
-        /* Handle last stage of pipe */
-        r = evalCmd(in, 1, cmds[numCmds - 1]);
+        for (unsigned int i = 0; i < started; ++i)
+            if (pids[i] > 0)
+                waitpid(pids[i], 0, 0);
+        for (unsigned int i = 0; i < numThreads; ++i)
+        {
+            pthread_join(threads[i], NULL);
+            stageFailed |= pvFailed[i];
+        }
+        if (stageFailed)
+            r = 1;
     }
     /* Free cmds */
     for (unsigned int i = 0; i < numCmds; ++i)
@@ -585,6 +617,96 @@ int evalInvoke(char *s)
     return r;
 }
 
+/*
+  Run a pv stage of a pipeline on a thread instead of in a process: it only
+  moves data from one pipe to the other with splice(), so there's nothing a
+  process would add but a fork and an exec
+  Returns -1 if s isn't a pv that can run that way (redirections, &, file
+  operands), for the caller to run it as a command. Otherwise the stage owns
+  in and out: 1 if it failed at once on a bad option, 0 if its thread was
+  added to threads, which sets the same index of failed if the copy fails
+*/
+int evalPv(int in, int out, char *s, pthread_t *threads, bool *failed, unsigned int *numThreads)
+{
+    char cmd[BUFF_MAX];
+    char *argv[MAX_ARGS];
+    char *redirs[MAX_ARGS];
+    char *filenames[MAX_ARGS];
+    unsigned int numArgs;
+    unsigned int numRedirs;
+    unsigned int numFilenames;
+    bool isBg;
+    bool inShell = false;
+    int first = 0; /* Index of the first operand, -1 for bad options */
+    int r = -1;
+    if (strncmp(s, "pv", 2) != 0 || (s[2] != '\0' && !isspace(s[2]))) /* Cheap check before parsing */
+        return r;
+    if (!parseCmd(s, MAX_ARGS, cmd, argv, redirs, filenames, &numArgs, &numRedirs, &numFilenames, &isBg))
+        return r;
+    struct pvStage *stage = (struct pvStage*) malloc(sizeof(struct pvStage));
+    memcpy(stage->argv, argv, numArgs * sizeof(char*));
+    stage->numArgs = numArgs;
+    if (numRedirs == 0 && !isBg)
+    {
+        first = pvParseArgs(&stage->opts, numArgs, stage->argv);
+        inShell = first == -1 || first == (int) numArgs; /* Files to read are left to the command */
+    }
+    stage->in = in;
+    stage->out = out;
+    stage->failed = &failed[*numThreads];
+    *stage->failed = false;
+    if (inShell && first == -1) /* Bad option, already reported. The stage fails like a pv process would */
+    {
+        close(in);
+        close(out);
+        r = 1;
+    }
+    else if (inShell && pthread_create(&threads[*numThreads], NULL, runPv, stage) == 0)
+    {
+        ++(*numThreads);
+        stage = NULL; /* The thread frees it */
+        r = 0;
+    }
+    for (unsigned int i = 0; i < numRedirs; ++i)
+        free(redirs[i]);
+    for (unsigned int i = 0; i < numFilenames; ++i)
+        free(filenames[i]);
+    if (stage != NULL)
+    {
+        for (unsigned int i = 0; i < stage->numArgs; ++i)
+            free(stage->argv[i]);
+        free(stage);
+    }
+    return r;
+}
+
+/* Thread of an in-shell pv stage */
+void* runPv(void *arg)
+{
+    struct pvStage *stage = (struct pvStage*) arg;
+    struct pvMeter meter;
+    sigset_t pipeSig;
+    sigemptyset(&pipeSig);
+    sigaddset(&pipeSig, SIGPIPE);
+    /* The reader going away has to end the stage with EPIPE, not kill the shell */
+    pthread_sigmask(SIG_BLOCK, &pipeSig, NULL);
+    pvStart(&meter, &stage->opts);
+    int err = pvCopy(&meter, stage->in, stage->out);
+    close(stage->in); /* EOF for the next stage, or SIGPIPE for the previous one */
+    close(stage->out);
+    pvFinish(&meter);
+    if (err == EPIPE) /* Take the SIGPIPE that's now pending on this thread */
+    {
+        struct timespec now = { 0, 0 };
+        sigtimedwait(&pipeSig, NULL, &now);
+    }
+    *stage->failed = pvFailed(NULL, err);
+    for (unsigned int i = 0; i < stage->numArgs; ++i)
+        free(stage->argv[i]);
+    free(stage);
+    return NULL;
+}
+
 bool getExecPath(char *cmd, char *execPath)
 {
     char path[BUFF_MAX]; /* String to store the current value of PATH */
@@ -664,8 +786,11 @@ char* evalArg(char *arg)
     return arg;
 }
 
-/* Evaluate the command and run the executable */
-int evalCmd(int in, int out, char* s)
+/*
+  Evaluate the command and run the executable
+  pid: NULL to wait for the process. Otherwise it's left running and its pid is stored here, -1 if none was started
+*/
+int evalCmd(int in, int out, char* s, pid_t *pid)
 {
     char cmd[BUFF_MAX]; /* Command name */
     char *argv[MAX_ARGS]; /* Argument list */
@@ -678,7 +803,9 @@ int evalCmd(int in, int out, char* s)
     bool isBg; /* Was a & passed to indicate a background process */
     bool ok;
     int fd; /* File descriptor returned by open */
-    pid_t pid;
+    pid_t child;
+    if (pid != NULL)
+        *pid = -1;
     ok = parseCmd(s, MAX_ARGS, cmd, argv, redirs, filenames, &numArgs, &numRedirs, &numFilenames, &isBg);
     if (!ok) /* Failed to parse */
         return 1;
@@ -731,8 +858,8 @@ int evalCmd(int in, int out, char* s)
             free(filenames[i]);
         return 1;
     }
-    pid = fork();
-    if (pid == 0) /* Child process */
+    child = fork();
+    if (child == 0) /* Child process */
     {
         for (unsigned int i = 0; i < numRedirs; ++i)
         {
@@ -819,7 +946,12 @@ int evalCmd(int in, int out, char* s)
         free(filenames[i]);
     if (isBg) /* Don't wait for background process */
         return 0;
-    r = waitpid(pid, 0, 0);
+    if (pid != NULL) /* Stage of a pipeline, evalInvoke waits for it */
+    {
+        *pid = child;
+        return 0;
+    }
+    r = waitpid(child, 0, 0);
     if (r == -1)
         return 1;
     return 0;
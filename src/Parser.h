@@ -24,12 +24,26 @@
 #include <sys/wait.h>
 #include <sys/stat.h>
 #include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include "pv.h"
 
 #define BUFF_MAX 1024 /* Maximum number of characters in the character buffer */
 #define INVALID_POS -1
 #define INIT_CONSTS 8 /* Initial number of constants to allocate memory for */
 #define MAX_ARGS 1024 /* Maximum number of arguments in argv */
 
+/* A pv stage of a pipeline run on a thread of the shell. The thread owns all of it */
+struct pvStage
+{
+    int in;
+    int out;
+    struct pvOptions opts;
+    char *argv[MAX_ARGS]; /* Kept until the thread is done, opts points into it */
+    unsigned int numArgs;
+    bool *failed; /* Set if the stage fails, read by evalInvoke once the thread is joined */
+};
+
 void init();
 void finish();
 bool addConst(char*, char*);
@@ -45,7 +59,9 @@ bool parseInvoke(char*, char**, unsigned int*, unsigned int*);
 bool parseS(char*, char*, char*);
 char* evalArg(char*);
 bool getExecPath(char*, char*);
-int evalCmd(int, int, char*);
+int evalCmd(int, int, char*, pid_t*);
+int evalPv(int, int, char*, pthread_t*, bool*, unsigned int*);
+void* runPv(void*);
 int evalInvoke(char*);
 int evalS(char*);
 int evalExpr(char*);
@@ -0,0 +1,155 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include "soyio.h"
+
+#define MOVE_CHUNK (1 << 30) /* Max bytes asked of the kernel per sendfile/splice call */
+#define PIPE_SIZE (1 << 20) /* Pipes we splice through are grown to this, fewer wakeups per byte */
+#define BLOCK_SIZE (1 << 20) /* Block size of the fallback read/mmap and write path */
+
+/* How the data of one input gets to the output */
+enum catMethod { CAT_SPLICE, CAT_SENDFILE, CAT_BUFFER };
+
+static bool outIsPipe;
+static bool outIsRegular;
+static struct stat outStat;
+
+/* write() all of len bytes. Returns 0, or -1 with errno set */
+static int writeAll(int fd, const char *buf, size_t len)
+{
+	while (len > 0) {
+		ssize_t n = write(fd, buf, len);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/*
+  Move everything from in to stdout without it passing through user space:
+  splice when either side is a pipe, sendfile otherwise
+  Returns 0 when done, 1 if the kernel can't do it for these fds and nothing
+  was lost (the caller carries on with a buffer), or -1 on a real error
+*/
+static int copyKernel(int in, enum catMethod method)
+{
+	while (1) {
+		ssize_t n = method == CAT_SPLICE ? splice(in, NULL, STDOUT_FILENO, NULL, MOVE_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE)
+						 : sendfile(STDOUT_FILENO, in, NULL, MOVE_CHUNK);
+		if (n == 0)
+			return 0;
+		if (n == -1) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			/* Nothing was consumed by the failed call, so the buffer path can pick up from here */
+			if (errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP || errno == EXDEV)
+				return 1;
+			return -1;
+		}
+	}
+}
+
+/* Copy in to stdout through a large buffer, or straight from a mapping of in */
+static int copyBuffer(int in)
+{
+	struct soyReader r;
+	if (srInit(&r, in, BLOCK_SIZE) == -1)
+		return -1;
+	int ret = 0;
+	while (1) {
+		const char *data;
+		ssize_t n = srNext(&r, &data);
+		if (n <= 0) {
+			ret = n;
+			break;
+		}
+		if (writeAll(STDOUT_FILENO, data, n) == -1) {
+			ret = -1;
+			break;
+		}
+	}
+	int err = errno;
+	srFree(&r);
+	errno = err;
+	return ret;
+}
+
+/* Pick the cheapest way to move in to stdout */
+static enum catMethod pickMethod(int in, const struct stat *st)
+{
+	if (S_ISFIFO(st->st_mode) || outIsPipe) {
+		if (S_ISFIFO(st->st_mode))
+			fcntl(in, F_SETPIPE_SZ, PIPE_SIZE);
+		return CAT_SPLICE;
+	}
+	if (S_ISREG(st->st_mode) || S_ISBLK(st->st_mode))
+		return CAT_SENDFILE;
+	return CAT_BUFFER;
+}
+
+/* Write one input to stdout. Returns 0 on success, 1 on failure */
+static int catFile(const char *path)
+{
+	bool isStdin = strcmp(path, "-") == 0;
+	int in = isStdin ? STDIN_FILENO : open(path, O_RDONLY | O_CLOEXEC);
+	if (in == -1) {
+		fprintf(stderr, "cat: %s: %s\n", path, strerror(errno));
+		return 1;
+	}
+	struct stat st;
+	if (fstat(in, &st) == -1) {
+		fprintf(stderr, "cat: %s: %s\n", path, strerror(errno));
+		if (!isStdin)
+			close(in);
+		return 1;
+	}
+	/* Appending a file to itself would never reach its end */
+	if (outIsRegular && S_ISREG(st.st_mode) && st.st_dev == outStat.st_dev && st.st_ino == outStat.st_ino && st.st_size > 0) {
+		fprintf(stderr, "cat: %s: input file is output file\n", path);
+		if (!isStdin)
+			close(in);
+		return 1;
+	}
+	if (S_ISREG(st.st_mode))
+		posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	enum catMethod method = pickMethod(in, &st);
+	int r = method == CAT_BUFFER ? 1 : copyKernel(in, method);
+	if (r == 1)
+		r = copyBuffer(in);
+	if (r == -1)
+		fprintf(stderr, "cat: %s: %s\n", path, strerror(errno));
+	if (!isStdin)
+		close(in);
+	return r == -1 ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+	if (fstat(STDOUT_FILENO, &outStat) == 0) {
+		outIsPipe = S_ISFIFO(outStat.st_mode);
+		outIsRegular = S_ISREG(outStat.st_mode);
+	}
+	if (outIsPipe)
+		fcntl(STDOUT_FILENO, F_SETPIPE_SZ, PIPE_SIZE);
+
+	if (argc < 2)
+		return catFile("-");
+	int ret = 0;
+	for (int i = 1; i < argc; ++i)
+		if (catFile(argv[i]) != 0)
+			ret = 1;
+	return ret;
+}
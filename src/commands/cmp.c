@@ -0,0 +1,333 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+#define BLOCK_SIZE (256 << 10) /* Bytes read per step from inputs that can't be mapped */
+
+/* Offset of the first byte where a[0, len) and b[0, len) differ, len if they don't */
+typedef size_t (*diffFn)(const unsigned char *a, const unsigned char *b, size_t len);
+
+/* Portable version: 8 bytes at a time, the first differing byte found from the XOR of the words */
+static size_t diffScalar(const unsigned char *a, const unsigned char *b, size_t len)
+{
+	size_t i = 0;
+	for (; i + 8 <= len; i += 8) {
+		unsigned long long x, y;
+		memcpy(&x, a + i, 8);
+		memcpy(&y, b + i, 8);
+		if (x != y) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+			return i + __builtin_ctzll(x ^ y) / 8;
+#else
+			return i + __builtin_clzll(x ^ y) / 8;
+#endif
+		}
+	}
+	for (; i < len && a[i] == b[i]; ++i);
+	return i;
+}
+
+#ifdef __x86_64__
+/* SSE2 version: 64 bytes per step, the equality masks of four vectors ANDed so there's one branch */
+static size_t diffSse2(const unsigned char *a, const unsigned char *b, size_t len)
+{
+	size_t i = 0;
+	for (; i + 64 <= len; i += 64) {
+		__m128i e0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (a + i)), _mm_loadu_si128((const __m128i*) (b + i)));
+		__m128i e1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (a + i + 16)), _mm_loadu_si128((const __m128i*) (b + i + 16)));
+		__m128i e2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (a + i + 32)), _mm_loadu_si128((const __m128i*) (b + i + 32)));
+		__m128i e3 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (a + i + 48)), _mm_loadu_si128((const __m128i*) (b + i + 48)));
+		__m128i all = _mm_and_si128(_mm_and_si128(e0, e1), _mm_and_si128(e2, e3));
+		if (_mm_movemask_epi8(all) != 0xFFFF)
+			break; /* The scalar loop finds the byte within these 64 */
+	}
+	return i + diffScalar(a + i, b + i, len - i);
+}
+
+/* AVX2 version: 128 bytes per step */
+__attribute__((target("avx2")))
+static size_t diffAvx2(const unsigned char *a, const unsigned char *b, size_t len)
+{
+	size_t i = 0;
+	for (; i + 128 <= len; i += 128) {
+		__m256i e0 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) (a + i)), _mm256_loadu_si256((const __m256i*) (b + i)));
+		__m256i e1 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) (a + i + 32)), _mm256_loadu_si256((const __m256i*) (b + i + 32)));
+		__m256i e2 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) (a + i + 64)), _mm256_loadu_si256((const __m256i*) (b + i + 64)));
+		__m256i e3 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) (a + i + 96)), _mm256_loadu_si256((const __m256i*) (b + i + 96)));
+		__m256i all = _mm256_and_si256(_mm256_and_si256(e0, e1), _mm256_and_si256(e2, e3));
+		if ((unsigned int) _mm256_movemask_epi8(all) != 0xFFFFFFFF)
+			break;
+	}
+	return i + diffScalar(a + i, b + i, len - i);
+}
+#endif
+
+/* Best kernel for the CPU we're running on */
+static diffFn pickKernel(void)
+{
+#ifdef __x86_64__
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return diffAvx2;
+	return diffSse2;
+#else
+	return diffScalar;
+#endif
+}
+
+static diffFn diff;
+
+/* One of the two inputs */
+struct cmpFile {
+	const char *path;
+	int fd;
+	struct stat st;
+	const unsigned char *map; /* Whole file, NULL when it's read a block at a time */
+	bool regular;
+};
+
+/* Where the inputs stop being the same */
+struct result {
+	unsigned long long at; /* Offset of the first differing byte, or of the end of the shorter input */
+	unsigned long long lines; /* Newlines before it */
+	bool lastNewline; /* The byte before it is a newline */
+	struct cmpFile *ended; /* Input that ran out first, NULL if a byte differs or neither did */
+	bool same;
+};
+
+static unsigned long long countLines(const unsigned char *p, size_t len)
+{
+	unsigned long long n = 0;
+	for (const unsigned char *end = p + len; (p = memchr(p, '\n', end - p)) != NULL; ++p)
+		++n;
+	return n;
+}
+
+/* Open an input, "-" being stdin, and map it when it's a regular file. Exits 2 on errors like cmp does */
+static void openInput(struct cmpFile *f)
+{
+	bool isStdin = strcmp(f->path, "-") == 0;
+	f->fd = isStdin ? STDIN_FILENO : open(f->path, O_RDONLY | O_CLOEXEC);
+	if (f->fd == -1 || fstat(f->fd, &f->st) == -1) {
+		fprintf(stderr, "cmp: %s: %s\n", f->path, strerror(errno));
+		exit(2);
+	}
+	if (S_ISDIR(f->st.st_mode)) {
+		fprintf(stderr, "cmp: %s: %s\n", f->path, strerror(EISDIR));
+		exit(2);
+	}
+	f->regular = S_ISREG(f->st.st_mode) && !isStdin;
+	if (f->regular && f->st.st_size > 0) {
+		void *map = mmap(NULL, f->st.st_size, PROT_READ, MAP_PRIVATE, f->fd, 0);
+		if (map != MAP_FAILED) {
+			madvise(map, f->st.st_size, MADV_SEQUENTIAL);
+			f->map = map;
+		}
+		else
+			f->regular = false; /* Read it instead */
+	}
+}
+
+/* Next data at or after pos, the size when there's only a hole left. pos itself when holes aren't reported */
+static off_t nextData(struct cmpFile *f, off_t pos)
+{
+	off_t data = lseek(f->fd, pos, SEEK_DATA);
+	if (data == -1)
+		return errno == ENXIO ? f->st.st_size : pos;
+	return data;
+}
+
+static off_t nextHole(struct cmpFile *f, off_t pos)
+{
+	off_t hole = lseek(f->fd, pos, SEEK_HOLE);
+	return hole == -1 ? f->st.st_size : hole;
+}
+
+/*
+  Whether the data and holes of two regular files of the same size are in
+  the same places. A copy can have the same bytes as its source and still
+  have filled in its holes; -x counts that as a difference. Sets *at to
+  where the layouts part
+*/
+static bool sameExtents(struct cmpFile *a, struct cmpFile *b, unsigned long long *at)
+{
+	off_t pos = 0;
+	while (pos < a->st.st_size) {
+		off_t dataA = nextData(a, pos), dataB = nextData(b, pos);
+		if (dataA != dataB) {
+			*at = dataA < dataB ? dataA : dataB;
+			return false;
+		}
+		if (dataA >= a->st.st_size)
+			break;
+		off_t holeA = nextHole(a, dataA), holeB = nextHole(b, dataB);
+		if (holeA != holeB) {
+			*at = holeA < holeB ? holeA : holeB;
+			return false;
+		}
+		pos = holeA;
+	}
+	return true;
+}
+
+/*
+  Compare two mapped files. Ranges that are a hole in both files are
+  skipped rather than read, they're zeros on both sides; everything else
+  goes through the vector kernel in one call per data extent
+*/
+static void compareMapped(struct cmpFile *a, struct cmpFile *b, bool silent, struct result *r)
+{
+	off_t common = a->st.st_size < b->st.st_size ? a->st.st_size : b->st.st_size;
+	off_t pos = 0;
+	while (pos < common) {
+		off_t dataA = nextData(a, pos), dataB = nextData(b, pos);
+		off_t start = dataA < dataB ? dataA : dataB;
+		if (start > pos) {
+			pos = start < common ? start : common;
+			continue;
+		}
+		/* Up to where either file switches between data and hole */
+		off_t endA = dataA == pos ? nextHole(a, pos) : dataA, endB = dataB == pos ? nextHole(b, pos) : dataB;
+		off_t end = endA < endB ? endA : endB;
+		if (end > common || end <= pos)
+			end = common;
+		size_t d = diff(a->map + pos, b->map + pos, end - pos);
+		if ((off_t) d < end - pos) {
+			r->at = pos + d;
+			if (!silent) /* Only worth a second pass when it's printed */
+				r->lines = countLines(a->map, r->at);
+			return;
+		}
+		pos = end;
+	}
+	r->at = common;
+	r->same = a->st.st_size == b->st.st_size;
+	if (!r->same) {
+		r->ended = a->st.st_size < b->st.st_size ? a : b;
+		if (!silent && common > 0) {
+			r->lines = countLines(r->ended->map, common);
+			r->lastNewline = r->ended->map[common - 1] == '\n';
+		}
+	}
+}
+
+/* Read up to len bytes, fewer only at the end of the input */
+static size_t readFull(struct cmpFile *f, unsigned char *buf, size_t len)
+{
+	size_t got = 0;
+	while (got < len) {
+		ssize_t n = read(f->fd, buf + got, len - got);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n == -1) {
+			fprintf(stderr, "cmp: %s: %s\n", f->path, strerror(errno));
+			exit(2);
+		}
+		if (n == 0)
+			break;
+		got += n;
+	}
+	return got;
+}
+
+/* Compare when either input is a pipe or a terminal, a block at a time */
+static void compareStreams(struct cmpFile *a, struct cmpFile *b, bool silent, struct result *r)
+{
+	unsigned char *bufA = malloc(BLOCK_SIZE), *bufB = malloc(BLOCK_SIZE);
+	while (1) {
+		size_t lenA = readFull(a, bufA, BLOCK_SIZE), lenB = readFull(b, bufB, BLOCK_SIZE);
+		size_t n = lenA < lenB ? lenA : lenB;
+		size_t d = diff(bufA, bufB, n);
+		if (!silent)
+			r->lines += countLines(bufA, d);
+		r->at += d;
+		if (d < n)
+			break;
+		if (n > 0)
+			r->lastNewline = bufA[n - 1] == '\n';
+		if (lenA != lenB) {
+			r->ended = lenA < lenB ? a : b;
+			break;
+		}
+		if (n < BLOCK_SIZE) {
+			r->same = true;
+			break;
+		}
+	}
+	free(bufA);
+	free(bufB);
+}
+
+int main(int argc, char **argv)
+{
+	bool silent = false, extents = false;
+	static struct option longOpts[] = {
+		{ "silent", no_argument, NULL, 's' },
+		{ "quiet", no_argument, NULL, 's' },
+		{ "extents", no_argument, NULL, 'x' },
+		{ NULL, 0, NULL, 0 }
+	};
+	int c;
+	while ((c = getopt_long(argc, argv, "sx", longOpts, NULL)) != -1) {
+		switch (c) {
+		case 's':
+			silent = true;
+			break;
+		case 'x':
+			extents = true;
+			break;
+		default:
+			return 2;
+		}
+	}
+	if (optind == argc || argc - optind > 2) {
+		fprintf(stderr, "cmp: %s\n", optind == argc ? "missing operand" : "extra operand");
+		return 2;
+	}
+	struct cmpFile a = { .path = argv[optind] }, b = { .path = optind + 1 < argc ? argv[optind + 1] : "-" };
+	openInput(&a);
+	openInput(&b);
+	diff = pickKernel();
+
+	bool bothRegular = a.regular && b.regular;
+	if (bothRegular && a.st.st_dev == b.st.st_dev && a.st.st_ino == b.st.st_ino)
+		return 0;
+	/* Files of different sizes differ: with nothing to print, that's all there is to know */
+	if (bothRegular && silent && a.st.st_size != b.st.st_size)
+		return 1;
+	unsigned long long at;
+	if (bothRegular && extents && a.st.st_size == b.st.st_size && !sameExtents(&a, &b, &at)) {
+		if (!silent)
+			printf("%s %s differ: extents at byte %llu\n", a.path, b.path, at + 1);
+		return 1;
+	}
+
+	struct result r = { 0 };
+	if (bothRegular)
+		compareMapped(&a, &b, silent, &r);
+	else
+		compareStreams(&a, &b, silent, &r);
+	if (r.same)
+		return 0;
+	if (silent)
+		return 1;
+	if (r.ended == NULL)
+		printf("%s %s differ: byte %llu, line %llu\n", a.path, b.path, r.at + 1, r.lines + 1);
+	else if (r.at == 0)
+		fprintf(stderr, "cmp: EOF on %s which is empty\n", r.ended->path);
+	else
+		fprintf(stderr, "cmp: EOF on %s after byte %llu, %sline %llu\n", r.ended->path, r.at,
+		        r.lastNewline ? "" : "in ", r.lines + !r.lastNewline);
+	return 1;
+}
@@ -1,31 +1,1268 @@
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdarg.h>
 #include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <dirent.h>
+#include <limits.h>
+#include <libgen.h>
+#include <sys/resource.h>
+#include "workpool.h"
+#include "uring.h"
+#include "soyio.h"
 
-int main (int argc, char** argv) {
-	
-	if (argc != 3) {
-		printf("cp: invalid number of arguments\n");
+#define COPY_CHUNK (1 << 30) /* Max bytes handed to the kernel per copy_file_range/sendfile call */
+#define BUF_SIZE (1 << 20) /* Size of the fallback read/write buffer */
+#define BUF_ALIGN 4096 /* Alignment of the fallback buffer */
+#define PAR_MIN_SIZE (64 << 20) /* Files smaller than this aren't worth splitting across threads */
+#define PAR_CHUNK_MIN (8 << 20) /* Smallest range handed to one thread */
+#define PAR_CHUNK_ALIGN (1 << 20) /* Range boundaries are aligned to this so threads never share a page or block */
+#define MAX_THREADS 64
+#define TREE_THREADS 8 /* Default workers for -r, copying trees is mostly waiting on metadata I/O */
+#define FILE_BATCH 128 /* Non-directory entries handed out per task when copying a tree */
+#define URING_MAX_FILE (32 << 10) /* Files up to this size are copied in one read/write by the io_uring engine */
+#define DROP_WINDOW (8 << 20) /* With --drop-cache, pages are dropped this far behind the copy cursor */
+#define DIRECT_BUF (4 << 20) /* Size of each of the two O_DIRECT buffers */
+#define DIRECT_ALIGN 4096 /* O_DIRECT buffer, offset and length alignment */
+#define OUT_BUF (64 << 10) /* Size of the buffer messages are collected in */
+
+enum reflinkMode { REFLINK_NEVER, REFLINK_AUTO, REFLINK_ALWAYS };
+
+enum sparseMode { SPARSE_NEVER, SPARSE_AUTO, SPARSE_ALWAYS };
+
+struct cpOpts {
+	enum reflinkMode reflink; /* Whether to share extents with the source instead of copying data */
+	enum sparseMode sparse; /* Whether to skip holes in the source */
+	bool verbose; /* Report what was copied */
+	unsigned int threads; /* Number of threads used to copy a single large file, or to walk a tree */
+	bool recursive; /* Copy directories */
+	bool uring; /* Batch small files of a tree through io_uring */
+	bool direct; /* Bypass the page cache with O_DIRECT */
+	bool dropCache; /* Evict copied pages from the page cache behind the copy */
+};
+
+/* Messages from every worker go through one locked buffer, flushed at exit */
+static struct soyWriter msgs;
+static pthread_mutex_t msgLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void report(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+static void report(const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	pthread_mutex_lock(&msgLock);
+	swVprintf(&msgs, fmt, ap);
+	pthread_mutex_unlock(&msgLock);
+	va_end(ap);
+}
+
+static void flushReports(void)
+{
+	swFlush(&msgs);
+}
+
+/* Copy buffers are reused across files instead of allocated for each one */
+static struct soyPool *bufPool; /* BUF_SIZE bytes for copyBuffer() */
+static struct soyPool *directPool; /* DIRECT_BUF bytes for copyDirect() */
+
+/*
+  Make out share all of in's extents (copy-on-write) with FICLONE
+  Returns 0 on success, -1 if the filesystem can't clone these files
+*/
+static int copyReflink(int in, int out)
+{
+	if (ioctl(out, FICLONE, in) == 0)
+		return 0;
+	return -1;
+}
+
+/* What the kernel turned out to support for this pair of files, so we don't keep retrying failed syscalls */
+struct copyMethod {
+	bool noKernel; /* copy_file_range unsupported */
+	bool noSendfile; /* sendfile unsupported */
+};
+
+/* Operations the io_uring engine performs on each small file */
+enum { OP_STATX, OP_OPEN_SRC, OP_OPEN_DST, OP_READ, OP_WRITE, OP_CLOSE_SRC, OP_CLOSE_DST, OP_COUNT };
+
+/* A region of the source file that holds data */
+struct extent {
+	off_t off;
+	off_t len;
+};
+
+/*
+  Copy len bytes from offset off of in to the same offset of out with copy_file_range
+  Returns bytes copied, -1 if the kernel can't do it for these files, -2 on error
+*/
+static off_t copyKernel(int in, int out, off_t off, off_t len)
+{
+	off_t done = 0;
+	loff_t offIn = off, offOut = off;
+	while (done < len) {
+		size_t n = (len - done) > COPY_CHUNK ? COPY_CHUNK : (size_t) (len - done);
+		ssize_t r = copy_file_range(in, &offIn, out, &offOut, n, 0);
+		if (r == -1) {
+			if (errno == EINTR)
+				continue;
+			if (done == 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP))
+				return -1; /* Not supported between these files, let the caller fall back */
+			return -2;
+		}
+		if (r == 0) /* Source shrank underneath us */
+			break;
+		done += r;
+	}
+	return done;
+}
+
+/* Same as copyKernel but with sendfile, which writes at out's file position */
+static off_t copySendfile(int in, int out, off_t off, off_t len)
+{
+	off_t done = 0;
+	if (lseek(out, off, SEEK_SET) == -1)
+		return -2;
+	while (done < len) {
+		size_t n = (len - done) > COPY_CHUNK ? COPY_CHUNK : (size_t) (len - done);
+		ssize_t r = sendfile(out, in, &off, n);
+		if (r == -1) {
+			if (errno == EINTR)
+				continue;
+			if (done == 0 && (errno == ENOSYS || errno == EINVAL))
+				return -1;
+			return -2;
+		}
+		if (r == 0)
+			break;
+		done += r;
+	}
+	return done;
+}
+
+/*
+  Last resort: pread/pwrite through a large aligned buffer
+  A negative len means copy until end of file. Works on streams when off is -1
+*/
+static off_t copyBuffer(int in, int out, off_t off, off_t len)
+{
+	char *buf = spGet(bufPool);
+	off_t done = 0;
+	if (buf == NULL)
+		return -2;
+	while (len < 0 || done < len) {
+		size_t want = (len < 0 || len - done > BUF_SIZE) ? BUF_SIZE : (size_t) (len - done);
+		ssize_t r = off < 0 ? read(in, buf, want) : pread(in, buf, want, off + done);
+		if (r == -1 && errno == EINTR)
+			continue;
+		if (r <= 0) {
+			if (r == -1)
+				done = -2;
+			break;
+		}
+		for (ssize_t w = 0; w < r; ) {
+			ssize_t n = off < 0 ? write(out, buf + w, r - w) : pwrite(out, buf + w, r - w, off + done + w);
+			if (n == -1) {
+				if (errno == EINTR)
+					continue;
+				spPut(bufPool, buf);
+				return -2;
+			}
+			w += n;
+		}
+		done += r;
+	}
+	spPut(bufPool, buf);
+	return done;
+}
+
+/*
+  Copy one region at the same offset, trying the cheapest mechanism first:
+  copy_file_range (no user space copy, may be offloaded by the filesystem),
+  then sendfile, then a read/write loop
+*/
+static off_t copyRange(int in, int out, off_t off, off_t len, struct copyMethod *m)
+{
+	off_t r = -1;
+	if (!m->noKernel) {
+		r = copyKernel(in, out, off, len);
+		if (r == -1)
+			m->noKernel = true;
+	}
+	if (r == -1 && !m->noSendfile) {
+		r = copySendfile(in, out, off, len);
+		if (r == -1)
+			m->noSendfile = true;
+	}
+	if (r == -1)
+		r = copyBuffer(in, out, off, len);
+	return r < 0 ? -1 : r;
+}
+
+/*
+  List the data regions of the file with SEEK_DATA/SEEK_HOLE
+  Returns the number of extents, stored in a malloc'd array, or -1 if the filesystem can't tell us
+*/
+static ssize_t findExtents(int fd, off_t size, struct extent **out)
+{
+	size_t n = 0, max = 16;
+	struct extent *ext = malloc(max * sizeof(struct extent));
+	off_t pos = 0;
+	while (pos < size) {
+		off_t data = lseek(fd, pos, SEEK_DATA);
+		if (data == -1) {
+			if (errno == ENXIO) /* Only a hole left */
+				break;
+			free(ext);
+			return -1;
+		}
+		off_t hole = lseek(fd, data, SEEK_HOLE);
+		if (hole == -1) {
+			free(ext);
+			return -1;
+		}
+		if (hole > size)
+			hole = size;
+		if (n == max) {
+			max *= 2;
+			ext = realloc(ext, max * sizeof(struct extent));
+		}
+		ext[n].off = data;
+		ext[n].len = hole - data;
+		++n;
+		pos = hole;
+	}
+	*out = ext;
+	return n;
+}
+
+/*
+  Write back the copied range of out and evict it, along with the source range, from the page cache
+  Dirty pages can't be dropped, hence the sync first
+*/
+static void dropBehind(int in, int out, off_t off, off_t len)
+{
+	sync_file_range(out, off, len, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+	posix_fadvise(in, off, len, POSIX_FADV_DONTNEED);
+	posix_fadvise(out, off, len, POSIX_FADV_DONTNEED);
+}
+
+/*
+  Copy each extent in order. On a short copy, *size is set to where the source data ran out
+  With dropCache, the copy goes in windows and each window is evicted once the next one
+  has been written, so writeback overlaps with copying
+  Returns bytes written or -1
+*/
+static off_t copyExtents(int in, int out, const struct extent *ext, size_t numExt, struct copyMethod *m, bool dropCache, off_t *size)
+{
+	off_t written = 0;
+	struct extent prev = { 0, 0 }; /* Window copied but not yet dropped */
+	for (size_t i = 0; i < numExt; ++i) {
+		for (off_t off = ext[i].off; off < ext[i].off + ext[i].len; ) {
+			off_t len = ext[i].off + ext[i].len - off;
+			if (dropCache && len > DROP_WINDOW)
+				len = DROP_WINDOW;
+			off_t r = copyRange(in, out, off, len, m);
+			if (r == -1)
+				return -1;
+			written += r;
+			if (dropCache) {
+				sync_file_range(out, off, r, SYNC_FILE_RANGE_WRITE); /* Start writeback now, wait for it next round */
+				if (prev.len > 0)
+					dropBehind(in, out, prev.off, prev.len);
+				prev.off = off;
+				prev.len = r;
+			}
+			if (r < len) { /* Source shrank underneath us */
+				*size = off + r;
+				if (prev.len > 0)
+					dropBehind(in, out, prev.off, prev.len);
+				return written;
+			}
+			off += r;
+		}
+	}
+	if (prev.len > 0)
+		dropBehind(in, out, prev.off, prev.len);
+	return written;
+}
+
+/* Shared state of the threads copying one file */
+struct parallelCopy {
+	int in;
+	int out;
+	struct extent *chunks;
+	size_t numChunks;
+	atomic_size_t next; /* Index of the next chunk to hand out */
+	atomic_llong written;
+	atomic_llong shrunk; /* Lowest offset at which the source ran out of data, or -1 */
+	atomic_bool failed;
+	bool dropCache;
+};
+
+/* Worker thread: claim chunks until none are left */
+static void* copyWorker(void *arg)
+{
+	struct parallelCopy *pc = arg;
+	/* sendfile writes at the shared file position, so threads can only use the positional methods */
+	struct copyMethod m = { false, true };
+	size_t i;
+	while (!atomic_load(&pc->failed) && (i = atomic_fetch_add(&pc->next, 1)) < pc->numChunks) {
+		off_t r = copyRange(pc->in, pc->out, pc->chunks[i].off, pc->chunks[i].len, &m);
+		if (r == -1) {
+			atomic_store(&pc->failed, true);
+			break;
+		}
+		atomic_fetch_add(&pc->written, r);
+		if (pc->dropCache)
+			dropBehind(pc->in, pc->out, pc->chunks[i].off, r);
+		if (r < pc->chunks[i].len) {
+			long long end = pc->chunks[i].off + r;
+			long long cur = atomic_load(&pc->shrunk);
+			while ((cur == -1 || end < cur) && !atomic_compare_exchange_weak(&pc->shrunk, &cur, end))
+				;
+		}
+	}
+	return NULL;
+}
+
+/*
+  Split the extents into aligned ranges and copy them on a pool of threads with
+  positional copy_file_range or pread/pwrite. Same contract as copyExtents
+*/
+static off_t copyParallel(int in, int out, const struct extent *ext, size_t numExt, unsigned int threads, bool dropCache, off_t *size)
+{
+	/* Aim for a few chunks per thread so a slow range doesn't leave the others idle */
+	off_t chunk = *size / ((off_t) threads * 4);
+	if (chunk < PAR_CHUNK_MIN)
+		chunk = PAR_CHUNK_MIN;
+	chunk = (chunk + PAR_CHUNK_ALIGN - 1) & ~((off_t) PAR_CHUNK_ALIGN - 1);
+
+	size_t max = numExt + *size / chunk + 1;
+	struct parallelCopy pc = { .in = in, .out = out, .chunks = malloc(max * sizeof(struct extent)), .numChunks = 0,
+				   .dropCache = dropCache };
+	if (pc.chunks == NULL) { /* No room to split it up, copy it on this thread */
+		struct copyMethod m = { false, false };
+		return copyExtents(in, out, ext, numExt, &m, dropCache, size);
+	}
+	atomic_init(&pc.next, 0);
+	atomic_init(&pc.written, 0);
+	atomic_init(&pc.shrunk, -1);
+	atomic_init(&pc.failed, false);
+	for (size_t i = 0; i < numExt; ++i) {
+		off_t off = ext[i].off;
+		off_t end = ext[i].off + ext[i].len;
+		while (off < end) {
+			/* Cut at the next aligned boundary so chunks line up across extents */
+			off_t cut = (off / chunk + 1) * chunk;
+			if (cut > end)
+				cut = end;
+			pc.chunks[pc.numChunks].off = off;
+			pc.chunks[pc.numChunks].len = cut - off;
+			++pc.numChunks;
+			off = cut;
+		}
+	}
+
+	pthread_t tids[MAX_THREADS];
+	unsigned int started = 0;
+	for (unsigned int i = 0; i < threads && i < pc.numChunks; ++i) {
+		if (pthread_create(&tids[started], NULL, copyWorker, &pc) != 0)
+			break;
+		++started;
+	}
+	if (started == 0) /* Couldn't get any threads, do it ourselves */
+		copyWorker(&pc);
+	for (unsigned int i = 0; i < started; ++i)
+		pthread_join(tids[i], NULL);
+	free(pc.chunks);
+
+	if (atomic_load(&pc.failed))
+		return -1;
+	if (atomic_load(&pc.shrunk) != -1)
+		*size = atomic_load(&pc.shrunk);
+	return atomic_load(&pc.written);
+}
+
+/* Buffers shared by the reading and writing sides of a direct copy */
+struct directCopy {
+	int out;
+	char *buf[2];
+	size_t len[2]; /* Bytes of data in each buffer */
+	off_t off[2]; /* File offset each buffer belongs at */
+	bool full[2];
+	bool done; /* Reader hit end of file */
+	int err; /* errno of a failed write. Set and read under lock */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+/* Write out buffer k. The last one is padded to the block size O_DIRECT requires */
+static void directWrite(struct directCopy *dc, unsigned int k)
+{
+	size_t len = (dc->len[k] + DIRECT_ALIGN - 1) & ~((size_t) DIRECT_ALIGN - 1);
+	memset(dc->buf[k] + dc->len[k], 0, len - dc->len[k]);
+	int err = 0;
+	for (size_t w = 0; w < len && err == 0; ) {
+		ssize_t n = pwrite(dc->out, dc->buf[k] + w, len - w, dc->off[k] + w);
+		if (n == -1 && errno != EINTR)
+			err = errno;
+		else if (n > 0)
+			w += n;
+	}
+	if (err != 0) {
+		pthread_mutex_lock(&dc->lock);
+		if (dc->err == 0)
+			dc->err = err;
+		pthread_mutex_unlock(&dc->lock);
+	}
+}
+
+/* Writer thread: drain the buffers in order until the reader is done */
+static void* directWriter(void *arg)
+{
+	struct directCopy *dc = arg;
+	for (unsigned int k = 0; ; k ^= 1) {
+		pthread_mutex_lock(&dc->lock);
+		while (!dc->full[k] && !dc->done)
+			pthread_cond_wait(&dc->cond, &dc->lock);
+		if (!dc->full[k]) {
+			pthread_mutex_unlock(&dc->lock);
+			return NULL;
+		}
+		pthread_mutex_unlock(&dc->lock);
+
+		directWrite(dc, k);
+
+		pthread_mutex_lock(&dc->lock);
+		dc->full[k] = false;
+		pthread_cond_broadcast(&dc->cond);
+		pthread_mutex_unlock(&dc->lock);
+	}
+}
+
+/*
+  Copy with O_DIRECT through two aligned buffers: while a helper thread writes
+  one buffer the next one is being read, so neither device sits idle and the
+  page cache is never touched. Returns bytes copied, or -1
+*/
+static off_t copyDirect(int in, int out)
+{
+	struct directCopy dc = { .out = out };
+	dc.buf[0] = spGet(directPool);
+	dc.buf[1] = spGet(directPool);
+	if (dc.buf[0] == NULL || dc.buf[1] == NULL) {
+		if (dc.buf[0] != NULL)
+			spPut(directPool, dc.buf[0]);
+		return -1;
+	}
+	pthread_mutex_init(&dc.lock, NULL);
+	pthread_cond_init(&dc.cond, NULL);
+	pthread_t tid;
+	bool threaded = pthread_create(&tid, NULL, directWriter, &dc) == 0;
+
+	off_t total = 0;
+	int readErr = 0;
+	for (unsigned int k = 0; ; k ^= 1) {
+		pthread_mutex_lock(&dc.lock);
+		while (dc.full[k])
+			pthread_cond_wait(&dc.cond, &dc.lock);
+		int err = dc.err;
+		pthread_mutex_unlock(&dc.lock);
+		if (err != 0)
+			break;
+
+		/* Fill the whole buffer so only the very last write can be unaligned */
+		size_t len = 0;
+		while (len < DIRECT_BUF) {
+			ssize_t n = pread(in, dc.buf[k] + len, DIRECT_BUF - len, total + len);
+			if (n == -1 && errno == EINTR)
+				continue;
+			if (n == -1)
+				readErr = errno;
+			if (n <= 0)
+				break;
+			len += n;
+		}
+		if (len > 0) {
+			dc.len[k] = len;
+			dc.off[k] = total;
+			total += len;
+			if (threaded) {
+				pthread_mutex_lock(&dc.lock);
+				dc.full[k] = true;
+				pthread_cond_broadcast(&dc.cond);
+				pthread_mutex_unlock(&dc.lock);
+			}
+			else /* No helper thread, write it ourselves */
+				directWrite(&dc, k);
+		}
+		if (len < DIRECT_BUF || readErr != 0)
+			break;
+	}
+
+	pthread_mutex_lock(&dc.lock);
+	dc.done = true;
+	pthread_cond_broadcast(&dc.cond);
+	pthread_mutex_unlock(&dc.lock);
+	if (threaded)
+		pthread_join(tid, NULL);
+	pthread_mutex_destroy(&dc.lock);
+	pthread_cond_destroy(&dc.cond);
+	spPut(directPool, dc.buf[0]);
+	spPut(directPool, dc.buf[1]);
+
+	if (readErr != 0 || dc.err != 0) {
+		errno = readErr != 0 ? readErr : dc.err;
+		return -1;
+	}
+	/* Cut off the padding of the last block */
+	if (ftruncate(out, total) == -1)
+		return -1;
+	return total;
+}
+
+/*
+  Copy the contents of in to out
+  Regular files are copied region by region, and with sparse copying only the
+  regions holding data are written so holes stay holes in the destination
+  Returns bytes of data written, or -1 on failure
+*/
+static off_t copyData(int in, int out, const struct stat *st, const struct cpOpts *opts)
+{
+	struct copyMethod m = { false, false };
+	if (!S_ISREG(st->st_mode)) { /* Pipes, devices, ... just stream them */
+		off_t r = copyBuffer(in, out, -1, -1);
+		return r < 0 ? -1 : r;
+	}
+
+	struct extent whole = { 0, st->st_size };
+	struct extent *ext = &whole;
+	ssize_t numExt = st->st_size > 0 ? 1 : 0;
+	bool sparse = opts->sparse == SPARSE_ALWAYS
+		|| (opts->sparse == SPARSE_AUTO && (off_t) st->st_blocks * 512 < st->st_size);
+	if (sparse) {
+		numExt = findExtents(in, st->st_size, &ext);
+		if (numExt == -1) { /* No hole information, copy everything */
+			ext = &whole;
+			numExt = 1;
+		}
+	}
+
+	off_t written;
+	off_t size = st->st_size; /* Final size of the destination */
+	for (ssize_t i = 0; i < numExt; ++i)
+		fallocate(out, FALLOC_FL_KEEP_SIZE, ext[i].off, ext[i].len); /* Best effort, not every filesystem supports it */
+	if (opts->threads > 1 && st->st_size >= PAR_MIN_SIZE)
+		written = copyParallel(in, out, ext, numExt, opts->threads, opts->dropCache, &size);
+	else
+		written = copyExtents(in, out, ext, numExt, &m, opts->dropCache, &size);
+	if (ext != &whole)
+		free(ext);
+	if (written == -1)
+		return -1;
+
+	if (size == st->st_size) {
+		/* The file may have grown since we stat'd it, pick up the rest */
+		off_t rest = copyBuffer(in, out, size, -1);
+		if (rest < 0)
+			return -1;
+		written += rest;
+		size += rest;
+	}
+	/* Skipped regions are already holes in the truncated destination, this sets the size for a trailing hole */
+	if (ftruncate(out, size) == -1)
+		return -1;
+	return written;
+}
+
+/* Report a failure with errno and remember it for the exit status */
+static atomic_bool failed;
+
+static void cpError(const char *what, const char *path)
+{
+	report("cp: %s %s: %s\n", what, path, strerror(errno));
+	atomic_store(&failed, true);
+}
+
+/*
+  Copy the regular file (or special file contents) src to dst, both relative to directory fds
+  srcPath/dstPath are only used in messages. threads > 1 allows splitting a large file
+  Returns 0 on success, 1 on failure
+*/
+static int copyFileAt(int srcDir, const char *src, int dstDir, const char *dst, const struct cpOpts *opts,
+		      unsigned int threads, const char *srcPath, const char *dstPath)
+{
+	int in = openat(srcDir, src, O_RDONLY | O_CLOEXEC);
+
+	if (in == -1) {
+		if (errno == ENOENT)
+			report("cp: file %s does not exist\n", srcPath);
+		else
+			cpError("cannot open", srcPath);
 		return 1;
 	}
 
-	FILE *fp_source = fopen(argv[1], "r");
+	struct stat st;
+	if (fstat(in, &st) == -1) {
+		cpError("cannot stat", srcPath);
+		close(in);
+		return 1;
+	}
+	if (S_ISDIR(st.st_mode)) {
+		report("cp: %s is a directory\n", srcPath);
+		close(in);
+		return 1;
+	}
 
-	if (!fp_source) {
-		printf("cp: file %s does not exist\n",argv[1]);
+	struct stat dst_st;
+	if (fstatat(dstDir, dst, &dst_st, 0) == 0 && dst_st.st_dev == st.st_dev && dst_st.st_ino == st.st_ino) {
+		report("cp: %s and %s are the same file\n", srcPath, dstPath);
+		close(in);
 		return 1;
 	}
-	
+
 	//We're copying over this file anyways, clean opening
-	remove(argv[2]);
-	FILE *fp_dest = fopen(argv[2], "w");
+	int out = openat(dstDir, dst, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 07777);
+	if (out == -1) {
+		report("cp: cannot create %s\n", dstPath);
+		close(in);
+		return 1;
+	}
+
+	int r = 0;
+	off_t written = 0;
+	struct cpOpts fileOpts = *opts;
+	fileOpts.threads = threads;
+	if (opts->reflink != REFLINK_NEVER && S_ISREG(st.st_mode) && copyReflink(in, out) == 0)
+		; /* Cloned, no data to move */
+	else if (opts->reflink == REFLINK_ALWAYS) {
+		/* Only regular files were attempted, errno says nothing about anything else */
+		report("cp: failed to clone %s to %s: %s\n", srcPath, dstPath, strerror(S_ISREG(st.st_mode) ? errno : EOPNOTSUPP));
+		r = 1;
+	}
+	else {
+		posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+		bool direct = false;
+		if (opts->direct && S_ISREG(st.st_mode)) {
+			/* Not every filesystem takes O_DIRECT (tmpfs doesn't), evict the cache behind us instead */
+			direct = fcntl(in, F_SETFL, O_DIRECT) == 0 && fcntl(out, F_SETFL, O_DIRECT) == 0;
+			if (!direct) {
+				fcntl(in, F_SETFL, 0);
+				fileOpts.dropCache = true;
+			}
+		}
+		if (direct)
+			written = copyDirect(in, out);
+		else
+			written = copyData(in, out, &st, &fileOpts);
+		if (written == -1) {
+			report("cp: error copying %s to %s: %s\n", srcPath, dstPath, strerror(errno));
+			r = 1;
+		}
+	}
+	if (opts->verbose && r == 0)
+		report("'%s' -> '%s' (%lld bytes written, %lld apparent)\n", srcPath, dstPath,
+		       (long long) written, (long long) st.st_size);
+	/* open() only applies the mode to new files and is subject to umask */
+	fchmod(out, st.st_mode & 07777);
+	close(in);
+	if (close(out) == -1)
+		r = 1;
+	return r;
+}
+
+/*
+  A directory being copied. It stays open until every task below it is done,
+  so its children are opened and created relative to its fds rather than by path
+*/
+struct dirNode {
+	int srcFd;
+	int dstFd;
+	char *srcPath; /* For messages */
+	char *dstPath;
+	mode_t mode; /* Applied last, so read-only directories can still be filled */
+	struct dirNode *parent;
+	atomic_uint refs; /* Outstanding tasks inside this directory, plus one for its own listing */
+};
+
+/* One unit of work: a directory to list, or a batch of non-directory entries to copy */
+struct cpTask {
+	struct dirNode *parent;
+	bool isDir;
+	char *dstName; /* Destination name if it differs from the source name (top-level arguments only) */
+	size_t numEntries;
+	struct {
+		char *name;
+		unsigned char type; /* d_type */
+	} entries[FILE_BATCH];
+};
+
+/* Pseudo directory that top-level arguments are relative to */
+static struct dirNode cwdNode = { .srcFd = AT_FDCWD, .dstFd = AT_FDCWD, .srcPath = "", .dstPath = "", .mode = 0, .parent = NULL };
+
+static struct cpTask* newTask(struct dirNode *parent, bool isDir)
+{
+	struct cpTask *t = malloc(sizeof(struct cpTask));
+	t->parent = parent;
+	t->isDir = isDir;
+	t->dstName = NULL;
+	t->numEntries = 0;
+	if (parent != &cwdNode)
+		atomic_fetch_add(&parent->refs, 1);
+	return t;
+}
+
+/* Drop a reference. The last one finishes the directory and releases its parent */
+static void releaseNode(struct dirNode *n)
+{
+	while (n != &cwdNode && atomic_fetch_sub(&n->refs, 1) == 1) {
+		struct dirNode *parent = n->parent;
+		fchmod(n->dstFd, n->mode);
+		close(n->srcFd);
+		close(n->dstFd);
+		free(n->srcPath);
+		free(n->dstPath);
+		free(n);
+		n = parent;
+	}
+}
+
+/* Join a directory path and a name for messages */
+static char* joinPath(const char *dir, const char *name)
+{
+	if (dir[0] == '\0')
+		return strdup(name);
+	char *p = malloc(strlen(dir) + strlen(name) + 2);
+	sprintf(p, "%s/%s", dir, name);
+	return p;
+}
+
+/* Create the destination directory, list the source and queue its entries */
+static void copyDir(struct workpool *pool, struct cpTask *t)
+{
+	struct dirNode *p = t->parent;
+	const char *name = t->entries[0].name;
+	const char *dstName = t->dstName ? t->dstName : name;
+	struct dirNode *n = malloc(sizeof(struct dirNode));
+	n->srcPath = joinPath(p->srcPath, name);
+	n->dstPath = joinPath(p->dstPath, dstName);
+	n->parent = p;
+	n->srcFd = openat(p->srcFd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC | (p == &cwdNode ? 0 : O_NOFOLLOW));
+	struct stat st;
+	if (n->srcFd == -1 || fstat(n->srcFd, &st) == -1) {
+		cpError("cannot open directory", n->srcPath);
+		goto fail;
+	}
+	n->mode = st.st_mode & 07777;
+	/* Owner needs full access while we fill it, the real mode goes on at the end */
+	if (mkdirat(p->dstFd, dstName, 0700) == -1 && errno != EEXIST) {
+		cpError("cannot create directory", n->dstPath);
+		goto fail;
+	}
+	n->dstFd = openat(p->dstFd, dstName, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (n->dstFd == -1) {
+		cpError("cannot open directory", n->dstPath);
+		goto fail;
+	}
+	atomic_init(&n->refs, 1);
+	if (p != &cwdNode)
+		atomic_fetch_add(&p->refs, 1);
+
+	DIR *d = fdopendir(dup(n->srcFd));
+	if (d == NULL) {
+		cpError("cannot read directory", n->srcPath);
+		releaseNode(n);
+		return;
+	}
+	struct cpTask *files = NULL;
+	struct dirent *ent;
+	while ((ent = readdir(d)) != NULL) {
+		if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+			continue;
+		if (ent->d_type == DT_DIR) {
+			struct cpTask *sub = newTask(n, true);
+			sub->entries[0].name = strdup(ent->d_name);
+			sub->numEntries = 1;
+			wpPush(pool, sub);
+			continue;
+		}
+		/* Batch everything else so huge flat directories still spread across workers */
+		if (files == NULL)
+			files = newTask(n, false);
+		files->entries[files->numEntries].name = strdup(ent->d_name);
+		files->entries[files->numEntries].type = ent->d_type;
+		if (++files->numEntries == FILE_BATCH) {
+			wpPush(pool, files);
+			files = NULL;
+		}
+	}
+	if (files != NULL)
+		wpPush(pool, files);
+	closedir(d);
+	releaseNode(n);
+	return;
+
+fail:
+	if (n->srcFd != -1)
+		close(n->srcFd);
+	free(n->srcPath);
+	free(n->dstPath);
+	free(n);
+}
+
+/* Copy one non-directory entry of a directory */
+static void copyEntry(struct workpool *pool, struct dirNode *p, const char *name, unsigned char type, const struct cpOpts *opts)
+{
+	char *srcPath = joinPath(p->srcPath, name);
+	char *dstPath = joinPath(p->dstPath, name);
+	struct stat st;
+	if (type == DT_UNKNOWN) { /* Filesystem doesn't fill in d_type */
+		if (fstatat(p->srcFd, name, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+			cpError("cannot stat", srcPath);
+			goto done;
+		}
+		type = IFTODT(st.st_mode);
+	}
+	if (type == DT_DIR) {
+		struct cpTask *sub = newTask(p, true);
+		sub->entries[0].name = strdup(name);
+		sub->numEntries = 1;
+		wpPush(pool, sub);
+	}
+	else if (type == DT_REG) {
+		if (copyFileAt(p->srcFd, name, p->dstFd, name, opts, 1, srcPath, dstPath) != 0)
+			atomic_store(&failed, true);
+	}
+	else if (type == DT_LNK) {
+		char target[PATH_MAX];
+		ssize_t len = readlinkat(p->srcFd, name, target, sizeof(target) - 1);
+		if (len == -1) {
+			cpError("cannot read link", srcPath);
+			goto done;
+		}
+		target[len] = '\0';
+		unlinkat(p->dstFd, name, 0);
+		if (symlinkat(target, p->dstFd, name) == -1)
+			cpError("cannot create link", dstPath);
+	}
+	else { /* FIFOs, sockets and device nodes are recreated rather than read */
+		if (fstatat(p->srcFd, name, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+			cpError("cannot stat", srcPath);
+			goto done;
+		}
+		if (mknodat(p->dstFd, name, st.st_mode, st.st_rdev) == -1)
+			cpError("cannot create", dstPath);
+	}
+done:
+	free(srcPath);
+	free(dstPath);
+}
+
+/* Per-worker io_uring state for batching small files */
+struct workerRing {
+	int state; /* 0 = not set up yet, 1 = usable, -1 = io_uring unavailable */
+	struct uring ring;
+	char *bufs; /* FILE_BATCH buffers of URING_MAX_FILE bytes */
+	struct smallFile {
+		struct statx stx;
+		int in;
+		int out;
+		int res[OP_COUNT]; /* Result of each operation on this file */
+		bool fallback; /* Copy with the regular path instead */
+	} files[FILE_BATCH];
+};
+
+static struct workerRing *rings; /* One per worker, indexed by wpWorker() */
+
+/* Get the calling worker's ring, setting it up on first use. NULL if io_uring can't be used */
+static struct workerRing* getRing(struct workpool *pool)
+{
+	struct workerRing *w = &rings[wpWorker(pool)];
+	if (w->state == 0) {
+		w->state = -1;
+		if (uringInit(&w->ring, 2 * FILE_BATCH) == 0) {
+			if (posix_memalign((void**) &w->bufs, BUF_ALIGN, (size_t) FILE_BATCH * URING_MAX_FILE) == 0)
+				w->state = 1;
+			else
+				uringExit(&w->ring);
+		}
+	}
+	return w->state == 1 ? w : NULL;
+}
+
+/* Stop using io_uring on this worker. freeBufs is false while requests may still be filling the buffers */
+static void dropRing(struct workerRing *w, bool freeBufs)
+{
+	uringExit(&w->ring);
+	if (freeBufs)
+		free(w->bufs);
+	w->bufs = NULL;
+	w->state = -1;
+}
+
+#define URING_DATA(i, op) (((unsigned long long) (i) << 3) | (op))
+
+/*
+  Submit everything queued and record the result of all n operations.
+  Returns false if io_uring_enter failed, after tearing the ring down: the
+  entries are already published in the SQ ring and would otherwise go to
+  the kernel again with the next phase
+*/
+static bool runPhase(struct workerRing *w, unsigned int n)
+{
+	if (n == 0)
+		return true;
+	if (uringSubmit(&w->ring, n) == -1) { /* Nothing was taken, so nothing is in flight */
+		dropRing(w, true);
+		return false;
+	}
+	for (unsigned int done = 0; done < n; ) {
+		struct io_uring_cqe *cqe = uringPeek(&w->ring);
+		if (cqe == NULL) {
+			if (uringSubmit(&w->ring, n - done) == -1) {
+				dropRing(w, false);
+				return false;
+			}
+			continue;
+		}
+		w->files[cqe->user_data >> 3].res[cqe->user_data & 7] = cqe->res;
+		uringSeen(&w->ring);
+		++done;
+	}
+	return true;
+}
+
+/* io_uring failed partway through a batch: close what it opened and send every file down the regular path */
+static void abandonBatch(struct workerRing *w, size_t num)
+{
+	for (size_t i = 0; i < num; ++i) {
+		struct smallFile *f = &w->files[i];
+		if (f->fallback)
+			continue;
+		if (f->in != -1)
+			close(f->in);
+		if (f->out != -1)
+			close(f->out);
+		f->in = f->out = -1;
+		f->fallback = true;
+	}
+}
+
+/*
+  Copy a batch of small regular files with a handful of io_uring_enter calls
+  instead of ~7 syscalls per file. Runs in four phases over the whole batch:
+  statx + open source, create destination + read, write + close source, close destination
+  Anything that isn't a small regular file, or trips over an error before
+  writing, is handed back to copyEntry()
+*/
+static void copyBatchUring(struct workpool *pool, struct cpTask *t, const struct cpOpts *opts, struct workerRing *w)
+{
+	struct dirNode *p = t->parent;
+	struct smallFile *f = w->files;
+	size_t num = t->numEntries;
+	unsigned int n = 0;
+	bool ok;
+	bool unsupported = false; /* Kernel has io_uring but not the opcodes used here */
+
+	for (size_t i = 0; i < num; ++i) {
+		f[i].in = f[i].out = -1;
+		f[i].fallback = t->entries[i].type != DT_REG && t->entries[i].type != DT_UNKNOWN;
+		if (f[i].fallback)
+			continue;
+		uringPrepStatx(uringGetSqe(&w->ring), p->srcFd, t->entries[i].name, AT_SYMLINK_NOFOLLOW,
+			       STATX_TYPE | STATX_MODE | STATX_SIZE, &f[i].stx, URING_DATA(i, OP_STATX));
+		/* The type isn't known yet: a FIFO would block the open, and the whole batch with it */
+		int nonBlock = t->entries[i].type == DT_UNKNOWN ? O_NONBLOCK : 0;
+		uringPrepOpenat(uringGetSqe(&w->ring), p->srcFd, t->entries[i].name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC | nonBlock, 0,
+				URING_DATA(i, OP_OPEN_SRC));
+		n += 2;
+	}
+	ok = runPhase(w, n);
+
+	n = 0;
+	for (size_t i = 0; ok && i < num; ++i) {
+		if (f[i].fallback)
+			continue;
+		if (f[i].res[OP_OPEN_SRC] >= 0)
+			f[i].in = f[i].res[OP_OPEN_SRC];
+		if (f[i].res[OP_STATX] < 0 || f[i].in == -1 || !S_ISREG(f[i].stx.stx_mode) || f[i].stx.stx_size > URING_MAX_FILE) {
+			if (f[i].res[OP_STATX] == -EINVAL)
+				unsupported = true;
+			if (f[i].in != -1)
+				close(f[i].in);
+			f[i].fallback = true;
+			continue;
+		}
+		if (t->entries[i].type == DT_UNKNOWN) /* Regular after all: reads should wait for the disk, not fail with EAGAIN */
+			fcntl(f[i].in, F_SETFL, 0);
+		uringPrepOpenat(uringGetSqe(&w->ring), p->dstFd, t->entries[i].name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+				f[i].stx.stx_mode & 07777, URING_DATA(i, OP_OPEN_DST));
+		uringPrepRead(uringGetSqe(&w->ring), f[i].in, w->bufs + i * URING_MAX_FILE, URING_MAX_FILE, 0,
+			      URING_DATA(i, OP_READ));
+		n += 2;
+	}
+	ok = ok && runPhase(w, n);
+
+	n = 0;
+	for (size_t i = 0; ok && i < num; ++i) {
+		if (f[i].fallback)
+			continue;
+		if (f[i].res[OP_OPEN_DST] >= 0)
+			f[i].out = f[i].res[OP_OPEN_DST];
+		/* A full buffer means the file grew past the small file limit */
+		if (f[i].out == -1 || f[i].res[OP_READ] < 0 || f[i].res[OP_READ] == URING_MAX_FILE) {
+			close(f[i].in);
+			if (f[i].out != -1)
+				close(f[i].out);
+			f[i].fallback = true;
+			continue;
+		}
+		uringPrepWrite(uringGetSqe(&w->ring), f[i].out, w->bufs + i * URING_MAX_FILE, f[i].res[OP_READ], 0,
+			       URING_DATA(i, OP_WRITE));
+		uringPrepClose(uringGetSqe(&w->ring), f[i].in, URING_DATA(i, OP_CLOSE_SRC));
+		n += 2;
+	}
+	ok = ok && runPhase(w, n);
+
+	n = 0;
+	for (size_t i = 0; ok && i < num; ++i) {
+		if (f[i].fallback)
+			continue;
+		f[i].in = -1; /* Closed by the last phase */
+		uringPrepClose(uringGetSqe(&w->ring), f[i].out, URING_DATA(i, OP_CLOSE_DST));
+		++n;
+	}
+	ok = ok && runPhase(w, n);
+	if (!ok)
+		abandonBatch(w, num);
+	else if (unsupported)
+		dropRing(w, true);
+
+	for (size_t i = 0; i < num; ++i) {
+		if (f[i].fallback) {
+			copyEntry(pool, p, t->entries[i].name, t->entries[i].type, opts);
+			continue;
+		}
+		if (f[i].res[OP_WRITE] != f[i].res[OP_READ] || f[i].res[OP_CLOSE_DST] < 0) {
+			char *dstPath = joinPath(p->dstPath, t->entries[i].name);
+			errno = f[i].res[OP_WRITE] < 0 ? -f[i].res[OP_WRITE] : f[i].res[OP_CLOSE_DST] < 0 ? -f[i].res[OP_CLOSE_DST] : EIO;
+			cpError("error writing", dstPath);
+			free(dstPath);
+		}
+		else if (opts->verbose) {
+			char *srcPath = joinPath(p->srcPath, t->entries[i].name);
+			char *dstPath = joinPath(p->dstPath, t->entries[i].name);
+			report("'%s' -> '%s' (%d bytes written, %lld apparent)\n", srcPath, dstPath,
+			       f[i].res[OP_WRITE], (long long) f[i].stx.stx_size);
+			free(srcPath);
+			free(dstPath);
+		}
+	}
+}
 
-	char c;
+/* Pool callback */
+static void runTask(struct workpool *pool, void *task, void *arg)
+{
+	struct cpTask *t = task;
+	const struct cpOpts *opts = arg;
+	struct workerRing *w;
+	if (t->isDir)
+		copyDir(pool, t);
+	else if (opts->uring && (w = getRing(pool)) != NULL)
+		copyBatchUring(pool, t, opts, w);
+	else {
+		for (size_t i = 0; i < t->numEntries; ++i)
+			copyEntry(pool, t->parent, t->entries[i].name, t->entries[i].type, opts);
+	}
+	for (size_t i = 0; i < t->numEntries; ++i)
+		free(t->entries[i].name);
+	free(t->dstName);
+	releaseNode(t->parent);
+	free(t);
+}
+
+/* Is path (or the directory it would be created in) inside dir? */
+static bool isInside(const char *dir, const char *path)
+{
+	char d[PATH_MAX], p[PATH_MAX];
+	if (realpath(dir, d) == NULL)
+		return false;
+	if (realpath(path, p) == NULL) {
+		/* Doesn't exist yet, check where it would go */
+		char tmp[PATH_MAX];
+		snprintf(tmp, sizeof(tmp), "%s", path);
+		if (realpath(dirname(tmp), p) == NULL)
+			return false;
+	}
+	size_t len = strlen(d);
+	return strncmp(d, p, len) == 0 && (p[len] == '/' || p[len] == '\0');
+}
+
+int main (int argc, char** argv) {
+
+	struct cpOpts opts = { REFLINK_AUTO, SPARSE_AUTO, false, 0, false, true, false, false };
+	swInit(&msgs, STDOUT_FILENO, OUT_BUF);
+	atexit(flushReports);
+	bufPool = spCreate(BUF_SIZE, BUF_ALIGN);
+	directPool = spCreate(DIRECT_BUF, DIRECT_ALIGN);
+	static struct option longOpts[] = {
+		{ "reflink", optional_argument, NULL, 'L' },
+		{ "sparse", required_argument, NULL, 'S' },
+		{ "verbose", no_argument, NULL, 'v' },
+		{ "jobs", required_argument, NULL, 'j' },
+		{ "recursive", no_argument, NULL, 'r' },
+		{ "no-uring", no_argument, NULL, 'U' },
+		{ "direct", no_argument, NULL, 'D' },
+		{ "drop-cache", no_argument, NULL, 'C' },
+		{ NULL, 0, NULL, 0 }
+	};
+	int c;
+	while ((c = getopt_long(argc, argv, "j:rRv", longOpts, NULL)) != -1) {
+		switch (c) {
+		case 'r':
+		case 'R':
+			opts.recursive = true;
+			break;
+		case 'j':
+			opts.threads = atoi(optarg);
+			if (opts.threads < 1 || opts.threads > MAX_THREADS) {
+				report("cp: number of threads must be between 1 and %d\n", MAX_THREADS);
+				return 1;
+			}
+			break;
+		case 'S':
+			if (strcmp(optarg, "always") == 0)
+				opts.sparse = SPARSE_ALWAYS;
+			else if (strcmp(optarg, "auto") == 0)
+				opts.sparse = SPARSE_AUTO;
+			else if (strcmp(optarg, "never") == 0)
+				opts.sparse = SPARSE_NEVER;
+			else {
+				report("cp: invalid argument '%s' for --sparse\n", optarg);
+				return 1;
+			}
+			break;
+		case 'v':
+			opts.verbose = true;
+			break;
+		case 'U':
+			opts.uring = false;
+			break;
+		case 'D':
+			opts.direct = true;
+			break;
+		case 'C':
+			opts.dropCache = true;
+			break;
+		case 'L':
+			if (!optarg || strcmp(optarg, "always") == 0)
+				opts.reflink = REFLINK_ALWAYS;
+			else if (strcmp(optarg, "auto") == 0)
+				opts.reflink = REFLINK_AUTO;
+			else if (strcmp(optarg, "never") == 0)
+				opts.reflink = REFLINK_NEVER;
+			else {
+				report("cp: invalid argument '%s' for --reflink\n", optarg);
+				return 1;
+			}
+			break;
+		default:
+			return 1;
+		}
+	}
+	argc -= optind - 1;
+	argv += optind - 1;
+	if (opts.threads == 0)
+		opts.threads = opts.recursive ? TREE_THREADS : 1;
+	/* Clones have to go through the regular path to be attempted on every file */
+	if (opts.reflink == REFLINK_ALWAYS)
+		opts.uring = false;
+	/* Batched small files go through the page cache */
+	if (opts.direct || opts.dropCache)
+		opts.uring = false;
+	/* Modes are copied exactly, as fchmod() would do afterwards anyway, so files created by io_uring get them too */
+	umask(0);
+
+	if (argc < 3) {
+		report("cp: invalid number of arguments\n");
+		return 1;
+	}
+
+	const char *dest = argv[argc - 1];
+	struct stat st;
+	bool destIsDir = stat(dest, &st) == 0 && S_ISDIR(st.st_mode);
+	if (argc > 3 && !destIsDir) {
+		report("cp: invalid number of arguments\n");
+		return 1;
+	}
+
+	/* Large trees need an fd per open directory, per worker */
+	struct rlimit rl;
+	if (opts.recursive && getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+	struct workpool *pool = NULL;
+
+	for (int i = 1; i < argc - 1; ++i) {
+		const char *src = argv[i];
+		char target[PATH_MAX];
+		char tmp[PATH_MAX];
+		if (destIsDir) { /* Copy into the directory under the same name */
+			snprintf(tmp, sizeof(tmp), "%s", src);
+			snprintf(target, sizeof(target), "%s/%s", dest, basename(tmp));
+		}
+		else
+			snprintf(target, sizeof(target), "%s", dest);
+
+		if (stat(src, &st) == 0 && S_ISDIR(st.st_mode)) {
+			if (!opts.recursive) {
+				report("cp: %s is a directory\n", src);
+				atomic_store(&failed, true);
+				continue;
+			}
+			if (isInside(src, target)) {
+				report("cp: cannot copy directory %s into itself\n", src);
+				atomic_store(&failed, true);
+				continue;
+			}
+			if (pool == NULL) {
+				pool = wpCreate(opts.threads, runTask, &opts);
+				rings = calloc(opts.threads, sizeof(struct workerRing));
+			}
+			struct cpTask *t = newTask(&cwdNode, true);
+			t->entries[0].name = strdup(src);
+			t->numEntries = 1;
+			t->dstName = strdup(target);
+			wpPush(pool, t);
+		}
+		else if (copyFileAt(AT_FDCWD, src, AT_FDCWD, target, &opts, opts.threads, src, target) != 0)
+			atomic_store(&failed, true);
+	}
 
-	while (( c = fgetc(fp_source)) != EOF) {
-		fputc(c,fp_dest);
+	if (pool != NULL) {
+		wpRun(pool);
+		for (unsigned int i = 0; i < opts.threads; ++i) {
+			if (rings[i].state == 1) {
+				uringExit(&rings[i].ring);
+				free(rings[i].bufs);
+			}
+		}
+		free(rings);
+		wpDestroy(pool);
 	}
-	fclose(fp_source);
-	fclose(fp_dest);
-	
-	return 0;
+	return atomic_load(&failed) ? 1 : 0;
 }
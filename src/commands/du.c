@@ -0,0 +1,594 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include "uring.h"
+#include "workpool.h"
+#include "soyio.h"
+
+#define DENTS_BUF (1 << 20) /* Bytes of directory entries fetched per getdents64 call */
+#define STAT_BATCH 256 /* statx calls submitted per io_uring_enter */
+#define OUT_BUF (1 << 20)
+#define TREE_THREADS 8 /* Default workers, walking trees is mostly waiting on metadata I/O */
+#define MAX_THREADS 64
+#define STRIPES 64 /* Independently locked parts of the hard link set */
+#define STAT_MASK (STATX_TYPE | STATX_NLINK | STATX_INO | STATX_BLOCKS)
+
+/* Record layout returned by getdents64 */
+struct linuxDirent64 {
+	unsigned long long d_ino;
+	long long d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+/*
+  A directory in the walk. Only the worker that scans a directory adds to its
+  own blocks and children, so the sums need no atomics or locks; subtree
+  totals are added up once the walk is over. The nodes are kept until then,
+  the fd only until every subdirectory has opened its own relative to it
+*/
+struct duNode {
+	char *path;
+	const char *name; /* Relative to the parent's fd */
+	int fd;
+	bool isDir;
+	struct duNode *parent;
+	unsigned int depth; /* 1 for an operand */
+	unsigned long long pos; /* Index among the entries of the parent's listing, for an operand its argument index */
+	atomic_uint refs; /* Own scan plus subdirectories not opened yet */
+	unsigned long long blocks; /* 512-byte blocks of the directory itself and the files directly in it */
+	unsigned long long total; /* Including subdirectories, filled in at the end */
+	struct duNode **children;
+	size_t numChildren, maxChildren;
+};
+
+static struct duNode topNode = { .fd = AT_FDCWD };
+
+/* Per worker state: the getdents64 buffer and a ring to stat a batch of entries with one syscall */
+struct duWorker {
+	char *dents;
+	int ringState; /* 0 = not set up yet, 1 = usable, -1 = io_uring unavailable */
+	struct uring ring;
+	const char *names[STAT_BATCH];
+	unsigned long long pos[STAT_BATCH]; /* Index of each name in the directory's listing */
+	struct statx stx[STAT_BATCH];
+	int err[STAT_BATCH];
+};
+
+static struct duWorker *workers;
+
+struct devIno {
+	unsigned long long dev;
+	unsigned long long ino; /* 0 marks an empty slot */
+};
+
+/*
+  Every file with more than one link seen so far, so each is counted once.
+  It's counted where GNU du's depth-first walk in listing order would meet it
+  first, whichever thread gets to it first here, so the output doesn't depend
+  on timing: the walks keep the earliest link, and its blocks are added once
+  they're over. The set is split into stripes by hash, each with its own lock
+  and open addressing table, so threads rarely wait on each other
+*/
+struct link {
+	struct devIno id;
+	unsigned long long blocks;
+	struct duNode *dir; /* Directory of the earliest link so far, topNode for an operand */
+	unsigned long long pos; /* Its index in dir */
+	struct duNode *owner; /* Node the blocks go to: dir, or the operand itself */
+};
+
+struct stripe {
+	pthread_mutex_t lock;
+	struct link *slots;
+	size_t cap, len;
+	char pad[64]; /* Keep neighbouring locks off the same cache line */
+};
+
+static struct stripe stripes[STRIPES];
+static atomic_bool failed;
+
+static void reportError(const char *path, int err)
+{
+	fprintf(stderr, "du: %s: %s\n", path, strerror(err));
+	atomic_store(&failed, true);
+}
+
+static inline unsigned long long hashDevIno(unsigned long long dev, unsigned long long ino)
+{
+	unsigned long long h = (ino ^ (dev << 32 | dev >> 32)) * 0x9E3779B97F4A7C15ULL;
+	return h ^ (h >> 29);
+}
+
+/* Whether entry pos of directory a comes before entry pos of b in a depth-first walk of the operands in order */
+static bool walkedFirst(struct duNode *a, unsigned long long posA, struct duNode *b, unsigned long long posB)
+{
+	while (a->depth > b->depth) {
+		posA = a->pos;
+		a = a->parent;
+	}
+	while (b->depth > a->depth) {
+		posB = b->pos;
+		b = b->parent;
+	}
+	while (a != b) {
+		posA = a->pos;
+		a = a->parent;
+		posB = b->pos;
+		b = b->parent;
+	}
+	return posA < posB;
+}
+
+/* Record a link found as entry pos of dir, keeping it if it's the earliest of its file so far */
+static void addLink(const struct statx *stx, struct duNode *dir, unsigned long long pos, struct duNode *owner)
+{
+	unsigned long long dev = makedev(stx->stx_dev_major, stx->stx_dev_minor), ino = stx->stx_ino;
+	unsigned long long h = hashDevIno(dev, ino);
+	struct stripe *s = &stripes[h % STRIPES];
+	h /= STRIPES;
+	pthread_mutex_lock(&s->lock);
+	if (2 * (s->len + 1) > s->cap) { /* Keep it at most half full */
+		size_t cap = s->cap > 0 ? 2 * s->cap : 256;
+		struct link *slots = calloc(cap, sizeof(struct link));
+		for (size_t i = 0; i < s->cap; ++i) {
+			if (s->slots[i].id.ino == 0)
+				continue;
+			size_t j = hashDevIno(s->slots[i].id.dev, s->slots[i].id.ino) / STRIPES & (cap - 1);
+			while (slots[j].id.ino != 0)
+				j = (j + 1) & (cap - 1);
+			slots[j] = s->slots[i];
+		}
+		free(s->slots);
+		s->slots = slots;
+		s->cap = cap;
+	}
+	size_t i = h & (s->cap - 1);
+	while (s->slots[i].id.ino != 0 && (s->slots[i].id.ino != ino || s->slots[i].id.dev != dev))
+		i = (i + 1) & (s->cap - 1);
+	struct link *l = &s->slots[i];
+	if (l->id.ino == 0) {
+		*l = (struct link) { .id = { dev, ino }, .blocks = stx->stx_blocks, .dir = dir, .pos = pos, .owner = owner };
+		++s->len;
+	}
+	else if (walkedFirst(dir, pos, l->dir, l->pos)) {
+		l->dir = dir;
+		l->pos = pos;
+		l->owner = owner;
+	}
+	pthread_mutex_unlock(&s->lock);
+}
+
+/*
+  Files and directories of the operands counted so far, when there's more than
+  one. Like GNU du, anything already counted under an earlier operand isn't
+  counted again: a later operand below it is skipped entirely, and a later
+  operand above it skips it in the walk. Sorted once the walk starts
+*/
+static struct devIno *operands;
+static size_t numOperands;
+
+static int compareDevIno(const void *a, const void *b)
+{
+	const struct devIno *x = a, *y = b;
+	if (x->dev != y->dev)
+		return x->dev < y->dev ? -1 : 1;
+	return x->ino < y->ino ? -1 : x->ino > y->ino;
+}
+
+static bool isOperand(unsigned long long dev, unsigned long long ino)
+{
+	struct devIno key = { dev, ino };
+	return bsearch(&key, operands, numOperands, sizeof(struct devIno), compareDevIno) != NULL;
+}
+
+static void idOf(const struct statx *stx, struct devIno *id)
+{
+	id->dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+	id->ino = stx->stx_ino;
+}
+
+/*
+  Whether the operand at path is one of the operands before it or lies below
+  one. Climbs with .. rather than comparing paths, so any spelling is caught
+*/
+static bool countedBefore(const char *path, const struct statx *stx)
+{
+	char up[strlen(path) + 4];
+	struct devIno id, prev;
+	idOf(stx, &id);
+	strcpy(up, path);
+	if (S_ISDIR(stx->stx_mode))
+		strcat(up, "/..");
+	int fd = open(S_ISDIR(stx->stx_mode) ? up : dirname(up), O_PATH | O_DIRECTORY | O_CLOEXEC);
+	while (1) {
+		for (size_t i = 0; i < numOperands; ++i) {
+			if (operands[i].dev == id.dev && operands[i].ino == id.ino) {
+				if (fd != -1)
+					close(fd);
+				return true;
+			}
+		}
+		struct statx dir;
+		prev = id;
+		if (fd == -1 || statx(fd, "", AT_EMPTY_PATH, STATX_INO, &dir) == -1)
+			break;
+		idOf(&dir, &id);
+		if (id.dev == prev.dev && id.ino == prev.ino) /* / is its own parent */
+			break;
+		int parent = openat(fd, "..", O_PATH | O_DIRECTORY | O_CLOEXEC);
+		close(fd);
+		fd = parent;
+	}
+	if (fd != -1)
+		close(fd);
+	return false;
+}
+
+/*
+  Blocks entry pos of dir adds to the usage of owner. 0 for a file with more
+  than one link, whose blocks are added once the walk is over
+*/
+static unsigned long long countBlocks(const struct statx *stx, struct duNode *dir, unsigned long long pos, struct duNode *owner)
+{
+	if (stx->stx_nlink > 1 && !S_ISDIR(stx->stx_mode)) {
+		addLink(stx, dir, pos, owner);
+		return 0;
+	}
+	return stx->stx_blocks;
+}
+
+/* Add the blocks of each file with several links to where its earliest link is */
+static void addLinks(void)
+{
+	for (int i = 0; i < STRIPES; ++i)
+		for (size_t j = 0; j < stripes[i].cap; ++j)
+			if (stripes[i].slots[j].id.ino != 0)
+				stripes[i].slots[j].owner->blocks += stripes[i].slots[j].blocks;
+}
+
+static struct duNode* newNode(struct duNode *parent, const char *name, unsigned long long pos)
+{
+	struct duNode *c = calloc(1, sizeof(struct duNode));
+	if (parent == &topNode)
+		c->path = strdup(name);
+	else {
+		size_t len = strlen(parent->path);
+		c->path = malloc(len + strlen(name) + 2);
+		sprintf(c->path, len > 0 && parent->path[len - 1] == '/' ? "%s%s" : "%s/%s", parent->path, name);
+		if (parent->numChildren == parent->maxChildren) {
+			parent->maxChildren = parent->maxChildren > 0 ? 2 * parent->maxChildren : 8;
+			parent->children = realloc(parent->children, parent->maxChildren * sizeof(struct duNode*));
+		}
+		parent->children[parent->numChildren++] = c;
+	}
+	c->name = parent == &topNode ? c->path : c->path + strlen(c->path) - strlen(name);
+	c->parent = parent;
+	c->depth = parent->depth + 1;
+	c->pos = pos;
+	c->fd = -1;
+	atomic_init(&c->refs, 1);
+	return c;
+}
+
+/* Drop one reference to n's fd, closing it once no subdirectory still needs it */
+static void release(struct duNode *n)
+{
+	if (n != &topNode && atomic_fetch_sub(&n->refs, 1) == 1 && n->fd != -1) {
+		close(n->fd);
+		n->fd = -1;
+	}
+}
+
+/* Stat num entries of dirFd into w->stx and w->err, as one io_uring batch when possible */
+static void statBatch(struct duWorker *w, int dirFd, size_t num)
+{
+	if (num == 0)
+		return;
+	if (w->ringState == 0)
+		w->ringState = uringInit(&w->ring, STAT_BATCH) == 0 ? 1 : -1;
+	if (w->ringState == 1) {
+		for (size_t i = 0; i < num; ++i)
+			uringPrepStatx(uringGetSqe(&w->ring), dirFd, w->names[i], AT_SYMLINK_NOFOLLOW, STAT_MASK, &w->stx[i], i);
+		if (uringSubmit(&w->ring, num) == 0) {
+			for (size_t done = 0; done < num; ) {
+				struct io_uring_cqe *cqe = uringPeek(&w->ring);
+				if (cqe == NULL) {
+					uringSubmit(&w->ring, num - done);
+					continue;
+				}
+				w->err[cqe->user_data] = cqe->res < 0 ? -cqe->res : 0;
+				uringSeen(&w->ring);
+				++done;
+			}
+			if (w->err[0] != EINVAL) /* io_uring without the STATX opcode otherwise */
+				return;
+		}
+		uringExit(&w->ring);
+		w->ringState = -1;
+	}
+	for (size_t i = 0; i < num; ++i)
+		w->err[i] = statx(dirFd, w->names[i], AT_SYMLINK_NOFOLLOW, STAT_MASK, &w->stx[i]) == 0 ? 0 : errno;
+}
+
+/* Account for a batch of entries of n, queueing the subdirectories */
+static void addBatch(struct workpool *pool, struct duNode *n, struct duWorker *w, size_t num)
+{
+	statBatch(w, n->fd, num);
+	for (size_t i = 0; i < num; ++i) {
+		if (w->err[i] != 0) {
+			char path[strlen(n->path) + strlen(w->names[i]) + 2];
+			sprintf(path, "%s/%s", n->path, w->names[i]);
+			reportError(path, w->err[i]);
+			continue;
+		}
+		if (numOperands > 0 && isOperand(makedev(w->stx[i].stx_dev_major, w->stx[i].stx_dev_minor), w->stx[i].stx_ino))
+			continue; /* Counted as an operand of its own */
+		if (S_ISDIR(w->stx[i].stx_mode)) {
+			struct duNode *c = newNode(n, w->names[i], w->pos[i]);
+			c->isDir = true;
+			c->blocks = w->stx[i].stx_blocks;
+			atomic_fetch_add(&n->refs, 1);
+			wpPush(pool, c);
+		}
+		else
+			n->blocks += countBlocks(&w->stx[i], n, w->pos[i], n);
+	}
+}
+
+/* Pool callback: add up the files of one directory and queue its subdirectories */
+static void duTask(struct workpool *pool, void *task, void *arg)
+{
+	struct duNode *n = task;
+	struct duWorker *w = &workers[wpWorker(pool)];
+	(void) arg;
+	n->fd = openat(n->parent->fd, n->name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	release(n->parent);
+	if (n->fd == -1) {
+		reportError(n->path, errno);
+		release(n);
+		return;
+	}
+	unsigned long long seen = 0; /* Entries listed so far */
+	while (1) {
+		long len = syscall(SYS_getdents64, n->fd, w->dents, DENTS_BUF);
+		if (len == -1) {
+			if (errno == EINTR)
+				continue;
+			reportError(n->path, errno);
+			break;
+		}
+		if (len == 0)
+			break;
+		/* Names point into the buffer, so each batch is finished before the next getdents64 */
+		size_t num = 0;
+		for (long pos = 0; pos < len; ) {
+			struct linuxDirent64 *d = (struct linuxDirent64*) (w->dents + pos);
+			pos += d->d_reclen;
+			const char *name = d->d_name;
+			if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+				continue;
+			w->pos[num] = seen++;
+			w->names[num++] = name;
+			if (num == STAT_BATCH) {
+				addBatch(pool, n, w, num);
+				num = 0;
+			}
+		}
+		addBatch(pool, n, w, num);
+	}
+	release(n);
+}
+
+static int compareNodes(const void *a, const void *b)
+{
+	unsigned long long x = (*(struct duNode* const*) a)->pos, y = (*(struct duNode* const*) b)->pos;
+	return x < y ? -1 : x > y;
+}
+
+/* Fill in the subtree totals of n and everything below it */
+static unsigned long long addTotals(struct duNode *n)
+{
+	n->total = n->blocks;
+	for (size_t i = 0; i < n->numChildren; ++i)
+		n->total += addTotals(n->children[i]);
+	return n->total;
+}
+
+static bool human;
+
+static void printSize(struct soyWriter *w, unsigned long long blocks)
+{
+	if (!human) {
+		swPrintf(w, "%llu", (blocks + 1) / 2); /* 1KiB units, rounded up */
+		return;
+	}
+	/* Rounded up like GNU du -h: one decimal below 10, none above */
+	static const char units[] = "KMGTPE";
+	unsigned long long bytes = blocks * 512;
+	if (bytes < 1024) {
+		swPrintf(w, "%llu", bytes);
+		return;
+	}
+	double v = bytes / 1024.0;
+	int u = 0;
+	while (v >= 1024 && u < 5) {
+		v /= 1024;
+		++u;
+	}
+	double tenths = (double) (unsigned long long) (v * 10);
+	if (tenths < v * 10)
+		++tenths;
+	if (tenths < 100) {
+		swPrintf(w, "%.1f%c", tenths / 10, units[u]);
+		return;
+	}
+	unsigned long long whole = (unsigned long long) v + ((double) (unsigned long long) v < v);
+	if (whole == 1024 && u < 5) {
+		whole = 1;
+		swPrintf(w, "%.1f%c", 1.0, units[u + 1]);
+		return;
+	}
+	swPrintf(w, "%llu%c", whole, units[u]);
+}
+
+/* Print the subdirectories of n before n itself, in listing order like GNU du, down to maxDepth */
+static void printTree(struct soyWriter *w, struct duNode *n, int depth, int maxDepth)
+{
+	if (maxDepth == -1 || depth < maxDepth) {
+		qsort(n->children, n->numChildren, sizeof(struct duNode*), compareNodes);
+		for (size_t i = 0; i < n->numChildren; ++i)
+			printTree(w, n->children[i], depth + 1, maxDepth);
+	}
+	printSize(w, n->total);
+	swWrite(w, "\t", 1);
+	swLine(w, n->path);
+}
+
+static void freeTree(struct duNode *n)
+{
+	for (size_t i = 0; i < n->numChildren; ++i)
+		freeTree(n->children[i]);
+	free(n->children);
+	free(n->path);
+	free(n);
+}
+
+int main(int argc, char **argv)
+{
+	int maxDepth = -1;
+	bool total = false;
+	unsigned int threads = TREE_THREADS;
+	static struct option longOpts[] = {
+		{ "max-depth", required_argument, NULL, 'd' },
+		{ "summarize", no_argument, NULL, 's' },
+		{ "human-readable", no_argument, NULL, 'h' },
+		{ "total", no_argument, NULL, 'c' },
+		{ "jobs", required_argument, NULL, 'j' },
+		{ NULL, 0, NULL, 0 }
+	};
+	int c;
+	while ((c = getopt_long(argc, argv, "d:shcj:", longOpts, NULL)) != -1) {
+		char *end;
+		switch (c) {
+		case 'd':
+			maxDepth = strtol(optarg, &end, 10);
+			if (end == optarg || *end != '\0' || maxDepth < 0) {
+				fprintf(stderr, "du: invalid maximum depth: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 's':
+			maxDepth = 0;
+			break;
+		case 'h':
+			human = true;
+			break;
+		case 'c':
+			total = true;
+			break;
+		case 'j':
+			threads = atoi(optarg);
+			if (threads < 1 || threads > MAX_THREADS) {
+				fprintf(stderr, "du: number of threads must be between 1 and %d\n", MAX_THREADS);
+				return 1;
+			}
+			break;
+		default:
+			return 1;
+		}
+	}
+	char *dot[] = { "." };
+	char **paths = argv + optind;
+	int num = argc - optind;
+	if (num == 0) {
+		paths = dot;
+		num = 1;
+	}
+
+	/* Every directory being read holds an fd */
+	struct rlimit rl;
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+	for (int i = 0; i < STRIPES; ++i)
+		pthread_mutex_init(&stripes[i].lock, NULL);
+	workers = calloc(threads, sizeof(struct duWorker));
+	for (unsigned int i = 0; i < threads; ++i)
+		workers[i].dents = malloc(DENTS_BUF);
+	struct workpool *pool = wpCreate(threads, duTask, NULL);
+	struct duNode **roots = calloc(num, sizeof(struct duNode*));
+	struct statx *stx = malloc(num * sizeof(struct statx));
+	if (num > 1)
+		operands = malloc(num * sizeof(struct devIno));
+	for (int i = 0; i < num; ++i) {
+		if (statx(AT_FDCWD, paths[i], AT_SYMLINK_NOFOLLOW, STAT_MASK, &stx[i]) == -1) {
+			reportError(paths[i], errno);
+			continue;
+		}
+		if (num > 1) {
+			if (countedBefore(paths[i], &stx[i]))
+				continue;
+			idOf(&stx[i], &operands[numOperands++]);
+		}
+		roots[i] = newNode(&topNode, paths[i], i);
+	}
+	if (num > 1)
+		qsort(operands, numOperands, sizeof(struct devIno), compareDevIno);
+	/* Only queued once the operands are all known, so every walk skips the same ones */
+	for (int i = 0; i < num; ++i) {
+		if (roots[i] == NULL)
+			continue;
+		roots[i]->isDir = S_ISDIR(stx[i].stx_mode);
+		roots[i]->blocks = roots[i]->isDir ? stx[i].stx_blocks : countBlocks(&stx[i], &topNode, i, roots[i]);
+		if (roots[i]->isDir)
+			wpPush(pool, roots[i]);
+	}
+	free(stx);
+	wpRun(pool);
+	wpDestroy(pool);
+	addLinks();
+
+	struct soyWriter out;
+	swInit(&out, STDOUT_FILENO, OUT_BUF);
+	unsigned long long sum = 0;
+	for (int i = 0; i < num; ++i) {
+		if (roots[i] == NULL)
+			continue;
+		sum += addTotals(roots[i]);
+		printTree(&out, roots[i], 0, maxDepth);
+		freeTree(roots[i]);
+	}
+	if (total) {
+		printSize(&out, sum);
+		swLine(&out, "\ttotal");
+	}
+	swFlush(&out);
+	for (unsigned int i = 0; i < threads; ++i) {
+		if (workers[i].ringState == 1)
+			uringExit(&workers[i].ring);
+		free(workers[i].dents);
+	}
+	free(workers);
+	free(roots);
+	free(operands);
+	for (int i = 0; i < STRIPES; ++i)
+		free(stripes[i].slots);
+	return atomic_load(&failed) ? 1 : 0;
+}
@@ -0,0 +1,566 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <fnmatch.h>
+#include <dirent.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include "workpool.h"
+#include "soyio.h"
+
+#define DENTS_BUF (1 << 20) /* Bytes of directory entries fetched per getdents64 call */
+#define OUT_BUF (1 << 20) /* Size of the shared output buffer */
+#define FLUSH_AT (64 << 10) /* A worker hands its output over once it has this much */
+#define TREE_THREADS 8 /* Default workers, walking trees is mostly waiting on metadata I/O */
+#define MAX_THREADS 64
+#define MAX_PROG 1024 /* Instructions an expression may compile to */
+
+/* Record layout returned by getdents64 */
+struct linuxDirent64 {
+	unsigned long long d_ino;
+	long long d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+/*
+  The expression is compiled to a straight-line program over one accumulator.
+  Tests set it, -a and -o become conditional jumps over what they short
+  circuit. Tests on the name and type come from the directory entry itself,
+  only the ones on size and time need a statx, which is made the first time
+  one of them is reached for an entry, so e.g. -name '*.log' -size +1M stats
+  just the .log files
+*/
+enum opcode { OP_NAME, OP_TYPE, OP_SIZE, OP_MTIME, OP_PRINT, OP_NOT, OP_JF, OP_JT };
+
+/* How a -name pattern is matched, the common shapes without fnmatch */
+enum globKind { GLOB_LITERAL, GLOB_SUFFIX, GLOB_PREFIX, GLOB_CONTAINS, GLOB_FNMATCH };
+
+struct inst {
+	enum opcode op;
+	enum globKind glob;
+	bool fold; /* -iname */
+	char *s; /* Pattern, or the literal part of it */
+	size_t len;
+	unsigned char type; /* DT_* for -type, the terminator for -print */
+	int cmp; /* -1, 0 or 1: less than, equal to, greater than n */
+	long long n;
+	long long unit; /* -size */
+	int target; /* Jumps */
+};
+
+static struct inst prog[MAX_PROG];
+static int progLen;
+static bool hasAction; /* Without -print anywhere, entries the expression is true for are printed */
+static unsigned int statMask; /* statx fields the tests use */
+static int maxDepth = -1, minDepth = 0;
+static time_t now;
+
+/* A directory being read. Its fd stays open until all its subdirectories have opened theirs relative to it */
+struct findNode {
+	char *path;
+	const char *name; /* Relative to the parent's fd */
+	int fd;
+	int depth;
+	struct findNode *parent;
+	atomic_uint refs; /* Own scan plus subdirectories not opened yet */
+};
+
+static struct findNode topNode = { .fd = AT_FDCWD };
+
+/* One entry being tested */
+struct entry {
+	int dirFd;
+	const char *name;
+	const char *dir; /* Path of the directory it's in, NULL for a starting point */
+	const char *path; /* Starting points only */
+	unsigned char type; /* DT_*, DT_UNKNOWN until known */
+	bool haveStat;
+	struct statx stx;
+};
+
+/* Per worker output, handed to the shared buffer in large pieces so lines never interleave */
+static struct soyWriter stdoutBuf;
+static pthread_mutex_t outLock = PTHREAD_MUTEX_INITIALIZER;
+static struct soyWriter *outs;
+static char **bufs; /* getdents64 buffers */
+static atomic_bool failed;
+
+static void reportError(const char *path, int err)
+{
+	pthread_mutex_lock(&outLock);
+	swFlush(&stdoutBuf);
+	fprintf(stderr, "find: %s: %s\n", path, strerror(err));
+	pthread_mutex_unlock(&outLock);
+	atomic_store(&failed, true);
+}
+
+static void handOver(struct soyWriter *w)
+{
+	pthread_mutex_lock(&outLock);
+	swWrite(&stdoutBuf, w->buf, w->len);
+	pthread_mutex_unlock(&outLock);
+	w->len = 0;
+}
+
+/* Fetch the fields the tests need, once per entry. Returns false if it couldn't */
+static bool statEntry(struct entry *e)
+{
+	if (e->haveStat)
+		return true;
+	if (statx(e->dirFd, e->name, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, statMask | STATX_TYPE, &e->stx) == -1) {
+		if (e->dir == NULL)
+			reportError(e->path, errno);
+		else {
+			char path[strlen(e->dir) + strlen(e->name) + 2];
+			sprintf(path, "%s/%s", e->dir, e->name);
+			reportError(path, errno);
+		}
+		return false;
+	}
+	e->haveStat = true;
+	if (e->type == DT_UNKNOWN)
+		e->type = IFTODT(e->stx.stx_mode);
+	return true;
+}
+
+static bool matchName(const struct inst *in, const char *name)
+{
+	size_t len;
+	int (*cmp)(const char*, const char*, size_t) = in->fold ? strncasecmp : strncmp;
+	switch (in->glob) {
+	case GLOB_LITERAL:
+		return (in->fold ? strcasecmp : strcmp)(name, in->s) == 0;
+	case GLOB_SUFFIX:
+		len = strlen(name);
+		return len >= in->len && cmp(name + len - in->len, in->s, in->len) == 0;
+	case GLOB_PREFIX:
+		return cmp(name, in->s, in->len) == 0;
+	case GLOB_CONTAINS:
+		return (in->fold ? strcasestr : strstr)(name, in->s) != NULL;
+	case GLOB_FNMATCH:
+		return fnmatch(in->s, name, in->fold ? FNM_CASEFOLD : 0) == 0;
+	}
+	return false;
+}
+
+static inline bool compare(const struct inst *in, long long v)
+{
+	return in->cmp < 0 ? v < in->n : in->cmp > 0 ? v > in->n : v == in->n;
+}
+
+static void printEntry(struct soyWriter *w, const struct entry *e, char end)
+{
+	if (e->dir == NULL)
+		swWrite(w, e->path, strlen(e->path));
+	else {
+		size_t len = strlen(e->dir);
+		swWrite(w, e->dir, len);
+		if (len == 0 || e->dir[len - 1] != '/')
+			swWrite(w, "/", 1);
+		swWrite(w, e->name, strlen(e->name));
+	}
+	swWrite(w, &end, 1);
+}
+
+/* Run the program on one entry */
+static void evaluate(struct entry *e, struct soyWriter *w)
+{
+	bool acc = true;
+	for (int pc = 0; pc < progLen; ++pc) {
+		const struct inst *in = &prog[pc];
+		switch (in->op) {
+		case OP_NAME:
+			acc = matchName(in, e->name);
+			break;
+		case OP_TYPE:
+			if (e->type == DT_UNKNOWN && !statEntry(e))
+				return;
+			acc = e->type == in->type;
+			break;
+		case OP_SIZE:
+			if (!statEntry(e))
+				return;
+			acc = compare(in, (e->stx.stx_size + in->unit - 1) / in->unit);
+			break;
+		case OP_MTIME:
+			if (!statEntry(e))
+				return;
+			acc = compare(in, (now - e->stx.stx_mtime.tv_sec) / 86400);
+			break;
+		case OP_PRINT:
+			printEntry(w, e, in->type);
+			acc = true;
+			break;
+		case OP_NOT:
+			acc = !acc;
+			break;
+		case OP_JF:
+			if (!acc)
+				pc = in->target - 1;
+			break;
+		case OP_JT:
+			if (acc)
+				pc = in->target - 1;
+			break;
+		}
+	}
+	if (acc && !hasAction)
+		printEntry(w, e, '\n');
+	if (w->len >= FLUSH_AT)
+		handOver(w);
+}
+
+static struct findNode* newNode(struct findNode *parent, const char *name, int depth)
+{
+	struct findNode *c = calloc(1, sizeof(struct findNode));
+	if (parent == &topNode)
+		c->path = strdup(name);
+	else {
+		size_t len = strlen(parent->path);
+		c->path = malloc(len + strlen(name) + 2);
+		sprintf(c->path, len > 0 && parent->path[len - 1] == '/' ? "%s%s" : "%s/%s", parent->path, name);
+	}
+	c->name = parent == &topNode ? c->path : c->path + strlen(c->path) - strlen(name);
+	c->parent = parent;
+	c->fd = -1;
+	c->depth = depth;
+	atomic_init(&c->refs, 1);
+	return c;
+}
+
+/* Drop one reference to n, freeing it and any parent that's no longer needed */
+static void release(struct findNode *n)
+{
+	while (n != &topNode && atomic_fetch_sub(&n->refs, 1) == 1) {
+		struct findNode *p = n->parent;
+		if (n->fd != -1)
+			close(n->fd);
+		free(n->path);
+		free(n);
+		n = p;
+	}
+}
+
+/* Pool callback: test every entry of one directory and queue its subdirectories */
+static void findTask(struct workpool *pool, void *task, void *arg)
+{
+	struct findNode *n = task;
+	struct soyWriter *w = &outs[wpWorker(pool)];
+	char *buf = bufs[wpWorker(pool)];
+	(void) arg;
+	n->fd = openat(n->parent->fd, n->name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	release(n->parent);
+	n->parent = &topNode; /* Not needed any more, and may be gone */
+	if (n->fd == -1) {
+		reportError(n->path, errno);
+		release(n);
+		return;
+	}
+	int depth = n->depth + 1;
+	bool descend = maxDepth == -1 || depth < maxDepth;
+	while (1) {
+		long len = syscall(SYS_getdents64, n->fd, buf, DENTS_BUF);
+		if (len == -1) {
+			if (errno == EINTR)
+				continue;
+			reportError(n->path, errno);
+			break;
+		}
+		if (len == 0)
+			break;
+		for (long pos = 0; pos < len; ) {
+			struct linuxDirent64 *d = (struct linuxDirent64*) (buf + pos);
+			pos += d->d_reclen;
+			const char *name = d->d_name;
+			if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+				continue;
+			struct entry e = { .dirFd = n->fd, .name = name, .dir = n->path, .type = d->d_type };
+			if (depth >= minDepth)
+				evaluate(&e, w);
+			if (descend && e.type == DT_UNKNOWN)
+				statEntry(&e);
+			if (descend && e.type == DT_DIR) {
+				atomic_fetch_add(&n->refs, 1);
+				wpPush(pool, newNode(n, name, depth));
+			}
+		}
+	}
+	release(n);
+}
+
+/* The literal part of a glob and how to match it, without fnmatch when the shape allows */
+static void compileGlob(struct inst *in, const char *pat)
+{
+	size_t len = strlen(pat);
+	bool star0 = len > 0 && pat[0] == '*', star1 = len > 1 && pat[len - 1] == '*';
+	const char *lit = pat + star0;
+	size_t litLen = len - star0 - star1;
+	in->glob = GLOB_FNMATCH;
+	in->s = strdup(pat);
+	if (strcspn(lit, "*?[\\") < litLen)
+		return;
+	in->glob = star0 && star1 ? GLOB_CONTAINS : star0 ? GLOB_SUFFIX : star1 ? GLOB_PREFIX : GLOB_LITERAL;
+	free(in->s);
+	in->s = strndup(lit, litLen);
+	in->len = litLen;
+}
+
+/* [+-]N with an optional unit suffix (-size). Returns false if it's invalid */
+static bool parseNumber(struct inst *in, const char *s, bool units)
+{
+	in->cmp = *s == '+' ? 1 : *s == '-' ? -1 : 0;
+	if (in->cmp != 0)
+		++s;
+	char *end;
+	errno = 0;
+	in->n = strtoll(s, &end, 10);
+	if (end == s || errno != 0 || in->n < 0)
+		return false;
+	in->unit = 512;
+	if (units && *end != '\0') {
+		switch (*end) {
+		case 'c': in->unit = 1; break;
+		case 'w': in->unit = 2; break;
+		case 'b': in->unit = 512; break;
+		case 'k': in->unit = 1 << 10; break;
+		case 'M': in->unit = 1 << 20; break;
+		case 'G': in->unit = 1 << 30; break;
+		default: return false;
+		}
+		++end;
+	}
+	return *end == '\0';
+}
+
+/* Expression parser over the remaining arguments */
+struct parser {
+	char **args;
+	int num;
+	int pos;
+	const char *err;
+	unsigned int threads;
+};
+
+static int emit(struct parser *p, enum opcode op)
+{
+	if (progLen == MAX_PROG) {
+		p->err = "expression too long";
+		return 0;
+	}
+	memset(&prog[progLen], 0, sizeof(struct inst));
+	prog[progLen].op = op;
+	return progLen++;
+}
+
+static const char* nextArg(struct parser *p, const char *opt)
+{
+	if (p->pos == p->num) {
+		static char msg[64];
+		snprintf(msg, sizeof(msg), "missing argument to %s", opt);
+		p->err = msg;
+		return NULL;
+	}
+	return p->args[p->pos++];
+}
+
+static void parseOr(struct parser *p);
+
+/* Whether the next argument can start another term of an -a chain */
+static bool startsTerm(struct parser *p)
+{
+	if (p->pos == p->num || p->err != NULL)
+		return false;
+	const char *a = p->args[p->pos];
+	return strcmp(a, "-o") != 0 && strcmp(a, "-or") != 0 && strcmp(a, ")") != 0;
+}
+
+/* A test, an action, a negation or a parenthesised expression. Global options compile to nothing */
+static void parseTerm(struct parser *p)
+{
+	const char *a = p->args[p->pos++];
+	const char *v;
+	int i;
+	if (strcmp(a, "!") == 0 || strcmp(a, "-not") == 0) {
+		if (!startsTerm(p)) {
+			p->err = "expected an expression after !";
+			return;
+		}
+		parseTerm(p);
+		emit(p, OP_NOT);
+	}
+	else if (strcmp(a, "(") == 0) {
+		parseOr(p);
+		if (p->err == NULL && (p->pos == p->num || strcmp(p->args[p->pos++], ")") != 0))
+			p->err = "missing )";
+	}
+	else if (strcmp(a, "-name") == 0 || strcmp(a, "-iname") == 0) {
+		if ((v = nextArg(p, a)) == NULL)
+			return;
+		i = emit(p, OP_NAME);
+		prog[i].fold = a[1] == 'i';
+		compileGlob(&prog[i], v);
+	}
+	else if (strcmp(a, "-type") == 0) {
+		if ((v = nextArg(p, a)) == NULL)
+			return;
+		static const char letters[] = "fdlbcps";
+		static const unsigned char types[] = { DT_REG, DT_DIR, DT_LNK, DT_BLK, DT_CHR, DT_FIFO, DT_SOCK };
+		const char *t = v[0] != '\0' && v[1] == '\0' ? strchr(letters, v[0]) : NULL;
+		if (t == NULL) {
+			p->err = "unknown argument to -type";
+			return;
+		}
+		i = emit(p, OP_TYPE);
+		prog[i].type = types[t - letters];
+	}
+	else if (strcmp(a, "-size") == 0 || strcmp(a, "-mtime") == 0) {
+		if ((v = nextArg(p, a)) == NULL)
+			return;
+		bool size = a[1] == 's';
+		i = emit(p, size ? OP_SIZE : OP_MTIME);
+		if (!parseNumber(&prog[i], v, size))
+			p->err = size ? "invalid argument to -size" : "invalid argument to -mtime";
+		statMask |= size ? STATX_SIZE : STATX_MTIME;
+	}
+	else if (strcmp(a, "-print") == 0 || strcmp(a, "-print0") == 0) {
+		i = emit(p, OP_PRINT);
+		prog[i].type = a[6] == '0' ? '\0' : '\n';
+		hasAction = true;
+	}
+	else if (strcmp(a, "-maxdepth") == 0 || strcmp(a, "-mindepth") == 0 || strcmp(a, "-j") == 0) {
+		if ((v = nextArg(p, a)) == NULL)
+			return;
+		char *end;
+		long n = strtol(v, &end, 10);
+		if (end == v || *end != '\0' || n < 0 || (a[1] == 'j' && (n < 1 || n > MAX_THREADS))) {
+			p->err = a[1] == 'j' ? "number of threads must be between 1 and 64" : "invalid depth";
+			return;
+		}
+		if (a[1] == 'j')
+			p->threads = n;
+		else if (a[2] == 'a')
+			maxDepth = n;
+		else
+			minDepth = n;
+	}
+	else {
+		static char msg[64];
+		snprintf(msg, sizeof(msg), "unknown predicate %.40s", a);
+		p->err = msg;
+	}
+}
+
+/* Terms joined by -a or by nothing: each one is skipped once the accumulator is false */
+static void parseAnd(struct parser *p)
+{
+	int jumps[MAX_PROG];
+	int num = 0;
+	parseTerm(p);
+	while (startsTerm(p)) {
+		if (strcmp(p->args[p->pos], "-a") == 0 || strcmp(p->args[p->pos], "-and") == 0)
+			if (++p->pos == p->num) {
+				p->err = "expected an expression after -a";
+				return;
+			}
+		jumps[num++] = emit(p, OP_JF);
+		parseTerm(p);
+	}
+	for (int i = 0; i < num; ++i)
+		prog[jumps[i]].target = progLen;
+}
+
+/* -o chains: each side after the first is skipped once the accumulator is true */
+static void parseOr(struct parser *p)
+{
+	int jumps[MAX_PROG];
+	int num = 0;
+	if (p->pos == p->num) {
+		p->err = "expected an expression";
+		return;
+	}
+	parseAnd(p);
+	while (p->err == NULL && p->pos < p->num && (strcmp(p->args[p->pos], "-o") == 0 || strcmp(p->args[p->pos], "-or") == 0)) {
+		if (++p->pos == p->num) {
+			p->err = "expected an expression after -o";
+			return;
+		}
+		jumps[num++] = emit(p, OP_JT);
+		parseAnd(p);
+	}
+	for (int i = 0; i < num; ++i)
+		prog[jumps[i]].target = progLen;
+}
+
+int main(int argc, char **argv)
+{
+	/* Starting points come first, the expression starts at the first argument that looks like part of it */
+	int numPaths = 1;
+	while (numPaths < argc && argv[numPaths][0] != '-' && strcmp(argv[numPaths], "(") != 0 && strcmp(argv[numPaths], "!") != 0)
+		++numPaths;
+	struct parser p = { argv + numPaths, argc - numPaths, 0, NULL, TREE_THREADS };
+	if (p.num > 0)
+		parseOr(&p);
+	if (p.err == NULL && p.pos < p.num)
+		p.err = "unexpected )";
+	if (p.err != NULL) {
+		fprintf(stderr, "find: %s\n", p.err);
+		return 1;
+	}
+	now = time(NULL);
+	char *dot[] = { NULL, "." };
+	char **paths = argv + 1;
+	int num = numPaths - 1;
+	if (num == 0) {
+		paths = dot + 1;
+		num = 1;
+	}
+
+	/* Every directory being read holds an fd */
+	struct rlimit rl;
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+	swInit(&stdoutBuf, STDOUT_FILENO, OUT_BUF);
+	outs = malloc(p.threads * sizeof(struct soyWriter));
+	bufs = malloc(p.threads * sizeof(char*));
+	for (unsigned int i = 0; i < p.threads; ++i) {
+		swInit(&outs[i], -1, FLUSH_AT * 2);
+		bufs[i] = malloc(DENTS_BUF);
+	}
+	struct workpool *pool = wpCreate(p.threads, findTask, NULL);
+	for (int i = 0; i < num; ++i) {
+		struct entry e = { .dirFd = AT_FDCWD, .name = paths[i], .path = paths[i] };
+		if (!statEntry(&e))
+			continue;
+		if (minDepth == 0)
+			evaluate(&e, &outs[0]);
+		if (e.type == DT_DIR && maxDepth != 0)
+			wpPush(pool, newNode(&topNode, paths[i], 0));
+	}
+	wpRun(pool);
+	wpDestroy(pool);
+	for (unsigned int i = 0; i < p.threads; ++i) {
+		handOver(&outs[i]);
+		swFree(&outs[i]);
+		free(bufs[i]);
+	}
+	swFlush(&stdoutBuf);
+	free(outs);
+	free(bufs);
+	for (int i = 0; i < progLen; ++i)
+		free(prog[i].s);
+	return atomic_load(&failed) ? 1 : 0;
+}
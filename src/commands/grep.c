@@ -0,0 +1,1126 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "soyio.h"
+#include "workpool.h"
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+#define STREAM_BUF (256 << 10) /* Buffer for inputs that can't be mapped, grown only for longer lines */
+#define OUT_BUF (1 << 20)
+#define MAX_THREADS 64
+#define DEFAULT_THREADS 8 /* Upper bound on the default number of files scanned at once */
+#define MAX_PROG 4096 /* Instructions a compiled pattern may have */
+#define DUP_MAX 32767 /* Largest count in an interval, RE_DUP_MAX */
+
+struct grepOpts {
+	bool extended; /* -E: ( ) | + ? are operators without a backslash */
+	bool fixed; /* -F: the pattern is a plain string */
+	bool ignoreCase;
+	bool invert; /* Select the lines that don't match */
+	bool count; /* Print the number of selected lines per file */
+	bool list; /* Print the names of files with a selected line */
+	bool lineNumbers;
+	bool quiet; /* Just the exit status */
+	int names; /* Prefix lines with the file name: -1 unless several files, 0 never (-h), 1 always (-H) */
+};
+
+static struct grepOpts opts;
+
+/*
+  Regular expressions are compiled to a program for a Pike VM: every
+  alternative is followed at once, so matching a line is linear in its length
+  whatever the pattern, and there's no backtracking to blow up
+*/
+enum opcode { OP_CHAR, OP_ANY, OP_CLASS, OP_BOL, OP_EOL, OP_WORDB, OP_NWORDB, OP_BOW, OP_EOW, OP_SPLIT, OP_JMP, OP_MATCH };
+
+struct inst {
+	enum opcode op;
+	unsigned char c; /* OP_CHAR */
+	int x; /* OP_CLASS: class index, OP_SPLIT and OP_JMP: target */
+	int y; /* OP_SPLIT: second target */
+};
+
+/* Syntax tree the parser builds and the compiler walks */
+enum nodeType {
+	N_EMPTY, N_CHAR, N_ANY, N_CLASS, N_BOL, N_EOL, N_WORDB, N_NWORDB, N_BOW, N_EOW,
+	N_CAT, N_ALT, N_STAR, N_PLUS, N_QUEST, N_REPEAT
+};
+
+struct node {
+	enum nodeType type;
+	unsigned char c; /* N_CHAR */
+	int cls; /* N_CLASS */
+	int min, max; /* N_REPEAT: bounds of the interval, max is -1 when there's none */
+	struct node *l, *r;
+};
+
+/* A compiled pattern, shared read-only by all the scanning threads */
+struct pattern {
+	struct inst prog[MAX_PROG];
+	int len;
+	unsigned char (*classes)[32]; /* 256-bit sets of bytes */
+	int numClasses;
+	bool literal; /* The whole pattern is needle, no need for the VM */
+	char needle[256]; /* A string every match contains, for the prefilter */
+	size_t needleLen;
+	size_t fp1, fp2; /* Positions of the two needle bytes the prefilter looks for */
+};
+
+static struct pattern pat;
+
+/* Parser state */
+struct parser {
+	const char *s;
+	size_t pos;
+	const char *err;
+	bool seqStart; /* At the start of a sequence, where ^ is an anchor in basic syntax */
+};
+
+static struct node* newNode(enum nodeType type, struct node *l, struct node *r)
+{
+	struct node *n = calloc(1, sizeof(struct node));
+	n->type = type;
+	n->l = l;
+	n->r = r;
+	return n;
+}
+
+static void freeNode(struct node *n)
+{
+	if (n == NULL)
+		return;
+	freeNode(n->l);
+	freeNode(n->r);
+	free(n);
+}
+
+static int newClass(void)
+{
+	pat.classes = realloc(pat.classes, (pat.numClasses + 1) * sizeof(*pat.classes));
+	memset(pat.classes[pat.numClasses], 0, 32);
+	return pat.numClasses++;
+}
+
+static void classAdd(int cls, unsigned char c)
+{
+	pat.classes[cls][c >> 3] |= 1 << (c & 7);
+	if (opts.ignoreCase && isalpha(c)) {
+		unsigned char o = islower(c) ? toupper(c) : tolower(c);
+		pat.classes[cls][o >> 3] |= 1 << (o & 7);
+	}
+}
+
+/*
+  Whether the next character is the operator op: in basic syntax ( ) | + ?
+  need a backslash to be operators, in extended syntax a backslash makes them
+  literal. * is an operator in both
+*/
+static bool isOp(struct parser *p, char op)
+{
+	const char *s = p->s + p->pos;
+	if (op == '*' || opts.extended)
+		return s[0] == op;
+	return s[0] == '\\' && s[1] == op;
+}
+
+static void skipOp(struct parser *p, char op)
+{
+	p->pos += (op == '*' || opts.extended) ? 1 : 2;
+}
+
+/* [...] bracket expression, after the [ */
+static struct node* parseClass(struct parser *p)
+{
+	static const struct { const char *name; int (*fn)(int); } named[] = {
+		{ "alpha", isalpha }, { "digit", isdigit }, { "alnum", isalnum }, { "upper", isupper },
+		{ "lower", islower }, { "space", isspace }, { "blank", isblank }, { "punct", ispunct },
+		{ "xdigit", isxdigit }, { "print", isprint }, { "graph", isgraph }, { "cntrl", iscntrl },
+	};
+	int cls = newClass();
+	bool negate = p->s[p->pos] == '^';
+	if (negate)
+		++p->pos;
+	bool first = true;
+	while (p->s[p->pos] != '\0' && (first || p->s[p->pos] != ']')) {
+		first = false;
+		const char *s = p->s + p->pos;
+		if (s[0] == '[' && s[1] == ':') {
+			const char *end = strstr(s + 2, ":]");
+			size_t i;
+			for (i = 0; end != NULL && i < sizeof(named) / sizeof(named[0]); ++i)
+				if (strlen(named[i].name) == (size_t) (end - s - 2) && strncmp(s + 2, named[i].name, end - s - 2) == 0)
+					break;
+			if (end == NULL || i == sizeof(named) / sizeof(named[0])) {
+				p->err = "invalid character class";
+				return NULL;
+			}
+			for (int c = 0; c < 256; ++c)
+				if (named[i].fn(c))
+					classAdd(cls, c);
+			p->pos = end + 2 - p->s;
+			continue;
+		}
+		unsigned char lo = s[0];
+		if (s[1] == '-' && s[2] != ']' && s[2] != '\0') {
+			unsigned char hi = s[2];
+			for (int c = lo; c <= hi; ++c)
+				classAdd(cls, c);
+			p->pos += 3;
+		}
+		else {
+			classAdd(cls, lo);
+			++p->pos;
+		}
+	}
+	if (p->s[p->pos] != ']') {
+		p->err = "unmatched [";
+		return NULL;
+	}
+	++p->pos;
+	if (negate)
+		for (int i = 0; i < 32; ++i)
+			pat.classes[cls][i] ^= 0xFF;
+	struct node *n = newNode(N_CLASS, NULL, NULL);
+	n->cls = cls;
+	return n;
+}
+
+static struct node* parseAlt(struct parser *p);
+
+/* The GNU escape \c, after the backslash: word and space classes, word boundaries, or c itself */
+static struct node* parseEscape(struct parser *p, char c)
+{
+	struct node *n;
+	int cls;
+	switch (c) {
+	case 'w':
+	case 'W':
+	case 's':
+	case 'S':
+		cls = newClass();
+		for (int i = 0; i < 256; ++i) {
+			bool in = tolower(c) == 'w' ? isalnum(i) || i == '_' : isspace(i) != 0;
+			if (in != (isupper(c) != 0)) /* \W and \S are the complements */
+				classAdd(cls, i);
+		}
+		n = newNode(N_CLASS, NULL, NULL);
+		n->cls = cls;
+		return n;
+	case 'b':
+		return newNode(N_WORDB, NULL, NULL);
+	case 'B':
+		return newNode(N_NWORDB, NULL, NULL);
+	case '<':
+		return newNode(N_BOW, NULL, NULL);
+	case '>':
+		return newNode(N_EOW, NULL, NULL);
+	case '`': /* Start and end of the buffer, which is always one line */
+		return newNode(N_BOL, NULL, NULL);
+	case '\'':
+		return newNode(N_EOL, NULL, NULL);
+	default:
+		if (c >= '1' && c <= '9') {
+			p->err = "back-references are not supported";
+			return NULL;
+		}
+	}
+	n = newNode(N_CHAR, NULL, NULL);
+	n->c = c;
+	return n;
+}
+
+/* A single character, class, anchor or group. NULL at the end of a sequence */
+static struct node* parseAtom(struct parser *p)
+{
+	const char *s = p->s + p->pos;
+	if (s[0] == '\0' || isOp(p, '|') || isOp(p, ')'))
+		return NULL;
+	bool seqStart = p->seqStart;
+	p->seqStart = false;
+	if (isOp(p, '(')) {
+		skipOp(p, '(');
+		struct node *n = parseAlt(p);
+		p->seqStart = false;
+		if (p->err != NULL)
+			return n;
+		if (!isOp(p, ')')) {
+			p->err = "unmatched (";
+			return n;
+		}
+		skipOp(p, ')');
+		return n != NULL ? n : newNode(N_EMPTY, NULL, NULL);
+	}
+	++p->pos;
+	struct node *n;
+	switch (s[0]) {
+	case '.':
+		return newNode(N_ANY, NULL, NULL);
+	case '[':
+		return parseClass(p);
+	/* In basic syntax ^ and $ are only anchors at the start and end of a sequence, elsewhere they're literal */
+	case '^':
+		if (opts.extended || seqStart)
+			return newNode(N_BOL, NULL, NULL);
+		break;
+	case '$':
+		if (opts.extended || p->s[p->pos] == '\0' || isOp(p, ')') || isOp(p, '|'))
+			return newNode(N_EOL, NULL, NULL);
+		break;
+	case '\\':
+		if (s[1] == '\0') {
+			p->err = "trailing backslash";
+			return NULL;
+		}
+		++p->pos;
+		return parseEscape(p, s[1]);
+	}
+	n = newNode(N_CHAR, NULL, NULL);
+	n->c = s[0];
+	return n;
+}
+
+/* A count of an interval, or -1 if there's no number at p */
+static int parseCount(struct parser *p)
+{
+	if (!isdigit((unsigned char) p->s[p->pos]))
+		return -1;
+	int n = 0;
+	while (isdigit((unsigned char) p->s[p->pos])) {
+		n = n > DUP_MAX ? n : n * 10 + (p->s[p->pos] - '0');
+		++p->pos;
+	}
+	return n;
+}
+
+/*
+  The interval {n}, {n,}, {,m} or {n,m} after an atom, \{ \} in basic syntax,
+  with p at the opening brace. In extended syntax a brace that doesn't start a
+  valid interval is literal, like in GNU grep: false is returned and p is left
+  as it was
+*/
+static bool parseInterval(struct parser *p, int *min, int *max)
+{
+	size_t start = p->pos;
+	skipOp(p, '{');
+	*min = parseCount(p);
+	*max = *min;
+	if (p->s[p->pos] == ',') {
+		++p->pos;
+		*max = parseCount(p);
+		if (*min == -1)
+			*min = 0;
+	}
+	else if (*min == -1)
+		*max = -2; /* No count at all */
+	if (*max != -2 && isOp(p, '}') && (*max == -1 || *min <= *max)) {
+		skipOp(p, '}');
+		if (*min > DUP_MAX || *max > DUP_MAX)
+			p->err = "regular expression too big";
+		return true;
+	}
+	if (opts.extended) {
+		p->pos = start;
+		return false;
+	}
+	p->err = strstr(p->s + p->pos, "\\}") != NULL ? "invalid content of \\{\\}" : "unmatched \\{";
+	return true;
+}
+
+/* An atom with any number of * + ? or intervals after it */
+static struct node* parseRepeat(struct parser *p)
+{
+	/* A leading * is literal */
+	if (p->s[p->pos] == '*' && p->pos == 0) {
+		++p->pos;
+		struct node *n = newNode(N_CHAR, NULL, NULL);
+		n->c = '*';
+		return n;
+	}
+	struct node *n = parseAtom(p);
+	while (n != NULL && p->err == NULL) {
+		if (isOp(p, '*')) {
+			skipOp(p, '*');
+			n = newNode(N_STAR, n, NULL);
+		}
+		else if (isOp(p, '+')) {
+			skipOp(p, '+');
+			n = newNode(N_PLUS, n, NULL);
+		}
+		else if (isOp(p, '?')) {
+			skipOp(p, '?');
+			n = newNode(N_QUEST, n, NULL);
+		}
+		else if (isOp(p, '{')) {
+			int min, max;
+			if (!parseInterval(p, &min, &max))
+				break;
+			n = newNode(N_REPEAT, n, NULL);
+			n->min = min;
+			n->max = max;
+		}
+		else
+			break;
+	}
+	return n;
+}
+
+static struct node* parseCat(struct parser *p)
+{
+	struct node *n = NULL;
+	struct node *r;
+	p->seqStart = true;
+	while (p->err == NULL && (r = parseRepeat(p)) != NULL)
+		n = n == NULL ? r : newNode(N_CAT, n, r);
+	return n != NULL ? n : newNode(N_EMPTY, NULL, NULL);
+}
+
+static struct node* parseAlt(struct parser *p)
+{
+	struct node *n = parseCat(p);
+	while (p->err == NULL && isOp(p, '|')) {
+		skipOp(p, '|');
+		n = newNode(N_ALT, n, parseCat(p));
+	}
+	return n;
+}
+
+static int emit(enum opcode op, int c, int x, int y)
+{
+	if (pat.len == MAX_PROG)
+		return -1;
+	pat.prog[pat.len] = (struct inst) { op, c, x, y };
+	return pat.len++;
+}
+
+/* Thompson construction of n into the program. Returns 0, or -1 if it's too big */
+static int compile(struct node *n)
+{
+	int split, jmp;
+	switch (n->type) {
+	case N_EMPTY:
+		return 0;
+	case N_CHAR:
+		if (opts.ignoreCase && isalpha(n->c)) { /* Case folded characters become classes */
+			int cls = newClass();
+			classAdd(cls, n->c);
+			return emit(OP_CLASS, 0, cls, 0) < 0 ? -1 : 0;
+		}
+		return emit(OP_CHAR, n->c, 0, 0) < 0 ? -1 : 0;
+	case N_ANY:
+		return emit(OP_ANY, 0, 0, 0) < 0 ? -1 : 0;
+	case N_CLASS:
+		return emit(OP_CLASS, 0, n->cls, 0) < 0 ? -1 : 0;
+	case N_BOL:
+		return emit(OP_BOL, 0, 0, 0) < 0 ? -1 : 0;
+	case N_EOL:
+		return emit(OP_EOL, 0, 0, 0) < 0 ? -1 : 0;
+	case N_WORDB:
+		return emit(OP_WORDB, 0, 0, 0) < 0 ? -1 : 0;
+	case N_NWORDB:
+		return emit(OP_NWORDB, 0, 0, 0) < 0 ? -1 : 0;
+	case N_BOW:
+		return emit(OP_BOW, 0, 0, 0) < 0 ? -1 : 0;
+	case N_EOW:
+		return emit(OP_EOW, 0, 0, 0) < 0 ? -1 : 0;
+	case N_CAT:
+		return compile(n->l) < 0 || compile(n->r) < 0 ? -1 : 0;
+	case N_ALT:
+		if ((split = emit(OP_SPLIT, 0, 0, 0)) < 0)
+			return -1;
+		pat.prog[split].x = pat.len;
+		if (compile(n->l) < 0 || (jmp = emit(OP_JMP, 0, 0, 0)) < 0)
+			return -1;
+		pat.prog[split].y = pat.len;
+		if (compile(n->r) < 0)
+			return -1;
+		pat.prog[jmp].x = pat.len;
+		return 0;
+	case N_STAR:
+		if ((split = emit(OP_SPLIT, 0, 0, 0)) < 0)
+			return -1;
+		pat.prog[split].x = pat.len;
+		if (compile(n->l) < 0 || emit(OP_JMP, 0, split, 0) < 0)
+			return -1;
+		pat.prog[split].y = pat.len;
+		return 0;
+	case N_PLUS:
+		jmp = pat.len;
+		if (compile(n->l) < 0 || (split = emit(OP_SPLIT, 0, jmp, 0)) < 0)
+			return -1;
+		pat.prog[split].y = pat.len;
+		return 0;
+	case N_QUEST:
+		if ((split = emit(OP_SPLIT, 0, 0, 0)) < 0)
+			return -1;
+		pat.prog[split].x = pat.len;
+		if (compile(n->l) < 0)
+			return -1;
+		pat.prog[split].y = pat.len;
+		return 0;
+	case N_REPEAT: {
+		/* x{2,4} is compiled as xxx?x?, x{2,} as xxx* */
+		struct node rest = { .type = n->max == -1 ? N_STAR : N_QUEST, .l = n->l };
+		for (int i = 0; i < n->min; ++i)
+			if (compile(n->l) < 0)
+				return -1;
+		for (int i = n->min; i < (n->max == -1 ? n->min + 1 : n->max); ++i)
+			if (compile(&rest) < 0)
+				return -1;
+		return 0;
+	}
+	}
+	return -1;
+}
+
+/* Flatten the top-level concatenation of n into list, in order */
+static void flattenCat(struct node *n, struct node **list, int *num, int max)
+{
+	if (n->type == N_CAT) {
+		flattenCat(n->l, list, num, max);
+		flattenCat(n->r, list, num, max);
+	}
+	else if (*num < max)
+		list[(*num)++] = n;
+}
+
+/*
+  Find the longest run of plain characters every match must contain, for the
+  prefilter. Returns true if the pattern is nothing but that run
+*/
+static bool findNeedle(struct node *root)
+{
+	struct node *list[MAX_PROG];
+	int num = 0;
+	flattenCat(root, list, &num, MAX_PROG);
+	size_t bestStart = 0, bestLen = 0;
+	for (int i = 0; i < num; ) {
+		if (list[i]->type != N_CHAR) {
+			++i;
+			continue;
+		}
+		int j = i;
+		while (j < num && list[j]->type == N_CHAR && j - i < (int) sizeof(pat.needle))
+			++j;
+		if ((size_t) (j - i) > bestLen) {
+			bestStart = i;
+			bestLen = j - i;
+		}
+		i = j;
+	}
+	for (size_t k = 0; k < bestLen; ++k)
+		pat.needle[k] = list[bestStart + k]->c;
+	pat.needleLen = bestLen;
+	return bestLen > 0 && bestLen == (size_t) num;
+}
+
+/*
+  How common a byte is in text and logs, higher is more common. The
+  prefilter looks for the two rarest bytes of the needle so it stops at as
+  few false candidates as possible
+*/
+static int byteRank(unsigned char c)
+{
+	static const char common[] = " etaoinsrhldcumfpgwybvkxjqz0123456789ETAOINSRHLDCUMFPGWYBVKXJQZ.,:-/_=\"'";
+	const char *p = c != '\0' ? strchr(common, c) : NULL;
+	return p != NULL ? (int) (sizeof(common) - (p - common)) : 0;
+}
+
+static void pickFingerprint(void)
+{
+	pat.fp1 = 0;
+	pat.fp2 = pat.needleLen - 1;
+	if (pat.needleLen < 3)
+		return;
+	/* Rarest byte, then the rarest at another position */
+	size_t a = 0;
+	for (size_t i = 1; i < pat.needleLen; ++i)
+		if (byteRank(pat.needle[i]) < byteRank(pat.needle[a]))
+			a = i;
+	size_t b = a == 0 ? 1 : 0;
+	for (size_t i = 0; i < pat.needleLen; ++i)
+		if (i != a && byteRank(pat.needle[i]) < byteRank(pat.needle[b]))
+			b = i;
+	pat.fp1 = a < b ? a : b;
+	pat.fp2 = a < b ? b : a;
+}
+
+/* Compile the pattern. Returns an error message, or NULL */
+static const char* compilePattern(const char *s)
+{
+	if (opts.fixed) {
+		size_t len = strlen(s);
+		if (len >= sizeof(pat.needle))
+			return "fixed string too long";
+		memcpy(pat.needle, s, len);
+		pat.needleLen = len;
+		pat.literal = true;
+	}
+	else {
+		struct parser p = { s, 0, NULL, false };
+		struct node *root = parseAlt(&p);
+		if (p.err == NULL && p.s[p.pos] != '\0')
+			p.err = "unmatched )";
+		if (p.err != NULL) {
+			freeNode(root);
+			return p.err;
+		}
+		pat.literal = findNeedle(root);
+		int r = compile(root);
+		freeNode(root);
+		if (r < 0 || emit(OP_MATCH, 0, 0, 0) < 0)
+			return "pattern too large";
+	}
+	if (pat.needleLen > 0)
+		pickFingerprint();
+	return NULL;
+}
+
+static inline bool classHas(int cls, unsigned char c)
+{
+	return pat.classes[cls][c >> 3] & (1 << (c & 7));
+}
+
+/* Thread lists of the VM, one set of them per scanning thread */
+struct vm {
+	int *cur, *next;
+	int numCur, numNext;
+	unsigned int *mark; /* Step each instruction was last added in, so it's added once per step */
+	unsigned int step;
+};
+
+static void vmInit(struct vm *m)
+{
+	m->cur = malloc(pat.len * sizeof(int));
+	m->next = malloc(pat.len * sizeof(int));
+	m->mark = calloc(pat.len, sizeof(unsigned int));
+	m->step = 0;
+}
+
+static void vmFree(struct vm *m)
+{
+	free(m->cur);
+	free(m->next);
+	free(m->mark);
+}
+
+static inline bool isWordByte(unsigned char c)
+{
+	return isalnum(c) || c == '_';
+}
+
+/*
+  Whether the zero-width assertion op holds at pos in the line s[0, len):
+  the word boundaries look at the bytes on either side
+*/
+static bool assertAt(enum opcode op, const unsigned char *s, size_t pos, size_t len)
+{
+	bool before = pos > 0 && isWordByte(s[pos - 1]);
+	bool after = pos < len && isWordByte(s[pos]);
+	switch (op) {
+	case OP_BOL: return pos == 0;
+	case OP_EOL: return pos == len;
+	case OP_WORDB: return before != after;
+	case OP_NWORDB: return before == after;
+	case OP_BOW: return !before && after;
+	case OP_EOW: return before && !after;
+	default: return true;
+	}
+}
+
+/* Add pc to the next list, following jumps and zero-width assertions. Returns true on reaching OP_MATCH */
+static bool addThread(struct vm *m, int pc, const unsigned char *s, size_t pos, size_t len)
+{
+	while (m->mark[pc] != m->step) {
+		m->mark[pc] = m->step;
+		const struct inst *in = &pat.prog[pc];
+		switch (in->op) {
+		case OP_JMP:
+			pc = in->x;
+			continue;
+		case OP_SPLIT:
+			if (addThread(m, in->x, s, pos, len))
+				return true;
+			pc = in->y;
+			continue;
+		case OP_BOL:
+		case OP_EOL:
+		case OP_WORDB:
+		case OP_NWORDB:
+		case OP_BOW:
+		case OP_EOW:
+			if (!assertAt(in->op, s, pos, len))
+				return false;
+			++pc;
+			continue;
+		case OP_MATCH:
+			return true;
+		default:
+			m->next[m->numNext++] = pc;
+			return false;
+		}
+	}
+	return false;
+}
+
+/* Whether the pattern matches anywhere in the line s[0, len) */
+static bool vmMatch(struct vm *m, const unsigned char *s, size_t len)
+{
+	m->numCur = 0;
+	for (size_t pos = 0; ; ++pos) {
+		/* Start a new attempt at every position, the search is unanchored */
+		m->numNext = 0;
+		++m->step;
+		if (m->step == 0) { /* Wrapped, old marks could look current */
+			memset(m->mark, 0, pat.len * sizeof(unsigned int));
+			m->step = 1;
+		}
+		for (int i = 0; i < m->numCur; ++i) {
+			const struct inst *in = &pat.prog[m->cur[i]];
+			unsigned char c = s[pos - 1];
+			bool ok = in->op == OP_ANY || (in->op == OP_CHAR && in->c == c) || (in->op == OP_CLASS && classHas(in->x, c));
+			if (ok && addThread(m, m->cur[i] + 1, s, pos, len))
+				return true;
+		}
+		if (addThread(m, 0, s, pos, len))
+			return true;
+		if (pos == len)
+			return false;
+		int *t = m->cur;
+		m->cur = m->next;
+		m->next = t;
+		m->numCur = m->numNext;
+	}
+}
+
+/* Whether s[0, n) equals the needle, ignoring case if asked to */
+static inline bool needleAt(const char *s)
+{
+	if (!opts.ignoreCase)
+		return memcmp(s, pat.needle, pat.needleLen) == 0;
+	return strncasecmp(s, pat.needle, pat.needleLen) == 0;
+}
+
+static inline bool byteEq(unsigned char a, unsigned char b)
+{
+	return a == b || (opts.ignoreCase && tolower(a) == tolower(b));
+}
+
+/* Portable prefilter: memchr for the first fingerprint byte, or a plain loop when ignoring case */
+static const char* findScalar(const char *p, const char *end)
+{
+	if ((size_t) (end - p) < pat.needleLen)
+		return NULL;
+	const char *last = end - pat.needleLen;
+	unsigned char c1 = pat.needle[pat.fp1];
+	unsigned char c2 = pat.needle[pat.fp2];
+	while (p <= last) {
+		if (!opts.ignoreCase || !isalpha(c1)) {
+			p = memchr(p + pat.fp1, c1, last - p + 1);
+			if (p == NULL)
+				return NULL;
+			p -= pat.fp1;
+		}
+		else if (!byteEq(p[pat.fp1], c1)) {
+			++p;
+			continue;
+		}
+		if (byteEq(p[pat.fp2], c2) && needleAt(p))
+			return p;
+		++p;
+	}
+	return NULL;
+}
+
+#ifdef __x86_64__
+/*
+  Two-byte fingerprint search: compare 16 candidate starts at once against the
+  needle's two rarest bytes, at their offsets, and only check the whole needle
+  where both agree. Letters are compared with their case bit forced on under -i
+*/
+static const char* findSse2(const char *p, const char *end)
+{
+	if ((size_t) (end - p) < pat.needleLen)
+		return NULL;
+	unsigned char c1 = pat.needle[pat.fp1], c2 = pat.needle[pat.fp2];
+	unsigned char f1 = opts.ignoreCase && isalpha(c1) ? 0x20 : 0, f2 = opts.ignoreCase && isalpha(c2) ? 0x20 : 0;
+	const __m128i v1 = _mm_set1_epi8(c1 | f1), v2 = _mm_set1_epi8(c2 | f2);
+	const __m128i m1 = _mm_set1_epi8(f1), m2 = _mm_set1_epi8(f2);
+	while (p + pat.needleLen + 15 <= end) {
+		__m128i a = _mm_or_si128(_mm_loadu_si128((const __m128i*) (p + pat.fp1)), m1);
+		__m128i b = _mm_or_si128(_mm_loadu_si128((const __m128i*) (p + pat.fp2)), m2);
+		unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, v1), _mm_cmpeq_epi8(b, v2)));
+		while (mask != 0) {
+			const char *s = p + __builtin_ctz(mask);
+			if (needleAt(s))
+				return s;
+			mask &= mask - 1;
+		}
+		p += 16;
+	}
+	return findScalar(p, end);
+}
+
+/* findSse2 32 candidates at a time */
+__attribute__((target("avx2,bmi")))
+static const char* findAvx2(const char *p, const char *end)
+{
+	if ((size_t) (end - p) < pat.needleLen)
+		return NULL;
+	unsigned char c1 = pat.needle[pat.fp1], c2 = pat.needle[pat.fp2];
+	unsigned char f1 = opts.ignoreCase && isalpha(c1) ? 0x20 : 0, f2 = opts.ignoreCase && isalpha(c2) ? 0x20 : 0;
+	const __m256i v1 = _mm256_set1_epi8(c1 | f1), v2 = _mm256_set1_epi8(c2 | f2);
+	const __m256i m1 = _mm256_set1_epi8(f1), m2 = _mm256_set1_epi8(f2);
+	while (p + pat.needleLen + 31 <= end) {
+		__m256i a = _mm256_or_si256(_mm256_loadu_si256((const __m256i*) (p + pat.fp1)), m1);
+		__m256i b = _mm256_or_si256(_mm256_loadu_si256((const __m256i*) (p + pat.fp2)), m2);
+		unsigned int mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, v1), _mm256_cmpeq_epi8(b, v2)));
+		while (mask != 0) {
+			const char *s = p + __builtin_ctz(mask);
+			if (needleAt(s))
+				return s;
+			mask &= mask - 1;
+		}
+		p += 32;
+	}
+	return findSse2(p, end);
+}
+#endif
+
+/* First occurrence of the needle in [p, end), or NULL */
+static const char* (*findNeedleIn)(const char *p, const char *end);
+
+static void pickFinder(void)
+{
+	findNeedleIn = findScalar;
+#ifdef __x86_64__
+	/* A lone byte is memchr's job */
+	if (pat.needleLen < 2)
+		return;
+	__builtin_cpu_init();
+	findNeedleIn = __builtin_cpu_supports("avx2") ? findAvx2 : findSse2;
+#endif
+}
+
+/* One input and its results */
+struct grepFile {
+	const char *path;
+	struct soyWriter *out; /* Straight to stdout, or mem when scanned in parallel */
+	struct soyWriter mem;
+	unsigned long long selected;
+	unsigned long long lineNo; /* Line number of counted */
+	const char *counted; /* Newlines before this have been counted, for -n */
+	bool stop; /* Nothing more to learn from this file (-l, -q) */
+	bool error;
+	bool done; /* Scanned, output can be printed */
+};
+
+static struct soyWriter stdoutBuf;
+static atomic_bool anySelected;
+static bool printNames;
+
+/* Output one selected line */
+static void selectLine(struct grepFile *f, const char *line, const char *end)
+{
+	++f->selected;
+	atomic_store(&anySelected, true);
+	if (opts.quiet || opts.list) {
+		f->stop = true;
+		return;
+	}
+	if (opts.count)
+		return;
+	if (printNames) {
+		swWrite(f->out, f->path, strlen(f->path));
+		swWrite(f->out, ":", 1);
+	}
+	if (opts.lineNumbers) {
+		for (const char *nl; (nl = memchr(f->counted, '\n', line - f->counted)) != NULL; f->counted = nl + 1)
+			++f->lineNo;
+		f->counted = line;
+		swPrintf(f->out, "%llu:", f->lineNo);
+	}
+	swWrite(f->out, line, end - line);
+	swWrite(f->out, "\n", 1);
+}
+
+/* Run the pattern over every line of buf[0, len), the last one possibly without its newline */
+static void scanLines(struct grepFile *f, struct vm *m, const char *buf, size_t len)
+{
+	const char *p = buf, *end = buf + len;
+	if (opts.lineNumbers && f->counted == NULL)
+		f->counted = buf;
+	if (!opts.invert && pat.needleLen > 0) {
+		/* Jump from needle to needle, only the lines containing one can match */
+		while (p < end && !f->stop) {
+			const char *hit = findNeedleIn(p, end);
+			if (hit == NULL)
+				return;
+			const char *line = memrchr(p, '\n', hit - p);
+			line = line == NULL ? p : line + 1;
+			const char *eol = memchr(hit, '\n', end - hit);
+			if (eol == NULL)
+				eol = end;
+			if (pat.literal || vmMatch(m, (const unsigned char*) line, eol - line))
+				selectLine(f, line, eol);
+			p = eol + 1;
+		}
+		return;
+	}
+	while (p < end && !f->stop) {
+		const char *eol = memchr(p, '\n', end - p);
+		if (eol == NULL)
+			eol = end;
+		bool match;
+		if (pat.literal)
+			match = findNeedleIn(p, eol) != NULL;
+		else
+			match = vmMatch(m, (const unsigned char*) p, eol - p);
+		if (match != opts.invert)
+			selectLine(f, p, eol);
+		p = eol + 1;
+	}
+}
+
+/* Scan an input that can't be mapped through a fixed buffer, whole lines at a time */
+static int scanStream(struct grepFile *f, struct vm *m, int fd)
+{
+	size_t cap = STREAM_BUF, have = 0;
+	char *buf = malloc(cap);
+	int ret = 0;
+	while (!f->stop) {
+		if (have == cap) { /* A line longer than the buffer */
+			cap *= 2;
+			buf = realloc(buf, cap);
+		}
+		ssize_t n = read(fd, buf + have, cap - have);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n == -1) {
+			ret = -1;
+			break;
+		}
+		if (n == 0) {
+			if (have > 0) {
+				if (opts.lineNumbers)
+					f->counted = buf;
+				scanLines(f, m, buf, have);
+			}
+			break;
+		}
+		have += n;
+		const char *last = memrchr(buf, '\n', have);
+		if (last == NULL)
+			continue;
+		size_t whole = last - buf + 1;
+		if (opts.lineNumbers)
+			f->counted = buf;
+		scanLines(f, m, buf, whole);
+		/* Count the lines that weren't selected before the buffer is reused */
+		if (opts.lineNumbers)
+			for (const char *nl; (nl = memchr(f->counted, '\n', buf + whole - f->counted)) != NULL; f->counted = nl + 1)
+				++f->lineNo;
+		memmove(buf, buf + whole, have - whole);
+		have -= whole;
+	}
+	free(buf);
+	return ret;
+}
+
+static pthread_mutex_t emitLock = PTHREAD_MUTEX_INITIALIZER; /* Guards stdoutBuf once files are scanned in parallel */
+
+/* Scan one input, mapping it when it's a regular file */
+static void scanFile(struct grepFile *f, struct vm *m)
+{
+	bool isStdin = strcmp(f->path, "-") == 0;
+	int fd = isStdin ? STDIN_FILENO : open(f->path, O_RDONLY | O_CLOEXEC);
+	f->lineNo = 1;
+	int err = 0;
+	struct stat st;
+	if (fd == -1 || fstat(fd, &st) == -1)
+		err = errno;
+	else if (S_ISREG(st.st_mode) && st.st_size > 0) {
+		char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map != MAP_FAILED) {
+			madvise(map, st.st_size, MADV_SEQUENTIAL);
+			scanLines(f, m, map, st.st_size);
+			munmap(map, st.st_size);
+		}
+		else if (scanStream(f, m, fd) == -1)
+			err = errno;
+	}
+	else if (S_ISDIR(st.st_mode))
+		err = EISDIR;
+	else if (scanStream(f, m, fd) == -1)
+		err = errno;
+	if (fd != -1 && !isStdin)
+		close(fd);
+
+	if (err != 0) {
+		f->error = true;
+		pthread_mutex_lock(&emitLock);
+		swFlush(&stdoutBuf);
+		fprintf(stderr, "grep: %s: %s\n", f->path, strerror(err));
+		pthread_mutex_unlock(&emitLock);
+		return;
+	}
+	if (opts.quiet)
+		return;
+	if (opts.count) {
+		if (printNames)
+			swPrintf(f->out, "%s:", f->path);
+		swPrintf(f->out, "%llu\n", f->selected);
+	}
+	else if (opts.list && f->selected > 0)
+		swLine(f->out, f->path);
+}
+
+/* Shared state of a parallel scan: results are printed in argument order */
+static struct grepFile *files;
+static size_t numFiles;
+static size_t cursor; /* Next file to print */
+static struct vm *vms; /* One per worker */
+
+/* Pool callback: scan one file into memory, then print whatever is next in line */
+static void grepTask(struct workpool *pool, void *task, void *arg)
+{
+	struct grepFile *f = task;
+	(void) arg;
+	scanFile(f, &vms[wpWorker(pool)]);
+	pthread_mutex_lock(&emitLock);
+	f->done = true;
+	while (cursor < numFiles && files[cursor].done) {
+		swWrite(&stdoutBuf, files[cursor].mem.buf, files[cursor].mem.len);
+		swFree(&files[cursor].mem);
+		++cursor;
+	}
+	pthread_mutex_unlock(&emitLock);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int threads = 0;
+	opts.names = -1;
+	int c;
+	while ((c = getopt(argc, argv, "EFGivclnqHhj:")) != -1) {
+		switch (c) {
+		case 'E':
+			opts.extended = true;
+			break;
+		case 'F':
+			opts.fixed = true;
+			break;
+		case 'G':
+			opts.extended = false;
+			break;
+		case 'i':
+			opts.ignoreCase = true;
+			break;
+		case 'v':
+			opts.invert = true;
+			break;
+		case 'c':
+			opts.count = true;
+			break;
+		case 'l':
+			opts.list = true;
+			break;
+		case 'n':
+			opts.lineNumbers = true;
+			break;
+		case 'q':
+			opts.quiet = true;
+			break;
+		case 'H':
+			opts.names = 1;
+			break;
+		case 'h':
+			opts.names = 0;
+			break;
+		case 'j':
+			threads = atoi(optarg);
+			if (threads < 1 || threads > MAX_THREADS) {
+				fprintf(stderr, "grep: number of threads must be between 1 and %d\n", MAX_THREADS);
+				return 2;
+			}
+			break;
+		default:
+			return 2;
+		}
+	}
+	if (optind >= argc) {
+		fprintf(stderr, "Usage: grep [-EFivclnqHh] [-j THREADS] PATTERN [FILE]...\n");
+		return 2;
+	}
+	const char *err = compilePattern(argv[optind++]);
+	if (err != NULL) {
+		fprintf(stderr, "grep: %s\n", err);
+		return 2;
+	}
+	pickFinder();
+
+	char *dash[] = { "-" };
+	char **paths = argv + optind;
+	numFiles = argc - optind;
+	if (numFiles == 0) {
+		paths = dash;
+		numFiles = 1;
+	}
+	printNames = opts.names == -1 ? numFiles > 1 : opts.names;
+	if (threads == 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cpus < 1 ? 1 : cpus > DEFAULT_THREADS ? DEFAULT_THREADS : cpus;
+	}
+	if (threads > numFiles)
+		threads = numFiles;
+
+	swInit(&stdoutBuf, STDOUT_FILENO, OUT_BUF);
+	files = calloc(numFiles, sizeof(struct grepFile));
+	vms = malloc(threads * sizeof(struct vm));
+	for (unsigned int i = 0; i < threads; ++i)
+		vmInit(&vms[i]);
+	bool failed = false;
+	if (threads == 1) {
+		for (size_t i = 0; i < numFiles && !(opts.quiet && atomic_load(&anySelected)); ++i) {
+			files[i].path = paths[i];
+			files[i].out = &stdoutBuf;
+			scanFile(&files[i], &vms[0]);
+			failed |= files[i].error;
+		}
+	}
+	else {
+		struct workpool *pool = wpCreate(threads, grepTask, NULL);
+		/* Workers take their newest task first, so push the last file first */
+		for (size_t i = numFiles; i-- > 0; ) {
+			files[i].path = paths[i];
+			files[i].out = &files[i].mem;
+			swInit(&files[i].mem, -1, 0);
+			wpPush(pool, &files[i]);
+		}
+		wpRun(pool);
+		wpDestroy(pool);
+		for (size_t i = 0; i < numFiles; ++i)
+			failed |= files[i].error;
+	}
+	swFlush(&stdoutBuf);
+	for (unsigned int i = 0; i < threads; ++i)
+		vmFree(&vms[i]);
+	free(vms);
+	free(files);
+	free(pat.classes);
+	if (opts.quiet && atomic_load(&anySelected))
+		return 0;
+	return failed ? 2 : atomic_load(&anySelected) ? 0 : 1;
+}
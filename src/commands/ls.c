@@ -1,26 +1,641 @@
-#include <stdio.h>
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
 #include <dirent.h>
+#include <stdio.h>
+#include <time.h>
+#include <limits.h>
+#include <pwd.h>
+#include <grp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
+#include "strsort.h"
+#include "uring.h"
+#include "workpool.h"
+#include "soyio.h"
 
-int main(int argc, char** argv) {
-	
-	DIR *d;
-	struct dirent *dir;
-	if (argc < 2) {
-		d = opendir(".");
+#define DENTS_BUF (1 << 20) /* Bytes of directory entries fetched per getdents64 call */
+#define OUT_BUF (1 << 20) /* Size of the output buffer */
+#define ARENA_CHUNK (1 << 20) /* Names are stored in blocks of this size when sorting */
+#define STAT_BATCH 256 /* statx calls submitted per io_uring_enter */
+#define STAT_THREADS 8 /* Threads issuing statx calls when io_uring isn't available */
+#define STAT_PARALLEL_MIN 64 /* Directories smaller than this are stat'd on the main thread */
+#define STAT_CHUNK 32 /* Entries a stat thread claims at a time */
+#define ID_CACHE 16 /* Recently looked up user and group names kept */
+#define TREE_THREADS 8 /* Default workers for -R, walking trees is mostly waiting on metadata I/O */
+#define MAX_THREADS 64
+
+/* Record layout returned by getdents64 */
+struct linuxDirent64 {
+	unsigned long long d_ino;
+	long long d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+struct lsOpts {
+	bool sort; /* Sort names instead of printing them in directory order */
+	bool longList; /* One line of metadata per entry */
+	bool classify; /* Append a type indicator (/ @ | =) to names */
+};
+
+/* Output goes through one big buffer so a huge listing costs a handful of write calls */
+static struct soyWriter stdoutBuf;
+
+/* Copies of names kept for sorting, packed into large blocks instead of one malloc each */
+struct arena {
+	char **blocks;
+	size_t numBlocks;
+	size_t used; /* Bytes used in the last block */
+};
+
+/* Store the name with its d_type in the byte just before it, so the type follows the name through sorting */
+static char* arenaCopy(struct arena *a, const char *s, size_t len, unsigned char type)
+{
+	if (a->numBlocks == 0 || a->used + len + 2 > ARENA_CHUNK) {
+		a->blocks = realloc(a->blocks, (a->numBlocks + 1) * sizeof(char*));
+		a->blocks[a->numBlocks++] = malloc(ARENA_CHUNK);
+		a->used = 0;
+	}
+	char *p = a->blocks[a->numBlocks - 1] + a->used;
+	p[0] = type;
+	memcpy(p + 1, s, len + 1);
+	a->used += len + 2;
+	return p + 1;
+}
+
+#define NAME_TYPE(name) ((unsigned char) (name)[-1])
+
+static void arenaFree(struct arena *a)
+{
+	for (size_t i = 0; i < a->numBlocks; ++i)
+		free(a->blocks[i]);
+	free(a->blocks);
+}
+
+/* Metadata of the entries of one directory being long listed */
+struct statJob {
+	int dirFd;
+	const char **names;
+	struct statx *stx;
+	int *err; /* 0, or errno of a failed statx */
+	size_t num;
+	atomic_size_t next; /* Next index for the stat threads to claim */
+};
+
+/* Stat thread: claim chunks of entries until all are done */
+static void* statWorker(void *arg)
+{
+	struct statJob *job = arg;
+	size_t start;
+	while ((start = atomic_fetch_add(&job->next, STAT_CHUNK)) < job->num) {
+		size_t end = start + STAT_CHUNK < job->num ? start + STAT_CHUNK : job->num;
+		for (size_t i = start; i < end; ++i)
+			job->err[i] = statx(job->dirFd, job->names[i], AT_SYMLINK_NOFOLLOW, STATX_BASIC_STATS, &job->stx[i]) == 0 ? 0 : errno;
+	}
+	return NULL;
+}
+
+/* Per-thread state for stat'ing big directories, one for each pool worker of a recursive listing */
+struct lsWorker {
+	bool pooled; /* On a pool thread, whose siblings are already busy: no extra stat threads */
+	int ringState; /* 0 = not set up yet, 1 = usable, -1 = io_uring unavailable */
+	struct uring ring; /* Reused for every directory the worker lists */
+};
+
+static struct lsWorker *workers;
+
+static void dropRing(struct lsWorker *w)
+{
+	uringExit(&w->ring);
+	w->ringState = -1;
+}
+
+/*
+  Stat every entry with batches of io_uring STATX operations on the worker's ring.
+  Returns -1 if io_uring can't be used or fails partway, with job->next at the
+  first entry still to stat
+*/
+static int statUring(struct statJob *job, struct lsWorker *w)
+{
+	if (w->ringState == 0)
+		w->ringState = uringInit(&w->ring, STAT_BATCH) == 0 ? 1 : -1;
+	if (w->ringState == -1)
+		return -1;
+	for (size_t start = 0; start < job->num; start += STAT_BATCH) {
+		size_t end = start + STAT_BATCH < job->num ? start + STAT_BATCH : job->num;
+		for (size_t i = start; i < end; ++i)
+			uringPrepStatx(uringGetSqe(&w->ring), job->dirFd, job->names[i], AT_SYMLINK_NOFOLLOW, STATX_BASIC_STATS,
+				       &job->stx[i], i);
+		/* A short or failed submit leaves the rest of the batch unsubmitted */
+		int submitted = uringSubmit(&w->ring, end - start);
+		bool broken = submitted < (int) (end - start);
+		size_t inFlight = start + (submitted > 0 ? submitted : 0);
+		for (size_t done = start; done < inFlight; ) {
+			struct io_uring_cqe *cqe = uringPeek(&w->ring);
+			if (cqe == NULL) {
+				/* What's in flight still writes into stx, so keep collecting it even if waiting fails */
+				if (broken || uringSubmit(&w->ring, inFlight - done) == -1) {
+					broken = true;
+					sched_yield();
+				}
+				continue;
+			}
+			job->err[cqe->user_data] = cqe->res < 0 ? -cqe->res : 0;
+			uringSeen(&w->ring);
+			++done;
+		}
+		if (start == 0 && inFlight > 0 && job->err[0] == EINVAL) { /* io_uring without the STATX opcode */
+			dropRing(w);
+			return -1;
+		}
+		if (broken) {
+			dropRing(w);
+			atomic_store(&job->next, inFlight);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+  Fetch metadata for every entry relative to the directory fd. Big directories are
+  stat'd as io_uring batches, or on a few threads when io_uring isn't available,
+  since on network filesystems the time goes into waiting for each reply
+*/
+static void statAll(struct statJob *job, struct lsWorker *w)
+{
+	atomic_init(&job->next, 0);
+	if (job->num < STAT_PARALLEL_MIN) {
+		statWorker(job);
+		return;
+	}
+	if (statUring(job, w) == 0)
+		return;
+	if (w->pooled) {
+		statWorker(job);
+		return;
+	}
+	pthread_t tids[STAT_THREADS];
+	unsigned int started = 0;
+	for (unsigned int i = 0; i < STAT_THREADS; ++i) {
+		if (pthread_create(&tids[started], NULL, statWorker, job) != 0)
+			break;
+		++started;
+	}
+	statWorker(job); /* Help out, and make sure the work gets done even without threads */
+	for (unsigned int i = 0; i < started; ++i)
+		pthread_join(tids[i], NULL);
+}
+
+/* Look up the name of a user or group id into name, or its number if it has none */
+static void lookupId(unsigned int id, bool group, char *name, size_t len)
+{
+	size_t size = 1024;
+	char *buf = NULL;
+	int err;
+	do {
+		char *grown = realloc(buf, size);
+		if (grown == NULL)
+			break;
+		buf = grown;
+		struct passwd pw, *pwp = NULL;
+		struct group gr, *grp = NULL;
+		if (group)
+			err = getgrgid_r(id, &gr, buf, size, &grp);
+		else
+			err = getpwuid_r(id, &pw, buf, size, &pwp);
+		if (err == 0 && (group ? grp != NULL : pwp != NULL)) {
+			snprintf(name, len, "%s", group ? gr.gr_name : pw.pw_name);
+			free(buf);
+			return;
+		}
+		size *= 2;
+	} while (err == ERANGE);
+	free(buf);
+	snprintf(name, len, "%u", id);
+}
+
+/*
+  Name of a user or group id, copied into name. A small cache shared by all
+  threads saves the lookups, since a directory usually has few owners
+*/
+static void idName(unsigned int id, bool group, char *name, size_t len)
+{
+	static struct {
+		bool used;
+		bool group;
+		unsigned int id;
+		char name[32];
+	} cache[ID_CACHE];
+	static unsigned int nextSlot = 0;
+	static pthread_mutex_t idLock = PTHREAD_MUTEX_INITIALIZER;
+	pthread_mutex_lock(&idLock);
+	for (int i = 0; i < ID_CACHE; ++i) {
+		if (cache[i].used && cache[i].id == id && cache[i].group == group) {
+			snprintf(name, len, "%s", cache[i].name);
+			pthread_mutex_unlock(&idLock);
+			return;
+		}
+	}
+	unsigned int slot = nextSlot++ % ID_CACHE;
+	cache[slot].used = true;
+	cache[slot].group = group;
+	cache[slot].id = id;
+	lookupId(id, group, cache[slot].name, sizeof(cache[slot].name));
+	snprintf(name, len, "%s", cache[slot].name);
+	pthread_mutex_unlock(&idLock);
+}
+
+/* Type indicator appended with -F, from d_type alone */
+static const char* typeSuffix(unsigned char type)
+{
+	switch (type) {
+	case DT_DIR: return "/";
+	case DT_LNK: return "@";
+	case DT_FIFO: return "|";
+	case DT_SOCK: return "=";
+	default: return "";
+	}
+}
+
+/* Write one entry of a long listing */
+static void writeLong(struct soyWriter *out, int dirFd, const char *name, const struct statx *stx, const struct lsOpts *opts)
+{
+	static const char types[] = "?pc?d?b?-?l?s???";
+	char mode[11];
+	mode[0] = types[(stx->stx_mode >> 12) & 15];
+	const char *rwx = "rwxrwxrwx";
+	for (int i = 0; i < 9; ++i)
+		mode[i + 1] = (stx->stx_mode & (0400 >> i)) ? rwx[i] : '-';
+	if (stx->stx_mode & S_ISUID)
+		mode[3] = (stx->stx_mode & S_IXUSR) ? 's' : 'S';
+	if (stx->stx_mode & S_ISGID)
+		mode[6] = (stx->stx_mode & S_IXGRP) ? 's' : 'S';
+	if (stx->stx_mode & S_ISVTX)
+		mode[9] = (stx->stx_mode & S_IXOTH) ? 't' : 'T';
+	mode[10] = '\0';
+
+	/* Like GNU ls, show the year instead of the time for anything older than six months */
+	char when[32];
+	time_t t = stx->stx_mtime.tv_sec;
+	struct tm tm;
+	localtime_r(&t, &tm);
+	strftime(when, sizeof(when), (time(NULL) - t) > 182 * 24 * 3600 || t > time(NULL) ? "%b %e  %Y" : "%b %e %H:%M", &tm);
+
+	char user[32], group[32];
+	idName(stx->stx_uid, false, user, sizeof(user));
+	idName(stx->stx_gid, true, group, sizeof(group));
+	swPrintf(out, "%s %3u %-8s %-8s %8llu %s %s%s", mode, stx->stx_nlink, user, group, (unsigned long long) stx->stx_size,
+		 when, name, opts->classify && !S_ISLNK(stx->stx_mode) ? typeSuffix(IFTODT(stx->stx_mode)) : "");
+	if (S_ISLNK(stx->stx_mode)) {
+		char target[PATH_MAX];
+		ssize_t n = readlinkat(dirFd, name, target, sizeof(target) - 1);
+		if (n > 0) {
+			swWrite(out, " -> ", 4);
+			swWrite(out, target, n);
+		}
+	}
+	swWrite(out, "\n", 1);
+}
+
+/* Write an entry whose metadata couldn't be read */
+static void writeUnknown(struct soyWriter *out, const char *name, int err)
+{
+	swWrite(out, "?????????? ", 11);
+	swWrite(out, name, strlen(name));
+	swWrite(out, " (", 2);
+	swWrite(out, strerror(err), strlen(strerror(err)));
+	swWrite(out, ")\n", 2);
+}
+
+/* Write the collected entries, stat'ing them first if the listing needs more than d_type */
+static void writeEntries(struct soyWriter *out, int dirFd, const char **list, size_t num, const struct lsOpts *opts,
+			 struct lsWorker *w)
+{
+	if (!opts->longList) {
+		for (size_t i = 0; i < num; ++i) {
+			unsigned char type = NAME_TYPE(list[i]);
+			swWrite(out, list[i], strlen(list[i]));
+			if (opts->classify) {
+				struct stat st;
+				if (type == DT_UNKNOWN && fstatat(dirFd, list[i], &st, AT_SYMLINK_NOFOLLOW) == 0)
+					type = IFTODT(st.st_mode); /* Filesystem doesn't fill in d_type */
+				swLine(out, typeSuffix(type));
+			}
+			else
+				swWrite(out, "\n", 1);
+		}
+		return;
+	}
+	struct statJob job;
+	job.dirFd = dirFd;
+	job.names = list;
+	job.num = num;
+	job.stx = malloc(num * sizeof(struct statx));
+	job.err = malloc(num * sizeof(int));
+	statAll(&job, w);
+	/* Like GNU ls, the total is in 1K blocks, rounded up */
+	unsigned long long blocks = 0;
+	for (size_t i = 0; i < num; ++i)
+		if (job.err[i] == 0)
+			blocks += job.stx[i].stx_blocks;
+	swPrintf(out, "total %llu\n", (blocks + 1) / 2);
+	for (size_t i = 0; i < num; ++i) {
+		if (job.err[i] == 0)
+			writeLong(out, dirFd, list[i], &job.stx[i], opts);
+		else
+			writeUnknown(out, list[i], job.err[i]);
+	}
+	free(job.stx);
+	free(job.err);
+}
+
+/*
+  A directory of a recursive listing. Its listing is buffered until everything
+  before it in depth-first order has been printed
+*/
+struct treeNode {
+	char *path;
+	const char *name; /* Last component of path, opened relative to the parent's fd */
+	int fd;
+	struct treeNode *parent;
+	size_t index; /* Position among the parent's children */
+	struct treeNode **children; /* Subdirectories in listing order */
+	size_t numChildren;
+	struct soyWriter out;
+	bool listed; /* Listing is complete and children are known */
+	atomic_uint refs; /* Own listing plus children that still have to open themselves relative to fd */
+};
+
+/* Shared state of a recursive listing */
+static pthread_mutex_t emitLock = PTHREAD_MUTEX_INITIALIZER;
+static struct treeNode topNode; /* Parent of the command line arguments, never printed */
+static struct treeNode *cursor; /* Next node to print */
+static bool printedBlock = false;
+static atomic_bool failed;
+
+/* Done with the node's fd once it and all its children have opened */
+static void releaseFd(struct treeNode *n)
+{
+	if (n != &topNode && atomic_fetch_sub(&n->refs, 1) == 1 && n->fd != -1)
+		close(n->fd);
+}
+
+/* Next node in depth-first order once n's whole subtree is printed, freeing what's finished */
+static struct treeNode* ascend(struct treeNode *n)
+{
+	while (n != &topNode) {
+		struct treeNode *p = n->parent;
+		size_t next = n->index + 1;
+		free(n->children);
+		free(n->path);
+		free(n);
+		if (next < p->numChildren)
+			return p->children[next];
+		n = p;
+	}
+	return NULL;
+}
+
+/* Print every listed node that's next in line. Called by whichever worker finishes a listing */
+static void emitReady(void)
+{
+	pthread_mutex_lock(&emitLock);
+	while (cursor != NULL && cursor->listed) {
+		struct treeNode *n = cursor;
+		if (n != &topNode) {
+			if (printedBlock)
+				swWrite(&stdoutBuf, "\n", 1);
+			swWrite(&stdoutBuf, n->out.buf, n->out.len);
+			printedBlock = true;
+			swFree(&n->out);
+		}
+		cursor = n->numChildren > 0 ? n->children[0] : ascend(n);
+	}
+	pthread_mutex_unlock(&emitLock);
+}
+
+/*
+  List one directory with raw getdents64 calls into a large buffer
+  Unsorted, names are written out as they arrive, so memory use doesn't depend on the directory size
+  With node set (recursive listing), the subdirectories found become its children
+  w is the calling thread's state for stat'ing the entries
+  Returns 0 on success, 1 on failure
+*/
+static int listDir(int fd, struct soyWriter *out, const struct lsOpts *opts, struct treeNode *node, struct lsWorker *w)
+{
+	char *buf = malloc(DENTS_BUF);
+	struct arena names = { NULL, 0, 0 };
+	const char **list = NULL;
+	size_t num = 0, max = 0;
+	int r = 0;
+	/* Only a plain unsorted listing can go straight out */
+	bool collect = opts->sort || opts->longList || opts->classify || node != NULL;
+	while (1) {
+		long n = syscall(SYS_getdents64, fd, buf, DENTS_BUF);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			r = 1;
+			break;
+		}
+		if (n == 0)
+			break;
+		for (long pos = 0; pos < n; ) {
+			struct linuxDirent64 *d = (struct linuxDirent64*) (buf + pos);
+			pos += d->d_reclen;
+			if (!collect) {
+				swLine(out, d->d_name);
+				continue;
+			}
+			if (num == max) {
+				max = max ? 2 * max : 1024;
+				list = realloc(list, max * sizeof(char*));
+			}
+			list[num++] = arenaCopy(&names, d->d_name, strlen(d->d_name), d->d_type);
+		}
+	}
+	if (collect) {
+		if (opts->sort)
+			radixSort(list, num);
+		writeEntries(out, fd, list, num, opts, w);
+	}
+	if (node != NULL) {
+		for (size_t i = 0; i < num; ++i) {
+			const char *name = list[i];
+			unsigned char type = NAME_TYPE(name);
+			if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+				continue;
+			struct stat st;
+			if (type == DT_UNKNOWN && fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+				type = IFTODT(st.st_mode);
+			if (type != DT_DIR)
+				continue;
+			struct treeNode *c = calloc(1, sizeof(struct treeNode));
+			c->path = malloc(strlen(node->path) + strlen(name) + 2);
+			sprintf(c->path, strcmp(node->path, "/") == 0 ? "%s%s" : "%s/%s", node->path, name);
+			c->name = c->path + strlen(c->path) - strlen(name);
+			c->parent = node;
+			c->index = node->numChildren;
+			swInit(&c->out, -1, 0); /* Held in memory until it's this directory's turn to print */
+			atomic_init(&c->refs, 1);
+			node->children = realloc(node->children, (node->numChildren + 1) * sizeof(struct treeNode*));
+			node->children[node->numChildren++] = c;
+		}
+	}
+	free(list);
+	arenaFree(&names);
+	free(buf);
+	if (r != 0)
+		swLine(out, "directory cannot be read.");
+	return r;
+}
+
+/* Pool callback: open and list one directory of a recursive listing, then queue its subdirectories */
+static void listTask(struct workpool *pool, void *task, void *arg)
+{
+	struct treeNode *n = task;
+	const struct lsOpts *opts = arg;
+	struct treeNode *p = n->parent;
+	n->fd = openat(p == &topNode ? AT_FDCWD : p->fd, p == &topNode ? n->path : n->name,
+		       O_RDONLY | O_DIRECTORY | O_CLOEXEC | (p == &topNode ? 0 : O_NOFOLLOW));
+	releaseFd(p);
+	swWrite(&n->out, n->path, strlen(n->path));
+	swWrite(&n->out, ":\n", 2);
+	if (n->fd == -1) {
+		swLine(&n->out, "directory cannot be read.");
+		atomic_store(&failed, true);
 	}
 	else {
-		d = opendir(argv[1]);
+		if (listDir(n->fd, &n->out, opts, n, &workers[wpWorker(pool)]) != 0)
+			atomic_store(&failed, true);
+		atomic_fetch_add(&n->refs, n->numChildren);
+		for (size_t i = 0; i < n->numChildren; ++i)
+			wpPush(pool, n->children[i]);
+	}
+	releaseFd(n);
+	/* The node may be printed and freed as soon as it's marked listed */
+	pthread_mutex_lock(&emitLock);
+	n->listed = true;
+	pthread_mutex_unlock(&emitLock);
+	emitReady();
+}
+
+/* List every argument and all directories below it, in parallel but printed in depth-first order */
+static int listTree(char **paths, int num, const struct lsOpts *opts, unsigned int threads)
+{
+	struct workpool *pool = wpCreate(threads, listTask, (void*) opts);
+	workers = calloc(wpThreads(pool), sizeof(struct lsWorker));
+	for (unsigned int i = 0; i < wpThreads(pool); ++i)
+		workers[i].pooled = true;
+	topNode.listed = true;
+	topNode.children = malloc(num * sizeof(struct treeNode*));
+	for (int i = 0; i < num; ++i) {
+		struct treeNode *c = calloc(1, sizeof(struct treeNode));
+		c->path = strdup(paths[i]);
+		c->name = c->path;
+		c->parent = &topNode;
+		c->index = i;
+		swInit(&c->out, -1, 0);
+		atomic_init(&c->refs, 1);
+		topNode.children[topNode.numChildren++] = c;
 	}
+	cursor = &topNode;
+	for (int i = 0; i < num; ++i)
+		wpPush(pool, topNode.children[i]);
+	wpRun(pool);
+	for (unsigned int i = 0; i < wpThreads(pool); ++i)
+		if (workers[i].ringState == 1)
+			uringExit(&workers[i].ring);
+	free(workers);
+	wpDestroy(pool);
+	emitReady();
+	free(topNode.children);
+	return atomic_load(&failed) ? 1 : 0;
+}
+
+int main(int argc, char** argv) {
 
-	if (d == NULL) {
-		printf("directory cannot be read.\n");
-		return 1;
+	struct lsOpts opts = { false, false, false };
+	bool recursive = false;
+	unsigned int threads = TREE_THREADS;
+	swInit(&stdoutBuf, STDOUT_FILENO, OUT_BUF);
+	static struct option longOpts[] = {
+		{ "sort", no_argument, NULL, 's' },
+		{ "recursive", no_argument, NULL, 'R' },
+		{ "jobs", required_argument, NULL, 'j' },
+		{ NULL, 0, NULL, 0 }
+	};
+	int c;
+	while ((c = getopt_long(argc, argv, "lFRj:", longOpts, NULL)) != -1) {
+		switch (c) {
+		case 'l':
+			opts.longList = true;
+			break;
+		case 'F':
+			opts.classify = true;
+			break;
+		case 's':
+			opts.sort = true;
+			break;
+		case 'R':
+			recursive = true;
+			break;
+		case 'j':
+			threads = atoi(optarg);
+			if (threads < 1 || threads > MAX_THREADS) {
+				swLine(&stdoutBuf, "ls: invalid number of threads");
+				swFlush(&stdoutBuf);
+				return 1;
+			}
+			break;
+		default:
+			return 1;
+		}
 	}
-        dir = readdir(d);
-	while (dir != NULL) {
-		printf("%s\n", dir->d_name);
-                dir = readdir(d);
+
+	int r = 0;
+	char *dot[] = { "." };
+	char **dirs = argv + optind;
+	int numDirs = argc - optind;
+	if (numDirs == 0) {
+		dirs = dot;
+		numDirs = 1;
 	}
-	closedir(d);
-	return 0;
+	if (recursive)
+		r = listTree(dirs, numDirs, &opts, threads);
+	else {
+		struct lsWorker single = { .pooled = false, .ringState = 0 };
+		for (int i = 0; i < numDirs; ++i) {
+			if (numDirs > 1) { /* Say which directory is which */
+				if (i > 0)
+					swWrite(&stdoutBuf, "\n", 1);
+				swWrite(&stdoutBuf, dirs[i], strlen(dirs[i]));
+				swWrite(&stdoutBuf, ":\n", 2);
+			}
+			int fd = open(dirs[i], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+			if (fd == -1) {
+				swLine(&stdoutBuf, "directory cannot be read.");
+				r = 1;
+				continue;
+			}
+			if (listDir(fd, &stdoutBuf, &opts, NULL, &single) != 0)
+				r = 1;
+			close(fd);
+		}
+		if (single.ringState == 1)
+			uringExit(&single.ring);
+	}
+	swFlush(&stdoutBuf);
+	return r;
 }
@@ -1,25 +1,240 @@
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <stdio.h>
-#include <errno.h>
-int main(int argc, char **argv)
-{
-    int status;
-    int r = 0;
-    if (argc < 2)
-    {
-	    puts("No arguments given");
-	    return 1;
-    }
-    for (int i = 1; i < argc; i++) {
-        status = mkdir(argv[i],0700);
-        if (status == -1)
-        {
-            if (errno == EEXIST) {
-                printf("Error: directory %s already exists\n",argv[i]);
-            }
-            r = 1;
-        }
-    }
-    return r;
-}
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include "strsort.h"
+
+#define MAX_DEPTH 512 /* Deepest path -p will create */
+
+/*
+  Directories opened while creating the previous path with -p. The next path
+  starts from the deepest directory it has in common with this one, so a
+  shared prefix is resolved once instead of once per argument
+*/
+struct pathCache {
+    bool absolute; /* Components are relative to / rather than the cwd */
+    int depth; /* Number of cached components */
+    char *names[MAX_DEPTH];
+    int fds[MAX_DEPTH]; /* O_PATH fd of each component, -1 until something needs it */
+};
+
+static void cacheTruncate(struct pathCache *c, int depth)
+{
+    while (c->depth > depth)
+    {
+        --c->depth;
+        if (c->fds[c->depth] != -1)
+            close(c->fds[c->depth]);
+        free(c->names[c->depth]);
+    }
+}
+
+/* fd of the directory at depth (0 = the starting directory), opening it if needed */
+static int cacheFd(struct pathCache *c, int depth)
+{
+    if (depth == 0)
+        return c->absolute ? c->fds[MAX_DEPTH - 1] : AT_FDCWD;
+    if (c->fds[depth - 1] == -1)
+        c->fds[depth - 1] = openat(cacheFd(c, depth - 1), c->names[depth - 1], O_PATH | O_DIRECTORY | O_CLOEXEC);
+    return c->fds[depth - 1];
+}
+
+/*
+  mkdir -p: create every missing component of path with mkdirat relative to
+  its parent's fd. Components shared with the previous path are reused, the
+  rest are opened until one is missing, and everything past that is created
+  outright since it can't exist yet. The last component gets mode, the ones
+  leading to it parentMode. On failure *err is set to the message to report
+*/
+static int makePath(struct pathCache *c, const char *path, mode_t mode, mode_t parentMode, char **err)
+{
+    char *copy = strdup(path);
+    char *comps[MAX_DEPTH];
+    int n = 0;
+    for (char *tok = strtok(copy, "/"); tok != NULL; tok = strtok(NULL, "/"))
+    {
+        if (n == MAX_DEPTH - 1)
+        {
+            asprintf(err, "Error: path %s is too deep", path);
+            free(copy);
+            return 1;
+        }
+        comps[n++] = tok;
+    }
+
+    bool absolute = path[0] == '/';
+    if (absolute != c->absolute)
+    {
+        cacheTruncate(c, 0);
+        c->absolute = absolute;
+    }
+    int common = 0;
+    while (common < n && common < c->depth && strcmp(comps[common], c->names[common]) == 0)
+        ++common;
+    cacheTruncate(c, common);
+
+    bool creating = false; /* A parent was just created, so nothing below it exists */
+    int r = 0;
+    for (int i = common; i < n; ++i)
+    {
+        int parent = cacheFd(c, i);
+        if (parent == -1 && i > 0)
+        {
+            asprintf(err, "Error: cannot open directory %s: %s", path, strerror(errno));
+            r = 1;
+            break;
+        }
+        int fd = -1;
+        if (!creating)
+            fd = openat(parent, comps[i], O_PATH | O_DIRECTORY | O_CLOEXEC);
+        if (fd == -1)
+        {
+            if (!creating && errno != ENOENT)
+            {
+                asprintf(err, "Error: %s: %s", path, strerror(errno));
+                r = 1;
+                break;
+            }
+            if (mkdirat(parent, comps[i], i == n - 1 ? mode : parentMode) == -1 && errno != EEXIST)
+            {
+                asprintf(err, "Error: cannot create directory %s: %s", path, strerror(errno));
+                r = 1;
+                break;
+            }
+            creating = true;
+        }
+        c->names[c->depth] = strdup(comps[i]);
+        c->fds[c->depth] = fd; /* Newly created ones are only opened if a later path goes through them */
+        ++c->depth;
+    }
+    free(copy);
+    return r;
+}
+
+/* Parse an octal mode for -m */
+static bool parseMode(const char *s, mode_t *mode)
+{
+    char *end;
+    long m = strtol(s, &end, 8);
+    if (*s == '\0' || *end != '\0' || m < 0 || m > 07777)
+        return false;
+    *mode = m;
+    return true;
+}
+
+/* Position of the string at address s in the sorted array strs */
+static size_t sortedIndex(const char **strs, size_t n, const char *s)
+{
+    size_t lo = 0;
+    size_t hi = n;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(strs[mid], s) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    while (strs[lo] != s) /* Skip over equal operands given earlier */
+        ++lo;
+    return lo;
+}
+
+int main(int argc, char **argv)
+{
+    int status;
+    int r = 0;
+    bool parents = false;
+    bool modeGiven = false;
+    mode_t mode = 0700;
+    int c;
+    while ((c = getopt(argc, argv, "pm:")) != -1)
+    {
+        switch (c)
+        {
+        case 'p':
+            parents = true;
+            break;
+        case 'm':
+            if (!parseMode(optarg, &mode))
+            {
+                printf("Error: invalid mode %s\n", optarg);
+                return 1;
+            }
+            modeGiven = true;
+            break;
+        default:
+            return 1;
+        }
+    }
+    if (optind >= argc)
+    {
+	    puts("No arguments given");
+	    return 1;
+    }
+    /* Parents -p creates get the default mode, plus whatever we need to create inside them */
+    mode_t mask = umask(0);
+    mode_t parentMode = (0777 & ~mask) | S_IWUSR | S_IXUSR;
+    if (!modeGiven) /* -m is the exact mode, not one filtered by the umask */
+    {
+        umask(mask);
+        parentMode = mode | S_IWUSR | S_IXUSR;
+    }
+
+    if (parents)
+    {
+        /*
+          Sorted, paths sharing a prefix come one after another and reuse it.
+          Errors are kept until all are made so they come out in argument order
+        */
+        int n = argc - optind;
+        const char **paths = malloc(n * sizeof(char*));
+        char **errs = calloc(n, sizeof(char*));
+        for (int i = 0; i < n; i++)
+            paths[i] = argv[optind + i];
+        radixSort(paths, n);
+        struct pathCache cache;
+        cache.absolute = false;
+        cache.depth = 0;
+        cache.fds[MAX_DEPTH - 1] = open("/", O_PATH | O_DIRECTORY | O_CLOEXEC);
+        for (int i = 0; i < n; i++)
+        {
+            if (makePath(&cache, paths[i], mode, parentMode, &errs[i]) != 0)
+                r = 1;
+        }
+        cacheTruncate(&cache, 0);
+        close(cache.fds[MAX_DEPTH - 1]);
+        for (int i = 0; i < n; i++)
+        {
+            char *err = errs[sortedIndex(paths, n, argv[optind + i])];
+            if (err != NULL)
+                puts(err);
+            free(err);
+        }
+        free(errs);
+        free(paths);
+        return r;
+    }
+
+    for (int i = optind; i < argc; i++) {
+        status = mkdir(argv[i], mode);
+        if (status == -1)
+        {
+            if (errno == EEXIST) {
+                printf("Error: directory %s already exists\n",argv[i]);
+            }
+            else {
+                printf("Error: cannot create directory %s: %s\n", argv[i], strerror(errno));
+            }
+            r = 1;
+        }
+    }
+    return r;
+}
@@ -0,0 +1,70 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "pv.h"
+
+/*
+  Pass the input through to stdout, reporting throughput on stderr:
+  pv [-i SECONDS] [-l] [-q] [-s SIZE[K|M|G|T]] [-N NAME] [FILE]...
+
+  The options are parsed by the lib rather than getopt_long() because the
+  shell parses the same options when it runs pv in-process, between two
+  stages of a pipeline
+*/
+int main(int argc, char **argv)
+{
+	struct pvOptions opts;
+	int first = pvParseArgs(&opts, argc, argv);
+	if (first == -1)
+		return 1;
+
+	char *dash[] = { "-" };
+	char **paths = argv + first;
+	int num = argc - first;
+	if (num == 0) {
+		paths = dash;
+		num = 1;
+	}
+	/* Regular files tell the ETA how much there is to go */
+	if (opts.size == 0) {
+		for (int i = 0; i < num; ++i) {
+			struct stat st;
+			bool isStdin = strcmp(paths[i], "-") == 0;
+			if ((isStdin ? fstat(STDIN_FILENO, &st) : stat(paths[i], &st)) == -1 || !S_ISREG(st.st_mode)) {
+				opts.size = 0;
+				break;
+			}
+			opts.size += st.st_size;
+		}
+	}
+
+	/* A reader that goes away ends the copy with EPIPE, handled like in the shell */
+	signal(SIGPIPE, SIG_IGN);
+	struct pvMeter meter;
+	pvStart(&meter, &opts);
+	bool failed = false;
+	for (int i = 0; i < num; ++i) {
+		bool isStdin = strcmp(paths[i], "-") == 0;
+		int fd = isStdin ? STDIN_FILENO : open(paths[i], O_RDONLY | O_CLOEXEC);
+		if (fd == -1) {
+			fprintf(stderr, "pv: %s: %s\n", paths[i], strerror(errno));
+			failed = true;
+			continue;
+		}
+		int err = pvCopy(&meter, fd, STDOUT_FILENO);
+		if (!isStdin)
+			close(fd);
+		failed |= pvFailed(paths[i], err);
+		if (err == EPIPE) /* Nobody reads the output any more */
+			break;
+	}
+	pvFinish(&meter);
+	return failed ? 1 : 0;
+}
@@ -1,20 +1,541 @@
+#define _GNU_SOURCE
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <dirent.h>
+#include <limits.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include "workpool.h"
+
+#define DENTS_BUF (1 << 20) /* Bytes of directory entries fetched per getdents64 call */
+#define TREE_THREADS 8 /* Default workers for -r, deleting is mostly waiting on metadata I/O */
+#define MAX_THREADS 64
+#define TRASH_NAME ".soytrash" /* Directory --defer moves things into, next to them */
+#define MAX_TRASH 64 /* Trash directories one --defer run can use, more are removed in the foreground */
+#define REAP_THREADS 2 /* The reaper runs at idle I/O priority, more workers wouldn't get more done */
+/* From linux/ioprio.h */
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_CLASS_SHIFT 13
+
+/* Record layout returned by getdents64 */
+struct linuxDirent64 {
+    unsigned long long d_ino;
+    long long d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+/*
+  A directory being deleted. It's removed from its parent once its own
+  entries are gone and every subdirectory has been removed, which is when
+  pending drops to zero. Its fd stays open until then so the children can be
+  opened and unlinked relative to it
+*/
+struct rmNode {
+    char *path; /* For error messages */
+    const char *name; /* Last component of path, relative to the parent's fd */
+    int fd;
+    struct rmNode *parent;
+    atomic_uint pending; /* Own scan plus subdirectories not removed yet */
+    atomic_bool keep; /* Something below couldn't be deleted, so this can't be either */
+    bool rescanned; /* Already listed a second time after rmdir found it not empty */
+};
+
+static struct rmNode topNode = { .fd = AT_FDCWD }; /* Parent of the command line arguments */
+static atomic_bool failed;
+static bool force; /* -f: ignore missing operands and don't report them */
+
+static void reportError(const char *path, int err)
+{
+    if (force && err == ENOENT)
+        return;
+    printf("rm: cannot remove %s: %s\n", path, strerror(err));
+    atomic_store(&failed, true);
+}
+
+/*
+  Drop one reference to n, removing it and walking up to any parent that's now
+  empty too. Unlinking while getdents64 reads the same directory can make it
+  skip entries, so a directory that turns out not to be empty is queued to be
+  scanned once more before that's reported
+*/
+static void finish(struct workpool *pool, struct rmNode *n)
+{
+    while (n != &topNode && atomic_fetch_sub(&n->pending, 1) == 1) {
+        struct rmNode *p = n->parent;
+        if (n->fd != -1)
+            close(n->fd);
+        n->fd = -1;
+        if (atomic_load(&n->keep))
+            atomic_store(&p->keep, true);
+        else if (unlinkat(p->fd, n->name, AT_REMOVEDIR) == -1) {
+            if (errno == ENOTEMPTY && !n->rescanned) {
+                n->rescanned = true;
+                atomic_store(&n->pending, 1);
+                wpPush(pool, n);
+                return;
+            }
+            reportError(n->path, errno);
+            atomic_store(&p->keep, true);
+        }
+        free(n->path);
+        free(n);
+        n = p;
+    }
+}
+
+static struct rmNode* newNode(struct rmNode *parent, const char *name)
+{
+    struct rmNode *c = calloc(1, sizeof(struct rmNode));
+    if (parent == &topNode)
+        c->path = strdup(name);
+    else {
+        c->path = malloc(strlen(parent->path) + strlen(name) + 2);
+        sprintf(c->path, "%s/%s", parent->path, name);
+    }
+    c->name = c->path + strlen(c->path) - strlen(name);
+    c->parent = parent;
+    c->fd = -1;
+    atomic_init(&c->pending, 1);
+    return c;
+}
+
+/*
+  Pool callback: unlink everything in one directory that isn't a directory,
+  and queue a task for each subdirectory. Entries are unlinked batch by batch
+  as getdents64 returns them, so the listing is never held in memory
+*/
+static void rmTask(struct workpool *pool, void *task, void *arg)
+{
+    struct rmNode *n = task;
+    char *buf = ((char**) arg)[wpWorker(pool)];
+    n->fd = openat(n->parent->fd, n->name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (n->fd == -1) {
+        reportError(n->path, errno);
+        atomic_store(&n->keep, true);
+        finish(pool, n);
+        return;
+    }
+    while (1) {
+        long len = syscall(SYS_getdents64, n->fd, buf, DENTS_BUF);
+        if (len == -1) {
+            if (errno == EINTR)
+                continue;
+            reportError(n->path, errno);
+            atomic_store(&n->keep, true);
+            break;
+        }
+        if (len == 0)
+            break;
+        for (long pos = 0; pos < len; ) {
+            struct linuxDirent64 *d = (struct linuxDirent64*) (buf + pos);
+            pos += d->d_reclen;
+            const char *name = d->d_name;
+            if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+                continue;
+            unsigned char type = d->d_type;
+            struct stat st;
+            if (type == DT_UNKNOWN && fstatat(n->fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+                type = IFTODT(st.st_mode);
+            if (type == DT_DIR) {
+                atomic_fetch_add(&n->pending, 1);
+                wpPush(pool, newNode(n, name));
+            }
+            else if (unlinkat(n->fd, name, 0) == -1) {
+                char path[strlen(n->path) + strlen(name) + 2];
+                sprintf(path, "%s/%s", n->path, name);
+                reportError(path, errno);
+                atomic_store(&n->keep, true);
+            }
+        }
+    }
+    finish(pool, n);
+}
+
+/* Remove each argument, descending into directories with a pool of workers */
+static void removeTrees(char **paths, int num, unsigned int threads)
+{
+    /* One getdents64 buffer per worker, indexed by wpWorker() */
+    char **bufs = malloc(threads * sizeof(char*));
+    for (unsigned int i = 0; i < threads; ++i)
+        bufs[i] = malloc(DENTS_BUF);
+    struct workpool *pool = wpCreate(threads, rmTask, bufs);
+    for (int i = 0; i < num; ++i) {
+        struct stat st;
+        if (lstat(paths[i], &st) == -1) {
+            reportError(paths[i], errno);
+            continue;
+        }
+        if (!S_ISDIR(st.st_mode)) {
+            if (unlink(paths[i]) == -1)
+                reportError(paths[i], errno);
+            continue;
+        }
+        wpPush(pool, newNode(&topNode, paths[i]));
+    }
+    wpRun(pool);
+    wpDestroy(pool);
+    for (unsigned int i = 0; i < threads; ++i)
+        free(bufs[i]);
+    free(bufs);
+}
+
+/*
+  A trash directory for --defer, TRASH_NAME inside dir. fd is -1 if it couldn't
+  be used, so every path under the same directory doesn't retry it
+*/
+struct trash {
+    char *dir;
+    int fd;
+    int err; /* Why fd is -1 */
+    bool used; /* Something was moved in, so the reaper has to empty it */
+};
+
+static struct trash trashes[MAX_TRASH];
+static int numTrashes;
+
+/* Create and open t's directory. It has to be ours and closed to everyone else */
+static void openTrash(struct trash *t)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", strcmp(t->dir, "/") == 0 ? "" : t->dir, TRASH_NAME);
+    mkdir(path, 0700);
+    t->fd = open(path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    t->err = errno;
+    struct stat st;
+    if (t->fd != -1 && (fstat(t->fd, &st) == -1 || st.st_uid != geteuid() || (st.st_mode & 077) != 0)) {
+        close(t->fd);
+        t->fd = -1;
+        t->err = EPERM;
+    }
+}
+
+/* The trash directory inside dir, or NULL when this run has used up its trash directories */
+static struct trash* getTrash(const char *dir)
+{
+    for (int i = 0; i < numTrashes; ++i)
+        if (strcmp(trashes[i].dir, dir) == 0)
+            return &trashes[i];
+    if (numTrashes == MAX_TRASH)
+        return NULL;
+    struct trash *t = &trashes[numTrashes++];
+    t->dir = strdup(dir);
+    t->used = false;
+    openTrash(t);
+    return t;
+}
+
+/*
+  rm --defer: atomically move path into a trash directory and leave the
+  actual deletion to the reaper. The trash goes in the path's own directory,
+  which is on the same filesystem and already writable to whoever may remove
+  the path, and doesn't put anything anywhere else. The reaper removes the
+  trash once it's empty
+*/
+static void deferRemove(const char *path)
+{
+    static unsigned int serial = 0;
+    struct stat st;
+    if (lstat(path, &st) == -1) {
+        reportError(path, errno);
+        return;
+    }
+    char tmp[strlen(path) + 1];
+    strcpy(tmp, path);
+    char *dir = realpath(dirname(tmp), NULL);
+    if (dir == NULL) {
+        reportError(path, errno);
+        return;
+    }
+    struct trash *t = getTrash(dir);
+    free(dir);
+    if (t == NULL) { /* Spread over too many directories, remove the rest here */
+        char *paths[] = { (char*) path };
+        removeTrees(paths, 1, TREE_THREADS);
+        return;
+    }
+    int err = t->err;
+    bool moved = false;
+    /* Names only have to be unique within the trash, retry on the rare clash */
+    for (int tries = 0; tries < 8 && t->fd != -1; ++tries) {
+        char name[64];
+        snprintf(name, sizeof(name), "%ld.%d.%u", (long) time(NULL), getpid(), serial++);
+        if (renameat2(AT_FDCWD, path, t->fd, name, RENAME_NOREPLACE) == 0) {
+            t->used = moved = true;
+            break;
+        }
+        err = errno;
+        if (err == ENOENT && lstat(path, &st) == 0) { /* Another reaper just removed the emptied trash */
+            close(t->fd);
+            openTrash(t);
+            err = t->err;
+        }
+        else if (err != EEXIST)
+            break;
+    }
+    if (!moved)
+        reportError(path, err);
+}
+
+/* Names in the directory at fd, not counting . and .. */
+static char** listNames(int fd, size_t *num)
+{
+    char **names = NULL;
+    size_t max = 0;
+    *num = 0;
+    int dup = openat(fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *d = dup == -1 ? NULL : fdopendir(dup);
+    if (d == NULL)
+        return NULL;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0)
+            continue;
+        if (*num == max) {
+            max = max ? 2 * max : 64;
+            names = realloc(names, max * sizeof(char*));
+        }
+        names[(*num)++] = strdup(e->d_name);
+    }
+    closedir(d);
+    return names;
+}
+
+/* Drop to idle I/O priority and the lowest CPU priority, for the reaper */
+static void lowerPriority(void)
+{
+    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+    setpriority(PRIO_PROCESS, 0, 19);
+}
+
+/* Whether name is one of names */
+static bool hasName(char **names, size_t num, const char *name)
+{
+    for (size_t i = 0; i < num; ++i)
+        if (strcmp(names[i], name) == 0)
+            return true;
+    return false;
+}
+
+/*
+  Empty a trash directory, for as long as things keep arriving in it. Only one
+  reaper works on a trash at a time: the others find it locked and leave. The
+  holder looks again after unlocking, so whatever was moved in while it worked
+  isn't left behind. Entries still there after a pass are skipped from then on,
+  since trying again won't remove them. Returns false if any were left
+*/
+static bool reap(int fd)
+{
+    force = true; /* Another reaper may get to an entry first */
+    char **stuck = NULL;
+    size_t numStuck = 0;
+    while (1) {
+        size_t num, keep = 0;
+        char **names = listNames(fd, &num);
+        for (size_t i = 0; i < num; ++i) {
+            if (hasName(stuck, numStuck, names[i]))
+                free(names[i]);
+            else
+                names[keep++] = names[i];
+        }
+        num = keep;
+        bool locked = num > 0 && flock(fd, LOCK_EX | LOCK_NB) == 0;
+        if (locked) {
+            if (fchdir(fd) == 0)
+                removeTrees(names, num, REAP_THREADS);
+            for (size_t i = 0; i < num; ++i) {
+                struct stat st;
+                if (fstatat(fd, names[i], &st, AT_SYMLINK_NOFOLLOW) == 0) {
+                    stuck = realloc(stuck, (numStuck + 1) * sizeof(char*));
+                    stuck[numStuck++] = names[i];
+                    names[i] = NULL;
+                }
+            }
+            flock(fd, LOCK_UN);
+        }
+        for (size_t i = 0; i < num; ++i)
+            free(names[i]);
+        free(names);
+        if (!locked)
+            break;
+    }
+    for (size_t i = 0; i < numStuck; ++i)
+        free(stuck[i]);
+    free(stuck);
+    return numStuck == 0;
+}
+
+/*
+  Start the reaper for every trash --defer moved something into. It's detached
+  (double fork, new session, no stdio) so rm returns at once and nothing waits
+  on it
+*/
+static void startReaper(void)
+{
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid != 0) {
+        if (pid > 0)
+            waitpid(pid, NULL, 0);
+        return;
+    }
+    if (fork() != 0)
+        _exit(0);
+    setsid();
+    int null = open("/dev/null", O_RDWR);
+    if (null != -1) {
+        dup2(null, STDIN_FILENO);
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+    }
+    lowerPriority();
+    for (int i = 0; i < numTrashes; ++i) {
+        if (trashes[i].used && reap(trashes[i].fd)) {
+            /* Fails harmlessly if more arrived meanwhile, their rm started a reaper of its own */
+            int dir = open(trashes[i].dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (dir != -1) {
+                unlinkat(dir, TRASH_NAME, AT_REMOVEDIR);
+                close(dir);
+            }
+        }
+    }
+    _exit(0);
+}
+
+/* Whether the last component of path is . or .., which rm -r refuses to remove */
+static bool isDotOrDotDot(const char *path)
+{
+    char tmp[strlen(path) + 1];
+    strcpy(tmp, path);
+    const char *base = basename(tmp);
+    return strcmp(base, ".") == 0 || strcmp(base, "..") == 0;
+}
 
 int main (int argc, char **argv)
 {
-    if (argc != 2) {
+    bool recursive = false;
+    bool defer = false;
+    const char *reapDir = NULL;
+    unsigned int threads = TREE_THREADS;
+    static struct option longOpts[] = {
+        { "recursive", no_argument, NULL, 'r' },
+        { "force", no_argument, NULL, 'f' },
+        { "jobs", required_argument, NULL, 'j' },
+        { "defer", no_argument, NULL, 'D' },
+        { "reap", required_argument, NULL, 'P' },
+        { NULL, 0, NULL, 0 }
+    };
+    int c;
+    while ((c = getopt_long(argc, argv, "rRfj:", longOpts, NULL)) != -1) {
+        switch (c) {
+        case 'r':
+        case 'R':
+            recursive = true;
+            break;
+        case 'f':
+            force = true;
+            break;
+        case 'D':
+            defer = true;
+            break;
+        case 'P':
+            reapDir = optarg;
+            break;
+        case 'j':
+            threads = atoi(optarg);
+            if (threads < 1 || threads > MAX_THREADS) {
+                puts("rm: invalid number of threads");
+                return 1;
+            }
+            break;
+        default:
+            return 1;
+        }
+    }
+    if (reapDir != NULL) { /* Empty a trash directory in the foreground, e.g. from cron */
+        int fd = open(reapDir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd == -1) {
+            printf("rm: cannot open %s: %s\n", reapDir, strerror(errno));
+            return 1;
+        }
+        lowerPriority();
+        bool emptied = reap(fd);
+        close(fd);
+        return emptied ? 0 : 1;
+    }
+    if (optind >= argc) {
+        if (force)
+            return 0;
         puts("No directory given");
         return 1;
     }
-    int r = rmdir(argv[1]);
-    if (r == -1) {
-        int r = remove(argv[1]);
+
+    if (defer) {
+        for (int i = optind; i < argc; i++) {
+            if (isDotOrDotDot(argv[i])) {
+                printf("rm: refusing to remove '.' or '..' directory: %s\n", argv[i]);
+                atomic_store(&failed, true);
+                continue;
+            }
+            deferRemove(argv[i]);
+        }
+        for (int i = 0; i < numTrashes; ++i) {
+            if (trashes[i].used) {
+                startReaper();
+                break;
+            }
+        }
+        return atomic_load(&failed) ? 1 : 0;
+    }
+
+    if (recursive) {
+        /* Every directory on the way down holds an fd until it's removed */
+        struct rlimit rl;
+        if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+            rl.rlim_cur = rl.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &rl);
+        }
+        char **paths = malloc((argc - optind) * sizeof(char*));
+        int num = 0;
+        for (int i = optind; i < argc; i++) {
+            if (isDotOrDotDot(argv[i])) {
+                printf("rm: refusing to remove '.' or '..' directory: %s\n", argv[i]);
+                atomic_store(&failed, true);
+                continue;
+            }
+            paths[num++] = argv[i];
+        }
+        removeTrees(paths, num, threads);
+        free(paths);
+        return atomic_load(&failed) ? 1 : 0;
+    }
+
+    int ret = 0;
+    for (int i = optind; i < argc; i++) {
+        int r = rmdir(argv[i]);
         if (r == -1) {
-            printf("%s could not be removed: either not empty or nonexistent\n", argv[1]);
-            return 1;
+            int r = remove(argv[i]);
+            if (r == -1) {
+                if (force && errno == ENOENT)
+                    continue;
+                printf("%s could not be removed: either not empty or nonexistent\n", argv[i]);
+                ret = 1;
+            }
         }
     }
-    return 0;
+    return ret;
 }
@@ -0,0 +1,735 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include "soyio.h"
+
+#define DEFAULT_MEMORY (256 << 20) /* Memory budget without -S */
+#define MIN_CHUNK (4 << 10) /* Smallest amount of text a worker sorts at once */
+#define RUN_BUF (1 << 20) /* Read buffer per run while merging, and output buffer size */
+#define MIN_RUN_BUF (64 << 10)
+#define MAX_MERGE 128 /* Runs merged at once, more take several passes */
+#define MAX_THREADS 64
+#define DEFAULT_THREADS 8 /* Upper bound on the default number of workers */
+#define INSERTION_MAX 16 /* Partitions this small are finished with insertion sort */
+
+struct sortOpts {
+	bool numeric;
+	bool reverse;
+	int sep; /* Field separator, -1 for blank to non-blank transitions */
+	size_t keyStart, keyEnd; /* 1-based fields of the key, 0 when there's no -k (the whole line) or it runs to the end */
+	size_t memory; /* Budget for all the workers' text and line records */
+	const char *tmpDir;
+	const char *output;
+	unsigned int threads;
+};
+
+static struct sortOpts opts;
+
+/*
+  A line being sorted: a view into a text buffer, never a copy, with its key
+  located (or parsed, for -n) once up front so comparisons don't redo it
+*/
+struct sortLine {
+	const char *line;
+	size_t len;
+	union {
+		struct {
+			const char *key;
+			size_t keyLen;
+		};
+		long double num;
+	};
+};
+
+/* Start of field f (1-based) of s[0, len), or s + len if there aren't that many */
+static const char* fieldStart(const char *s, size_t len, size_t f)
+{
+	const char *p = s, *end = s + len;
+	for (size_t i = 1; i < f && p < end; ++i) {
+		if (opts.sep != -1) {
+			p = memchr(p, opts.sep, end - p);
+			p = p == NULL ? end : p + 1;
+		}
+		else { /* A field is its leading blanks and the non-blanks after them */
+			while (p < end && isblank((unsigned char) *p))
+				++p;
+			while (p < end && !isblank((unsigned char) *p))
+				++p;
+		}
+	}
+	return p;
+}
+
+/* End of field f (1-based) of s[0, len) */
+static const char* fieldEnd(const char *s, size_t len, size_t f)
+{
+	const char *p = fieldStart(s, len, f), *end = s + len;
+	if (opts.sep != -1) {
+		const char *q = memchr(p, opts.sep, end - p);
+		return q == NULL ? end : q;
+	}
+	while (p < end && isblank((unsigned char) *p))
+		++p;
+	while (p < end && !isblank((unsigned char) *p))
+		++p;
+	return p;
+}
+
+/* Leading number of s[0, len) after blanks, 0 if there's none */
+static long double parseNumber(const char *s, size_t len)
+{
+	const char *p = s, *end = s + len;
+	while (p < end && isblank((unsigned char) *p))
+		++p;
+	bool negative = p < end && *p == '-';
+	if (negative)
+		++p;
+	long double v = 0;
+	for (; p < end && isdigit((unsigned char) *p); ++p)
+		v = v * 10 + (*p - '0');
+	if (p < end && *p == '.') {
+		long double scale = 1;
+		for (++p; p < end && isdigit((unsigned char) *p); ++p) {
+			scale /= 10;
+			v += (*p - '0') * scale;
+		}
+	}
+	return negative ? -v : v;
+}
+
+static void makeLine(struct sortLine *l, const char *s, size_t len)
+{
+	l->line = s;
+	l->len = len;
+	const char *key = s, *end = s + len;
+	if (opts.keyStart > 0) {
+		key = fieldStart(s, len, opts.keyStart);
+		if (opts.keyEnd > 0)
+			end = fieldEnd(s, len, opts.keyEnd);
+		if (end < key)
+			end = key;
+	}
+	if (opts.numeric)
+		l->num = parseNumber(key, end - key);
+	else {
+		l->key = key;
+		l->keyLen = end - key;
+	}
+}
+
+static inline int compareBytes(const char *a, size_t aLen, const char *b, size_t bLen)
+{
+	int c = memcmp(a, b, aLen < bLen ? aLen : bLen);
+	return c != 0 ? c : (aLen > bLen) - (aLen < bLen);
+}
+
+/* Key order, then byte order of the whole line as the last resort */
+static int compareLines(const struct sortLine *a, const struct sortLine *b)
+{
+	int c;
+	if (opts.numeric)
+		c = (a->num > b->num) - (a->num < b->num);
+	else
+		c = compareBytes(a->key, a->keyLen, b->key, b->keyLen);
+	return c != 0 ? c : compareBytes(a->line, a->len, b->line, b->len);
+}
+
+static int compareQsort(const void *a, const void *b)
+{ return compareLines(a, b); }
+
+static inline int keyByte(const struct sortLine *l, size_t depth)
+{ return depth < l->keyLen ? (unsigned char) l->key[depth] : -1; }
+
+static inline void swapLines(struct sortLine *a, struct sortLine *b)
+{
+	struct sortLine t = *a;
+	*a = *b;
+	*b = t;
+}
+
+/*
+  Multikey quicksort (Bentley and Sedgewick) on the keys, whose first depth
+  bytes are known to be equal: a three-way partition on one byte, then the
+  middle part moves on to the next byte. Each key byte is looked at about
+  once per level instead of once per comparison, as in a radix sort, but
+  without the 256 buckets per level
+*/
+static void multikeySort(struct sortLine *a, size_t n, size_t depth)
+{
+	while (n > INSERTION_MAX) {
+		/* Median of three bytes as the pivot */
+		int x = keyByte(&a[0], depth), y = keyByte(&a[n / 2], depth), z = keyByte(&a[n - 1], depth);
+		size_t m = (x < y) ? (y < z ? n / 2 : x < z ? n - 1 : 0) : (x < z ? 0 : y < z ? n - 1 : n / 2);
+		swapLines(&a[0], &a[m]);
+		int v = keyByte(&a[0], depth);
+		size_t lt = 0, i = 1, gt = n;
+		while (i < gt) {
+			int c = keyByte(&a[i], depth);
+			if (c < v)
+				swapLines(&a[lt++], &a[i++]);
+			else if (c > v)
+				swapLines(&a[i], &a[--gt]);
+			else
+				++i;
+		}
+		multikeySort(a, lt, depth);
+		multikeySort(a + gt, n - gt, depth);
+		if (v == -1) { /* Whole keys are equal, only the lines can tell them apart */
+			qsort(a + lt, gt - lt, sizeof(struct sortLine), compareQsort);
+			return;
+		}
+		a += lt;
+		n = gt - lt;
+		++depth;
+	}
+	for (size_t i = 1; i < n; ++i) {
+		struct sortLine l = a[i];
+		size_t j = i;
+		while (j > 0 && compareLines(&a[j - 1], &l) > 0) {
+			a[j] = a[j - 1];
+			--j;
+		}
+		a[j] = l;
+	}
+}
+
+static void sortLines(struct sortLine *lines, size_t n)
+{
+	if (opts.numeric)
+		qsort(lines, n, sizeof(struct sortLine), compareQsort);
+	else
+		multikeySort(lines, n, 0);
+	if (opts.reverse)
+		for (size_t i = 0, j = n; i + 1 < j; ++i, --j)
+			swapLines(&lines[i], &lines[j - 1]);
+}
+
+/* A sorted run: a range of a temporary file, lines ending with newlines */
+struct run {
+	int fd;
+	off_t off;
+	off_t len;
+};
+
+/* Inputs read one after the other by whichever worker needs more text */
+struct input {
+	pthread_mutex_t lock;
+	char **paths;
+	size_t num;
+	size_t next; /* Next path to open */
+	int fd; /* Being read, -1 between files */
+	bool lastNewline; /* Whether the last byte read from fd was a newline */
+	char *carry; /* Partial line left over from the last chunk */
+	size_t carryLen, carryCap;
+	size_t chunks; /* Chunks handed out so far */
+	bool eof;
+};
+
+static struct input in = { .lock = PTHREAD_MUTEX_INITIALIZER, .fd = -1, .lastNewline = true };
+
+/* Runs written so far and the temporary files holding them */
+static pthread_mutex_t runLock = PTHREAD_MUTEX_INITIALIZER;
+static struct run *runs;
+static size_t numRuns, maxRuns;
+static int *tmpFds;
+static size_t numTmp, maxTmp;
+
+/* The whole input when it fit in one chunk, sorted and never spilled */
+static struct sortLine *single;
+static size_t numSingle;
+static bool haveSingle;
+
+static bool failed;
+
+static void fail(const char *path, int err)
+{
+	pthread_mutex_lock(&runLock);
+	failed = true;
+	fprintf(stderr, "sort: %s: %s\n", path, strerror(err));
+	pthread_mutex_unlock(&runLock);
+}
+
+/*
+  Append up to cap - *len bytes of input to buf. Files are glued together with
+  a newline after a last line that lacks one. Called with in.lock held.
+  Returns false once every input has been read
+*/
+static bool readMore(char *buf, size_t cap, size_t *len)
+{
+	while (*len < cap) {
+		if (in.fd == -1) {
+			if (in.next == in.num)
+				return false;
+			const char *path = in.paths[in.next];
+			in.fd = strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY | O_CLOEXEC);
+			if (in.fd == -1) {
+				fail(path, errno);
+				++in.next;
+				continue;
+			}
+			posix_fadvise(in.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+			in.lastNewline = true;
+		}
+		ssize_t n = read(in.fd, buf + *len, cap - *len);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n > 0) {
+			*len += n;
+			in.lastNewline = buf[*len - 1] == '\n';
+			continue;
+		}
+		if (n == -1)
+			fail(in.paths[in.next], errno);
+		if (in.fd != STDIN_FILENO)
+			close(in.fd);
+		in.fd = -1;
+		++in.next;
+		if (!in.lastNewline) {
+			buf[(*len)++] = '\n'; /* The caller always leaves a byte for this */
+			in.lastNewline = true;
+		}
+	}
+	return true;
+}
+
+/*
+  Fill *buf with the next chunk of whole lines, at least about cap bytes
+  unless the input runs out, growing it for lines longer than that.
+  Returns the chunk's length, 0 at the end; *index is the chunk's number and
+  *last whether no input is left after it
+*/
+static size_t nextChunk(char **buf, size_t *cap, size_t *index, bool *last)
+{
+	pthread_mutex_lock(&in.lock);
+	size_t len = in.carryLen;
+	if (len > *cap - 1) {
+		*cap = len * 2;
+		*buf = realloc(*buf, *cap);
+	}
+	memcpy(*buf, in.carry, len);
+	in.carryLen = 0;
+	char *nl = NULL;
+	while (!in.eof) {
+		if (!readMore(*buf, *cap - 1, &len))
+			in.eof = true;
+		else if ((nl = memrchr(*buf, '\n', len)) == NULL) { /* Not even one whole line yet */
+			*cap *= 2;
+			*buf = realloc(*buf, *cap);
+			continue;
+		}
+		break;
+	}
+	if (!in.eof) { /* Hold the partial line back for the next chunk */
+		size_t whole = nl - *buf + 1;
+		in.carryLen = len - whole;
+		if (in.carryLen > in.carryCap) {
+			in.carryCap = in.carryLen * 2;
+			in.carry = realloc(in.carry, in.carryCap);
+		}
+		memcpy(in.carry, *buf + whole, in.carryLen);
+		len = whole;
+	}
+	*index = in.chunks;
+	if (len > 0)
+		++in.chunks;
+	*last = in.eof;
+	pthread_mutex_unlock(&in.lock);
+	return len;
+}
+
+/* Create an unlinked temporary file in the temporary directory. Returns its fd, or -1 */
+static int tempFile(void)
+{
+	char *path;
+	if (asprintf(&path, "%s/soysort.XXXXXX", opts.tmpDir) == -1)
+		return -1;
+	int fd = mkstemp(path);
+	if (fd == -1)
+		fail(opts.tmpDir, errno);
+	else {
+		unlink(path);
+		pthread_mutex_lock(&runLock);
+		if (numTmp == maxTmp) {
+			maxTmp = maxTmp > 0 ? 2 * maxTmp : 16;
+			tmpFds = realloc(tmpFds, maxTmp * sizeof(int));
+		}
+		tmpFds[numTmp++] = fd;
+		pthread_mutex_unlock(&runLock);
+	}
+	free(path);
+	return fd;
+}
+
+static void addRun(int fd, off_t off, off_t len)
+{
+	pthread_mutex_lock(&runLock);
+	if (numRuns == maxRuns) {
+		maxRuns = maxRuns > 0 ? 2 * maxRuns : 64;
+		runs = realloc(runs, maxRuns * sizeof(struct run));
+	}
+	runs[numRuns++] = (struct run) { fd, off, len };
+	pthread_mutex_unlock(&runLock);
+}
+
+/* Write sorted lines to w, each with its newline */
+static void writeLines(struct soyWriter *w, const struct sortLine *lines, size_t n)
+{
+	for (size_t i = 0; i < n; ++i) {
+		swWrite(w, lines[i].line, lines[i].len);
+		swWrite(w, "\n", 1);
+	}
+}
+
+/* Run generation: read a chunk, sort it and spill it to this worker's temporary file, until the input is gone */
+static void* sortWorker(void *arg)
+{
+	size_t cap = *(size_t*) arg;
+	char *buf = malloc(cap);
+	struct sortLine *lines = NULL;
+	size_t maxLines = 0;
+	int fd = -1;
+	off_t end = 0;
+	struct soyWriter w = { .fd = -1 };
+	while (1) {
+		size_t index;
+		bool last;
+		size_t len = nextChunk(&buf, &cap, &index, &last);
+		if (len == 0)
+			break;
+		size_t n = 0;
+		for (const char *p = buf, *nl; p < buf + len; p = nl + 1) {
+			nl = memchr(p, '\n', buf + len - p);
+			if (n == maxLines) {
+				maxLines = maxLines > 0 ? 2 * maxLines : len / 32 + 16;
+				lines = realloc(lines, maxLines * sizeof(struct sortLine));
+			}
+			makeLine(&lines[n++], p, nl - p);
+		}
+		sortLines(lines, n);
+		if (index == 0 && last) { /* Everything fit at once, main writes it straight out */
+			single = lines;
+			numSingle = n;
+			haveSingle = true;
+			return buf;
+		}
+		if (fd == -1) {
+			if ((fd = tempFile()) == -1)
+				break;
+			swInit(&w, fd, RUN_BUF);
+		}
+		writeLines(&w, lines, n);
+		if (swFlush(&w) == -1) {
+			fail(opts.tmpDir, errno);
+			break;
+		}
+		off_t pos = lseek(fd, 0, SEEK_CUR);
+		addRun(fd, end, pos - end);
+		end = pos;
+	}
+	swFree(&w);
+	free(lines);
+	free(buf);
+	return NULL;
+}
+
+/* One run being merged and its current line */
+struct runReader {
+	struct run r;
+	char *buf;
+	size_t cap, start, end;
+	struct sortLine cur;
+};
+
+/* Move to the next line of the run. Returns false when it's exhausted */
+static bool runNext(struct runReader *rr)
+{
+	while (1) {
+		char *nl = memchr(rr->buf + rr->start, '\n', rr->end - rr->start);
+		if (nl != NULL) {
+			makeLine(&rr->cur, rr->buf + rr->start, nl - (rr->buf + rr->start));
+			rr->start = nl - rr->buf + 1;
+			return true;
+		}
+		if (rr->r.len == 0)
+			return false;
+		/* Keep the partial line, growing the buffer for one longer than it */
+		size_t have = rr->end - rr->start;
+		memmove(rr->buf, rr->buf + rr->start, have);
+		rr->start = 0;
+		rr->end = have;
+		if (have == rr->cap) {
+			rr->cap *= 2;
+			rr->buf = realloc(rr->buf, rr->cap);
+		}
+		size_t want = rr->cap - have < (size_t) rr->r.len ? rr->cap - have : (size_t) rr->r.len;
+		ssize_t n = pread(rr->r.fd, rr->buf + have, want, rr->r.off);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			fail(opts.tmpDir, n == 0 ? EIO : errno);
+			return false;
+		}
+		rr->end += n;
+		rr->r.off += n;
+		rr->r.len -= n;
+	}
+}
+
+static inline bool heapLess(struct runReader *a, struct runReader *b)
+{
+	int c = compareLines(&a->cur, &b->cur);
+	return opts.reverse ? c > 0 : c < 0;
+}
+
+static void siftDown(struct runReader **heap, size_t n, size_t i)
+{
+	while (1) {
+		size_t least = i, l = 2 * i + 1, r = l + 1;
+		if (l < n && heapLess(heap[l], heap[least]))
+			least = l;
+		if (r < n && heapLess(heap[r], heap[least]))
+			least = r;
+		if (least == i)
+			return;
+		struct runReader *t = heap[i];
+		heap[i] = heap[least];
+		heap[least] = t;
+		i = least;
+	}
+}
+
+/* k-way merge of runs[0, n) into w through a heap of their current lines */
+static void mergeRuns(const struct run *rs, size_t n, struct soyWriter *w)
+{
+	size_t bufSize = opts.memory / (n + 1);
+	if (bufSize > RUN_BUF)
+		bufSize = RUN_BUF;
+	if (bufSize < MIN_RUN_BUF)
+		bufSize = MIN_RUN_BUF;
+	struct runReader *readers = calloc(n, sizeof(struct runReader));
+	struct runReader **heap = malloc(n * sizeof(struct runReader*));
+	size_t len = 0;
+	for (size_t i = 0; i < n; ++i) {
+		readers[i].r = rs[i];
+		readers[i].cap = bufSize;
+		readers[i].buf = malloc(bufSize);
+		if (runNext(&readers[i]))
+			heap[len++] = &readers[i];
+	}
+	for (size_t i = len / 2; i-- > 0; )
+		siftDown(heap, len, i);
+	while (len > 0) {
+		struct runReader *top = heap[0];
+		swWrite(w, top->cur.line, top->cur.len);
+		swWrite(w, "\n", 1);
+		if (!runNext(top))
+			heap[0] = heap[--len];
+		siftDown(heap, len, 0);
+	}
+	for (size_t i = 0; i < n; ++i)
+		free(readers[i].buf);
+	free(readers);
+	free(heap);
+}
+
+/* Merge groups of runs into longer runs until there are few enough to merge in one go */
+static void reduceRuns(void)
+{
+	while (numRuns > MAX_MERGE && !failed) {
+		int fd = tempFile();
+		if (fd == -1)
+			return;
+		struct soyWriter w;
+		swInit(&w, fd, RUN_BUF);
+		size_t kept = 0;
+		off_t end = 0;
+		for (size_t i = 0; i < numRuns; i += MAX_MERGE) {
+			size_t n = numRuns - i < MAX_MERGE ? numRuns - i : MAX_MERGE;
+			mergeRuns(runs + i, n, &w);
+			if (swFlush(&w) == -1)
+				fail(opts.tmpDir, errno);
+			off_t pos = lseek(fd, 0, SEEK_CUR);
+			runs[kept++] = (struct run) { fd, end, pos - end };
+			end = pos;
+		}
+		swFree(&w);
+		numRuns = kept;
+		/* The earlier files are merged away, give their space back */
+		for (size_t i = 0; i + 1 < numTmp; ++i)
+			close(tmpFds[i]);
+		tmpFds[0] = fd;
+		numTmp = 1;
+	}
+}
+
+/* Parse a -S size: a number of KiB, or with a K, M or G suffix */
+static size_t parseSize(const char *s)
+{
+	char *end;
+	unsigned long long v = strtoull(s, &end, 10);
+	switch (toupper((unsigned char) *end)) {
+	case 'G':
+		v <<= 10; /* Fall through */
+	case 'M':
+		v <<= 10; /* Fall through */
+	case '\0':
+	case 'K':
+		v <<= 10;
+		break;
+	case 'B':
+		break;
+	default:
+		return 0;
+	}
+	if (*end != '\0' && end[1] != '\0')
+		return 0;
+	return v;
+}
+
+/* Parse a -k FIELD[,FIELD] key. Returns false if it's invalid */
+static bool parseKey(const char *s)
+{
+	char *end;
+	unsigned long start = strtoul(s, &end, 10);
+	if (start == 0 || (*end != '\0' && *end != ','))
+		return false;
+	unsigned long stop = 0;
+	if (*end == ',') {
+		stop = strtoul(end + 1, &end, 10);
+		if (stop == 0 || *end != '\0' || stop < start)
+			return false;
+	}
+	opts.keyStart = start;
+	opts.keyEnd = stop;
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	opts.sep = -1;
+	opts.memory = DEFAULT_MEMORY;
+	static struct option longOpts[] = {
+		{ "numeric-sort", no_argument, NULL, 'n' },
+		{ "reverse", no_argument, NULL, 'r' },
+		{ "key", required_argument, NULL, 'k' },
+		{ "field-separator", required_argument, NULL, 't' },
+		{ "buffer-size", required_argument, NULL, 'S' },
+		{ "temporary-directory", required_argument, NULL, 'T' },
+		{ "output", required_argument, NULL, 'o' },
+		{ "jobs", required_argument, NULL, 'j' },
+		{ NULL, 0, NULL, 0 }
+	};
+	int c;
+	while ((c = getopt_long(argc, argv, "nrk:t:S:T:o:j:", longOpts, NULL)) != -1) {
+		switch (c) {
+		case 'n':
+			opts.numeric = true;
+			break;
+		case 'r':
+			opts.reverse = true;
+			break;
+		case 'k':
+			if (!parseKey(optarg)) {
+				fprintf(stderr, "sort: invalid key: %s\n", optarg);
+				return 2;
+			}
+			break;
+		case 't':
+			if (optarg[0] == '\0' || optarg[1] != '\0') {
+				fprintf(stderr, "sort: the separator must be a single character\n");
+				return 2;
+			}
+			opts.sep = (unsigned char) optarg[0];
+			break;
+		case 'S':
+			if ((opts.memory = parseSize(optarg)) == 0) {
+				fprintf(stderr, "sort: invalid buffer size: %s\n", optarg);
+				return 2;
+			}
+			break;
+		case 'T':
+			opts.tmpDir = optarg;
+			break;
+		case 'o':
+			opts.output = optarg;
+			break;
+		case 'j':
+			opts.threads = atoi(optarg);
+			if (opts.threads < 1 || opts.threads > MAX_THREADS) {
+				fprintf(stderr, "sort: number of threads must be between 1 and %d\n", MAX_THREADS);
+				return 2;
+			}
+			break;
+		default:
+			return 2;
+		}
+	}
+	if (opts.tmpDir == NULL)
+		opts.tmpDir = getenv("TMPDIR") != NULL ? getenv("TMPDIR") : "/tmp";
+	if (opts.threads == 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		opts.threads = cpus < 1 ? 1 : cpus > DEFAULT_THREADS ? DEFAULT_THREADS : cpus;
+	}
+
+	char *dash[] = { "-" };
+	in.paths = argv + optind;
+	in.num = argc - optind;
+	if (in.num == 0) {
+		in.paths = dash;
+		in.num = 1;
+	}
+
+	/* Each worker gets an equal share of the budget, half of it for text and the rest for line records */
+	size_t chunk = opts.memory / opts.threads / 2;
+	if (chunk < MIN_CHUNK)
+		chunk = MIN_CHUNK;
+	pthread_t tids[MAX_THREADS];
+	unsigned int started = 0;
+	while (started + 1 < opts.threads && pthread_create(&tids[started], NULL, sortWorker, &chunk) == 0)
+		++started;
+	void *singleBuf = sortWorker(&chunk);
+	for (unsigned int i = 0; i < started; ++i) {
+		void *r;
+		pthread_join(tids[i], &r);
+		if (r != NULL)
+			singleBuf = r;
+	}
+	free(in.carry);
+	if (!failed)
+		reduceRuns();
+
+	/* Only now that all the input is read can the output replace one of the inputs */
+	int out = STDOUT_FILENO;
+	if (opts.output != NULL && (out = open(opts.output, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666)) == -1) {
+		fprintf(stderr, "sort: %s: %s\n", opts.output, strerror(errno));
+		return 2;
+	}
+	struct soyWriter w;
+	swInit(&w, out, RUN_BUF);
+	if (haveSingle)
+		writeLines(&w, single, numSingle);
+	else if (!failed)
+		mergeRuns(runs, numRuns, &w);
+	if (swFlush(&w) == -1) {
+		fprintf(stderr, "sort: %s: %s\n", opts.output != NULL ? opts.output : "write error", strerror(errno));
+		failed = true;
+	}
+	swFree(&w);
+	if (out != STDOUT_FILENO)
+		close(out);
+	for (size_t i = 0; i < numTmp; ++i)
+		close(tmpFds[i]);
+	free(tmpFds);
+	free(runs);
+	free(single);
+	free(singleBuf);
+	return failed ? 2 : 0;
+}
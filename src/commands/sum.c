@@ -0,0 +1,468 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "soyio.h"
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+#define CHUNK_SIZE (4 << 20) /* Bytes per leaf of the tree. Part of the digest, don't change */
+#define OUT_BUF (64 << 10)
+#define MAX_THREADS 64
+#define DEFAULT_THREADS 8 /* Upper bound on the default number of threads */
+
+/*
+  Digest of a file: the file is cut into CHUNK_SIZE leaves that are hashed
+  independently, so any number of threads can work on one file. Pairs of
+  hashes are then hashed together level by level (an odd one out moves up
+  as is), and the root is hashed once more with the file's length
+*/
+typedef uint64_t (*hashFn)(const void *data, size_t len);
+
+/* CRC-32C (Castagnoli), the polynomial with an SSE4.2 instruction */
+static uint32_t crcTable[8][256];
+
+static void crcInit(void)
+{
+	for (uint32_t i = 0; i < 256; ++i) {
+		uint32_t c = i;
+		for (int k = 0; k < 8; ++k)
+			c = c & 1 ? (c >> 1) ^ 0x82F63B78 : c >> 1;
+		crcTable[0][i] = c;
+	}
+	for (int t = 1; t < 8; ++t)
+		for (int i = 0; i < 256; ++i)
+			crcTable[t][i] = (crcTable[t - 1][i] >> 8) ^ crcTable[0][crcTable[t - 1][i] & 0xFF];
+}
+
+/* Portable CRC-32C, slicing by 8: one table lookup per byte but eight independent ones per step */
+static uint64_t crcScalar(const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	uint32_t c = ~0U;
+	while (len >= 8) {
+		uint64_t v;
+		memcpy(&v, p, 8);
+		v ^= c;
+		c = crcTable[7][v & 0xFF] ^ crcTable[6][(v >> 8) & 0xFF] ^ crcTable[5][(v >> 16) & 0xFF] ^ crcTable[4][(v >> 24) & 0xFF]
+		    ^ crcTable[3][(v >> 32) & 0xFF] ^ crcTable[2][(v >> 40) & 0xFF] ^ crcTable[1][(v >> 48) & 0xFF] ^ crcTable[0][v >> 56];
+		p += 8;
+		len -= 8;
+	}
+	while (len-- > 0)
+		c = (c >> 8) ^ crcTable[0][(c ^ *p++) & 0xFF];
+	return ~c;
+}
+
+#ifdef __x86_64__
+/* CRC-32C with the SSE4.2 crc32 instruction, 8 bytes at a time */
+__attribute__((target("sse4.2")))
+static uint64_t crcSse42(const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	uint64_t c = ~0U;
+	while (len >= 8) {
+		uint64_t v;
+		memcpy(&v, p, 8);
+		c = _mm_crc32_u64(c, v);
+		p += 8;
+		len -= 8;
+	}
+	uint32_t c32 = c;
+	while (len-- > 0)
+		c32 = _mm_crc32_u8(c32, *p++);
+	return ~c32;
+}
+#endif
+
+/* xxHash64 with seed 0 */
+#define XXH_P1 0x9E3779B185EBCA87ULL
+#define XXH_P2 0xC2B2AE3D27D4EB4FULL
+#define XXH_P3 0x165667B19E3779F9ULL
+#define XXH_P4 0x85EBCA77C2B2AE63ULL
+#define XXH_P5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t rotl64(uint64_t v, int r)
+{ return (v << r) | (v >> (64 - r)); }
+
+static inline uint64_t xxhRound(uint64_t acc, uint64_t input)
+{ return rotl64(acc + input * XXH_P2, 31) * XXH_P1; }
+
+static inline uint64_t xxhMerge(uint64_t acc, uint64_t v)
+{ return (acc ^ xxhRound(0, v)) * XXH_P1 + XXH_P4; }
+
+static uint64_t xxh64(const void *data, size_t len)
+{
+	const unsigned char *p = data, *end = p + len;
+	uint64_t h, v;
+	if (len >= 32) {
+		uint64_t v1 = XXH_P1 + XXH_P2, v2 = XXH_P2, v3 = 0, v4 = -XXH_P1;
+		for (; p + 32 <= end; p += 32) {
+			uint64_t in[4];
+			memcpy(in, p, 32);
+			v1 = xxhRound(v1, in[0]);
+			v2 = xxhRound(v2, in[1]);
+			v3 = xxhRound(v3, in[2]);
+			v4 = xxhRound(v4, in[3]);
+		}
+		h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+		h = xxhMerge(xxhMerge(xxhMerge(xxhMerge(h, v1), v2), v3), v4);
+	}
+	else
+		h = XXH_P5;
+	h += len;
+	for (; p + 8 <= end; p += 8) {
+		memcpy(&v, p, 8);
+		h = rotl64(h ^ xxhRound(0, v), 27) * XXH_P1 + XXH_P4;
+	}
+	if (p + 4 <= end) {
+		uint32_t w;
+		memcpy(&w, p, 4);
+		h = rotl64(h ^ (w * XXH_P1), 23) * XXH_P2 + XXH_P3;
+		p += 4;
+	}
+	for (; p < end; ++p)
+		h = rotl64(h ^ (*p * XXH_P5), 11) * XXH_P1;
+	h ^= h >> 33;
+	h *= XXH_P2;
+	h ^= h >> 29;
+	h *= XXH_P3;
+	return h ^ (h >> 32);
+}
+
+static hashFn hash;
+static int digestDigits; /* Hex digits a digest is printed with */
+
+/* Hash of two values, little endian, for the inner nodes of the tree */
+static uint64_t hashPair(uint64_t a, uint64_t b)
+{
+	unsigned char buf[16];
+	for (int i = 0; i < 8; ++i) {
+		buf[i] = a >> (8 * i);
+		buf[8 + i] = b >> (8 * i);
+	}
+	return hash(buf, sizeof(buf));
+}
+
+/* One file to hash, and what it should hash to when checking */
+struct sumFile {
+	const char *path;
+	char *map; /* NULL when the file is read a chunk at a time instead */
+	size_t size;
+	uint64_t *leaves;
+	size_t numChunks;
+	atomic_size_t left; /* Chunks not hashed yet */
+	int err;
+	bool done;
+	uint64_t digest;
+	uint64_t expected; /* -c */
+};
+
+/* Shared state: threads claim one chunk of one file at a time, results are printed in order */
+static struct sumFile *files;
+static size_t numFiles;
+static pthread_mutex_t claimLock = PTHREAD_MUTEX_INITIALIZER;
+static size_t nextFile, nextChunk; /* Next chunk to hand out */
+static bool fileOpen; /* files[nextFile] has been set up */
+static pthread_mutex_t printLock = PTHREAD_MUTEX_INITIALIZER;
+static size_t printed;
+static struct soyWriter out;
+static bool checking;
+static size_t mismatches, unreadable;
+
+static void finishFile(struct sumFile *f)
+{
+	if (f->map != NULL)
+		munmap(f->map, f->size);
+	if (f->err == 0) {
+		/* Fold the leaves level by level in place */
+		size_t n = f->numChunks;
+		while (n > 1) {
+			size_t half = 0;
+			for (size_t i = 0; i + 1 < n; i += 2)
+				f->leaves[half++] = hashPair(f->leaves[i], f->leaves[i + 1]);
+			if (n % 2 == 1)
+				f->leaves[half++] = f->leaves[n - 1];
+			n = half;
+		}
+		f->digest = hashPair(f->leaves[0], f->size);
+	}
+	free(f->leaves);
+	f->leaves = NULL;
+
+	pthread_mutex_lock(&printLock);
+	f->done = true;
+	for (; printed < numFiles && files[printed].done; ++printed) {
+		struct sumFile *p = &files[printed];
+		if (p->err != 0) {
+			swFlush(&out);
+			fprintf(stderr, "sum: %s: %s\n", p->path, strerror(p->err));
+			++unreadable;
+		}
+		else if (!checking)
+			swPrintf(&out, "%0*llx  %s\n", digestDigits, (unsigned long long) p->digest, p->path);
+		else {
+			bool ok = p->digest == p->expected;
+			swPrintf(&out, "%s: %s\n", p->path, ok ? "OK" : "FAILED");
+			mismatches += !ok;
+		}
+	}
+	pthread_mutex_unlock(&printLock);
+}
+
+/*
+  Hash a file that can't be mapped (a pipe, stdin, or a failed mmap) by
+  reading it a chunk at a time. The leaves are the same as when it's mapped
+*/
+static void hashStream(struct sumFile *f, int fd)
+{
+	char *buf = malloc(CHUNK_SIZE);
+	size_t maxLeaves = 16;
+	f->leaves = malloc(maxLeaves * sizeof(uint64_t));
+	f->numChunks = 0;
+	f->size = 0;
+	while (1) {
+		size_t len = 0;
+		while (len < CHUNK_SIZE) {
+			ssize_t n = read(fd, buf + len, CHUNK_SIZE - len);
+			if (n == -1 && errno == EINTR)
+				continue;
+			if (n == -1)
+				f->err = errno;
+			if (n <= 0)
+				break;
+			len += n;
+		}
+		if (f->err != 0 || (len == 0 && f->numChunks > 0))
+			break;
+		if (f->numChunks == maxLeaves) {
+			maxLeaves *= 2;
+			f->leaves = realloc(f->leaves, maxLeaves * sizeof(uint64_t));
+		}
+		f->leaves[f->numChunks++] = hash(buf, len);
+		f->size += len;
+		if (len < CHUNK_SIZE)
+			break;
+	}
+	free(buf);
+}
+
+/*
+  Set up files[nextFile] for its chunks to be handed out, under claimLock.
+  Returns false if it was dealt with in one go instead (an error, or a file
+  that has to be read as a stream)
+*/
+static bool openFile(struct sumFile *f)
+{
+	bool isStdin = strcmp(f->path, "-") == 0;
+	int fd = isStdin ? STDIN_FILENO : open(f->path, O_RDONLY | O_CLOEXEC);
+	struct stat st;
+	if (fd == -1 || fstat(fd, &st) == -1) {
+		f->err = errno;
+		if (fd != -1 && !isStdin)
+			close(fd);
+		return false;
+	}
+	if (S_ISDIR(st.st_mode))
+		f->err = EISDIR;
+	else if (S_ISREG(st.st_mode) && st.st_size > 0) {
+		f->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (f->map == MAP_FAILED)
+			f->map = NULL;
+	}
+	if (f->map == NULL && f->err == 0) /* Streams block the other threads only until the next file is claimed */
+		hashStream(f, fd);
+	if (!isStdin)
+		close(fd);
+	if (f->map == NULL)
+		return false;
+	f->size = st.st_size;
+	f->numChunks = (f->size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	f->leaves = malloc(f->numChunks * sizeof(uint64_t));
+	atomic_init(&f->left, f->numChunks);
+	return true;
+}
+
+/* Next chunk to hash. Returns false when there's nothing left */
+static bool claim(struct sumFile **file, size_t *chunk)
+{
+	pthread_mutex_lock(&claimLock);
+	while (nextFile < numFiles) {
+		struct sumFile *f = &files[nextFile];
+		if (!fileOpen) {
+			if (!openFile(f)) {
+				++nextFile;
+				pthread_mutex_unlock(&claimLock);
+				finishFile(f);
+				pthread_mutex_lock(&claimLock);
+				continue;
+			}
+			fileOpen = true;
+			nextChunk = 0;
+		}
+		*file = f;
+		*chunk = nextChunk++;
+		if (nextChunk == f->numChunks) {
+			++nextFile;
+			fileOpen = false;
+		}
+		pthread_mutex_unlock(&claimLock);
+		return true;
+	}
+	pthread_mutex_unlock(&claimLock);
+	return false;
+}
+
+static void* sumWorker(void *arg)
+{
+	(void) arg;
+	struct sumFile *f;
+	size_t c;
+	while (claim(&f, &c)) {
+		size_t off = c * CHUNK_SIZE;
+		size_t len = f->size - off < CHUNK_SIZE ? f->size - off : CHUNK_SIZE;
+		madvise(f->map + off, len, MADV_WILLNEED);
+		f->leaves[c] = hash(f->map + off, len);
+		if (atomic_fetch_sub(&f->left, 1) == 1)
+			finishFile(f);
+	}
+	return NULL;
+}
+
+/* Read "DIGEST  PATH" lines of a -c list into files. Returns false if it can't be read */
+static bool readChecks(const char *path)
+{
+	FILE *in = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+	if (in == NULL) {
+		fprintf(stderr, "sum: %s: %s\n", path, strerror(errno));
+		return false;
+	}
+	size_t max = 0;
+	char *line = NULL;
+	size_t cap = 0;
+	ssize_t len;
+	unsigned long lineNo = 0;
+	while ((len = getline(&line, &cap, in)) != -1) {
+		++lineNo;
+		if (len > 0 && line[len - 1] == '\n')
+			line[--len] = '\0';
+		char *end;
+		unsigned long long digest = strtoull(line, &end, 16);
+		if (end - line != digestDigits || strncmp(end, "  ", 2) != 0 || end[2] == '\0') {
+			fprintf(stderr, "sum: %s: %lu: improperly formatted line\n", path, lineNo);
+			continue;
+		}
+		if (numFiles == max) {
+			max = max > 0 ? 2 * max : 64;
+			files = realloc(files, max * sizeof(struct sumFile));
+		}
+		memset(&files[numFiles], 0, sizeof(struct sumFile));
+		files[numFiles].path = strdup(end + 2);
+		files[numFiles++].expected = digest;
+	}
+	free(line);
+	if (in != stdin)
+		fclose(in);
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int threads = 0;
+	const char *algorithm = "crc32c";
+	static struct option longOpts[] = {
+		{ "algorithm", required_argument, NULL, 'a' },
+		{ "check", no_argument, NULL, 'c' },
+		{ "jobs", required_argument, NULL, 'j' },
+		{ NULL, 0, NULL, 0 }
+	};
+	int c;
+	while ((c = getopt_long(argc, argv, "a:cj:", longOpts, NULL)) != -1) {
+		switch (c) {
+		case 'a':
+			algorithm = optarg;
+			break;
+		case 'c':
+			checking = true;
+			break;
+		case 'j':
+			threads = atoi(optarg);
+			if (threads < 1 || threads > MAX_THREADS) {
+				fprintf(stderr, "sum: number of threads must be between 1 and %d\n", MAX_THREADS);
+				return 1;
+			}
+			break;
+		default:
+			return 1;
+		}
+	}
+	if (strcmp(algorithm, "crc32c") == 0) {
+		crcInit();
+		hash = crcScalar;
+		digestDigits = 8;
+#ifdef __x86_64__
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("sse4.2"))
+			hash = crcSse42;
+#endif
+	}
+	else if (strcmp(algorithm, "xxh64") == 0) {
+		hash = xxh64;
+		digestDigits = 16;
+	}
+	else {
+		fprintf(stderr, "sum: unknown algorithm %s, use crc32c or xxh64\n", algorithm);
+		return 1;
+	}
+	if (threads == 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cpus < 1 ? 1 : cpus > DEFAULT_THREADS ? DEFAULT_THREADS : cpus;
+	}
+
+	char *dash[] = { "-" };
+	char **paths = argv + optind;
+	int num = argc - optind;
+	if (num == 0) {
+		paths = dash;
+		num = 1;
+	}
+	if (checking) {
+		for (int i = 0; i < num; ++i)
+			if (!readChecks(paths[i]))
+				++unreadable;
+	}
+	else {
+		files = calloc(num, sizeof(struct sumFile));
+		for (int i = 0; i < num; ++i)
+			files[i].path = paths[i];
+		numFiles = num;
+	}
+
+	swInit(&out, STDOUT_FILENO, OUT_BUF);
+	pthread_t tids[MAX_THREADS];
+	unsigned int started = 0;
+	while (started + 1 < threads && pthread_create(&tids[started], NULL, sumWorker, NULL) == 0)
+		++started;
+	sumWorker(NULL);
+	for (unsigned int i = 0; i < started; ++i)
+		pthread_join(tids[i], NULL);
+	swFlush(&out);
+	if (checking && mismatches > 0)
+		fprintf(stderr, "sum: %zu computed checksum%s did NOT match\n", mismatches, mismatches == 1 ? "" : "s");
+	if (checking)
+		for (size_t i = 0; i < numFiles; ++i)
+			free((char*) files[i].path);
+	free(files);
+	return mismatches > 0 || unreadable > 0 ? 1 : 0;
+}
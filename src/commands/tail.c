@@ -0,0 +1,440 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#define BLOCK_SIZE (64 << 10) /* Bytes read per step, backwards when looking for the last lines */
+#define TRIM_AT (1 << 20) /* Buffered pipe input is cut down to the last lines past this size */
+#define EVENT_BUF (64 << 10)
+#define FILE_EVENTS (IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF)
+#define DIR_EVENTS (IN_CREATE | IN_MOVED_TO)
+
+/* One file being printed, and followed with -f */
+struct tailFile {
+	const char *path;
+	char *dir; /* Directory it's in, watched for it to reappear after a rotation */
+	const char *name; /* Its name in dir */
+	int fd; /* -1 when it's gone */
+	bool regular; /* Only regular files can be followed */
+	off_t pos; /* Next byte to print */
+	int wd; /* Watch on the file, -1 when it's not watched */
+	int dirWd;
+};
+
+static unsigned long long count = 10;
+static bool bytes; /* count is in bytes rather than lines */
+static bool fromStart; /* +N: print from line or byte count on, counting from 1, rather than the last count */
+static bool headers;
+static struct tailFile *shown; /* Whose data was printed last, for the headers */
+static bool failed;
+
+/* write() all of len bytes. Returns 0, or -1 with errno set */
+static int writeAll(int fd, const char *buf, size_t len)
+{
+	while (len > 0) {
+		ssize_t n = write(fd, buf, len);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static void report(const char *path, int err)
+{
+	fprintf(stderr, "tail: %s: %s\n", path, strerror(err));
+	failed = true;
+}
+
+/* "==> path <==" before output from a file other than the last one, with a blank line between files */
+static void showHeader(struct tailFile *f)
+{
+	if (!headers || shown == f)
+		return;
+	dprintf(STDOUT_FILENO, "%s==> %s <==\n", shown != NULL ? "\n" : "", f->path);
+	shown = f;
+}
+
+/*
+  Start of the last n lines of buf[0, len), a final newline ending the last
+  line rather than starting an empty one
+*/
+static size_t lastLines(const char *buf, size_t len, unsigned long long n)
+{
+	if (n == 0)
+		return len;
+	const char *p = buf + len;
+	if (len > 0 && p[-1] == '\n')
+		--p;
+	for (const char *nl; (nl = memrchr(buf, '\n', p - buf)) != NULL; p = nl)
+		if (--n == 0)
+			return nl - buf + 1;
+	return 0;
+}
+
+/* Start of buf[0, len) once *left more lines are skipped, counting them off. len if they don't all end in buf */
+static size_t skipLines(const char *buf, size_t len, unsigned long long *left)
+{
+	size_t pos = 0;
+	for (const char *nl; *left > 0 && (nl = memchr(buf + pos, '\n', len - pos)) != NULL; --*left)
+		pos = nl - buf + 1;
+	return *left > 0 ? len : pos;
+}
+
+/*
+  Offset where the output of a regular file of size bytes starts. The last
+  count lines are found reading backwards a block at a time, with +N the
+  lines to skip are read forwards
+*/
+static off_t findStart(struct tailFile *f, off_t size)
+{
+	static char buf[BLOCK_SIZE];
+	if (fromStart) {
+		unsigned long long left = count > 0 ? count - 1 : 0;
+		if (bytes)
+			return left < (unsigned long long) size ? (off_t) left : size;
+		off_t pos = 0;
+		while (left > 0 && pos < size) {
+			ssize_t len = pread(f->fd, buf, sizeof(buf), pos);
+			if (len == -1 && errno == EINTR)
+				continue;
+			if (len <= 0) {
+				report(f->path, len == 0 ? EIO : errno);
+				return size;
+			}
+			pos += skipLines(buf, len, &left);
+		}
+		return pos;
+	}
+	if (bytes)
+		return (unsigned long long) size > count ? size - (off_t) count : 0;
+	if (count == 0)
+		return size;
+	unsigned long long left = count;
+	off_t end = size;
+	while (end > 0) {
+		off_t start = end > BLOCK_SIZE ? end - BLOCK_SIZE : 0;
+		ssize_t len = pread(f->fd, buf, end - start, start);
+		if (len == -1 && errno == EINTR)
+			continue;
+		if (len <= 0) {
+			report(f->path, len == 0 ? EIO : errno);
+			return size;
+		}
+		start = end - len;
+		const char *p = buf + len;
+		if (end == size && p[-1] == '\n') /* The file's final newline ends the last line */
+			--p;
+		for (const char *nl; (nl = memrchr(buf, '\n', p - buf)) != NULL; p = nl)
+			if (--left == 0)
+				return start + (nl - buf) + 1;
+		end = start;
+	}
+	return 0;
+}
+
+/* Print f from f->pos up to its current end */
+static void printNew(struct tailFile *f)
+{
+	static char buf[BLOCK_SIZE];
+	struct stat st;
+	if (fstat(f->fd, &st) == 0 && st.st_size < f->pos) {
+		fprintf(stderr, "tail: %s: file truncated\n", f->path);
+		f->pos = 0;
+	}
+	while (1) {
+		ssize_t n = pread(f->fd, buf, sizeof(buf), f->pos);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n == -1)
+			report(f->path, errno);
+		if (n <= 0)
+			return;
+		showHeader(f);
+		if (writeAll(STDOUT_FILENO, buf, n) == -1) {
+			report("write error", errno);
+			exit(1);
+		}
+		f->pos += n;
+	}
+}
+
+/* Print a pipe or terminal from line or byte count on, as it's read */
+static void skipStream(struct tailFile *f)
+{
+	unsigned long long left = count > 0 ? count - 1 : 0;
+	char *buf = malloc(BLOCK_SIZE);
+	showHeader(f);
+	while (1) {
+		ssize_t n = read(f->fd, buf, BLOCK_SIZE);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n == -1)
+			report(f->path, errno);
+		if (n <= 0)
+			break;
+		size_t start;
+		if (bytes) {
+			start = left < (size_t) n ? left : (size_t) n;
+			left -= start;
+		}
+		else
+			start = skipLines(buf, n, &left);
+		if (writeAll(STDOUT_FILENO, buf + start, n - start) == -1) {
+			report("write error", errno);
+			break;
+		}
+	}
+	free(buf);
+}
+
+/* Print the end of a pipe or terminal: keep the last lines of what's read so far, print them at EOF */
+static void tailStream(struct tailFile *f)
+{
+	if (fromStart) {
+		skipStream(f);
+		return;
+	}
+	size_t cap = BLOCK_SIZE, len = 0;
+	char *buf = malloc(cap);
+	while (1) {
+		if (len == cap) {
+			size_t keep = bytes ? (count < len ? len - count : 0) : lastLines(buf, len, count);
+			if (keep > 0 && len >= TRIM_AT) {
+				memmove(buf, buf + keep, len - keep);
+				len -= keep;
+			}
+			else {
+				cap *= 2;
+				buf = realloc(buf, cap);
+			}
+		}
+		ssize_t n = read(f->fd, buf + len, cap - len);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n == -1)
+			report(f->path, errno);
+		if (n <= 0)
+			break;
+		len += n;
+	}
+	size_t start = bytes ? (count < len ? len - count : 0) : lastLines(buf, len, count);
+	showHeader(f);
+	if (writeAll(STDOUT_FILENO, buf + start, len - start) == -1)
+		report("write error", errno);
+	free(buf);
+}
+
+/* Print the last lines of one input, leaving it open if it can be followed */
+static void tailFile(struct tailFile *f)
+{
+	bool isStdin = strcmp(f->path, "-") == 0;
+	f->fd = isStdin ? STDIN_FILENO : open(f->path, O_RDONLY | O_CLOEXEC);
+	if (f->fd == -1) {
+		report(f->path, errno);
+		return;
+	}
+	struct stat st;
+	if (fstat(f->fd, &st) == -1) {
+		report(f->path, errno);
+		if (!isStdin)
+			close(f->fd);
+		f->fd = -1;
+		return;
+	}
+	f->regular = S_ISREG(st.st_mode) && !isStdin;
+	if (S_ISDIR(st.st_mode))
+		report(f->path, EISDIR);
+	else if (f->regular) {
+		f->pos = findStart(f, st.st_size);
+		showHeader(f);
+		printNew(f);
+		return;
+	}
+	else
+		tailStream(f);
+	if (!isStdin)
+		close(f->fd);
+	f->fd = -1;
+}
+
+/* Done with the file behind a name: print what was still written to it and stop watching it */
+static void drop(int ino, struct tailFile *f)
+{
+	printNew(f);
+	close(f->fd);
+	f->fd = -1;
+	if (f->wd != -1)
+		inotify_rm_watch(ino, f->wd);
+	f->wd = -1;
+}
+
+/*
+  Switch to the file now at the name of one that was rotated away or was
+  missing, printing it from the start. The old file is only let go once
+  there's a new one, so lines written to it after the rename aren't lost
+*/
+static void reopen(int ino, struct tailFile *f)
+{
+	int fd = open(f->path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return;
+	struct stat st, old;
+	if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)
+	    || (f->fd != -1 && fstat(f->fd, &old) == 0 && old.st_dev == st.st_dev && old.st_ino == st.st_ino)) {
+		close(fd);
+		return;
+	}
+	if (f->fd != -1)
+		drop(ino, f);
+	fprintf(stderr, "tail: %s has been replaced, following the new file\n", f->path);
+	f->fd = fd;
+	f->pos = 0;
+	f->wd = inotify_add_watch(ino, f->path, FILE_EVENTS);
+	printNew(f);
+}
+
+/*
+  Follow every regular file by name. The files are watched for writes and
+  for being moved or deleted, and their directories for a new file taking
+  the name, so nothing is polled: the process sleeps in read() until the
+  kernel has an event for it
+*/
+static void follow(struct tailFile *files, size_t num)
+{
+	int ino = inotify_init1(IN_CLOEXEC);
+	if (ino == -1) {
+		report("inotify", errno);
+		return;
+	}
+	size_t watched = 0;
+	for (size_t i = 0; i < num; ++i) {
+		struct tailFile *f = &files[i];
+		f->wd = f->dirWd = -1;
+		if (!f->regular)
+			continue;
+		const char *slash = strrchr(f->path, '/');
+		f->dir = slash == NULL ? strdup(".") : slash == f->path ? strdup("/") : strndup(f->path, slash - f->path);
+		f->name = slash == NULL ? f->path : slash + 1;
+		f->wd = inotify_add_watch(ino, f->path, FILE_EVENTS);
+		f->dirWd = inotify_add_watch(ino, f->dir, DIR_EVENTS);
+		if (f->wd == -1)
+			report(f->path, errno);
+		else
+			++watched;
+	}
+	static char buf[EVENT_BUF] __attribute__((aligned(__alignof__(struct inotify_event))));
+	while (watched > 0) {
+		ssize_t n = read(ino, buf, sizeof(buf));
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			report("inotify", n == 0 ? EIO : errno);
+			break;
+		}
+		for (char *p = buf; p < buf + n; ) {
+			struct inotify_event *ev = (struct inotify_event*) p;
+			p += sizeof(struct inotify_event) + ev->len;
+			for (size_t i = 0; i < num; ++i) {
+				struct tailFile *f = &files[i];
+				if (ev->mask & IN_Q_OVERFLOW) { /* Events were lost, catch up on everything */
+					if (f->fd != -1)
+						printNew(f);
+					else if (f->regular)
+						reopen(ino, f);
+				}
+				else if (f->fd != -1 && ev->wd == f->wd) {
+					if (ev->mask & IN_DELETE_SELF)
+						drop(ino, f);
+					else if (ev->mask & (IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF))
+						printNew(f);
+					if (ev->mask & (IN_MOVE_SELF | IN_DELETE_SELF))
+						reopen(ino, f); /* The new file may already be there */
+				}
+				/* Also when the file is still open: renamed or deleted, it's no longer at the name */
+				else if (f->regular && ev->wd == f->dirWd && ev->len > 0 && strcmp(ev->name, f->name) == 0)
+					reopen(ino, f);
+			}
+		}
+	}
+	close(ino);
+}
+
+/* Parse a -n or -c count, N or -N for the last N, +N to start at the Nth. Returns false if it's not a number */
+static bool parseCount(const char *s)
+{
+	char *end;
+	fromStart = *s == '+';
+	if (*s == '-' || *s == '+')
+		++s;
+	errno = 0;
+	count = strtoull(s, &end, 10);
+	return *s != '\0' && *end == '\0' && errno == 0;
+}
+
+int main(int argc, char **argv)
+{
+	bool followFiles = false, quiet = false;
+	static struct option longOpts[] = {
+		{ "lines", required_argument, NULL, 'n' },
+		{ "bytes", required_argument, NULL, 'c' },
+		{ "follow", no_argument, NULL, 'f' },
+		{ "quiet", no_argument, NULL, 'q' },
+		{ NULL, 0, NULL, 0 }
+	};
+	int c;
+	while ((c = getopt_long(argc, argv, "n:c:fq", longOpts, NULL)) != -1) {
+		switch (c) {
+		case 'n':
+		case 'c':
+			if (!parseCount(optarg)) {
+				fprintf(stderr, "tail: invalid number: %s\n", optarg);
+				return 1;
+			}
+			bytes = c == 'c';
+			break;
+		case 'f':
+			followFiles = true;
+			break;
+		case 'q':
+			quiet = true;
+			break;
+		default:
+			return 1;
+		}
+	}
+
+	char *dash[] = { "-" };
+	char **paths = argv + optind;
+	size_t num = argc - optind;
+	if (num == 0) {
+		paths = dash;
+		num = 1;
+	}
+	headers = num > 1 && !quiet;
+	struct tailFile *files = calloc(num, sizeof(struct tailFile));
+	for (size_t i = 0; i < num; ++i) {
+		files[i].path = paths[i];
+		tailFile(&files[i]);
+	}
+	if (followFiles)
+		follow(files, num);
+	for (size_t i = 0; i < num; ++i) {
+		if (files[i].fd != -1 && files[i].fd != STDIN_FILENO)
+			close(files[i].fd);
+		free(files[i].dir);
+	}
+	free(files);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,324 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "soyio.h"
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+#define BLOCK_SIZE (4 << 20) /* Bytes counted per block, from the mapping or a read */
+#define OUT_BUF (64 << 10)
+#define MAX_THREADS 64
+
+struct counts {
+	unsigned long long lines;
+	unsigned long long words;
+	unsigned long long bytes;
+};
+
+/* One input and what was counted in it */
+struct wcFile {
+	const char *path;
+	struct counts c;
+	int err; /* errno if it couldn't be read */
+};
+
+/*
+  Count newlines and, if words is set, word starts (a non-space byte after a
+  space byte) in p[0, n). *prevSpace carries whether the byte before p was a
+  space from one block to the next
+*/
+typedef void (*countFn)(const unsigned char *p, size_t n, bool words, struct counts *c, unsigned int *prevSpace);
+
+/* The six ASCII whitespace bytes that separate words */
+static const unsigned char spaceTable[256] = { ['\t'] = 1, ['\n'] = 1, ['\v'] = 1, ['\f'] = 1, ['\r'] = 1, [' '] = 1 };
+
+/* Portable kernel, also used for the tails the vector kernels leave. Branch free per byte */
+static void countScalar(const unsigned char *p, size_t n, bool words, struct counts *c, unsigned int *prevSpace)
+{
+	unsigned long long lines = 0, starts = 0;
+	unsigned int prev = *prevSpace;
+	for (size_t i = 0; i < n; ++i) {
+		unsigned int space = spaceTable[p[i]];
+		lines += p[i] == '\n';
+		starts += prev & (space ^ 1);
+		prev = space;
+	}
+	c->lines += lines;
+	if (words)
+		c->words += starts;
+	*prevSpace = prev;
+}
+
+#ifdef __x86_64__
+/*
+  SSE2 (always there on x86-64). Newlines are counted in per-byte counters
+  that are summed with psadbw before they can overflow. Spaces are ' ' or
+  9 <= byte <= 13, turned into a bit mask, and the word starts are the
+  non-space bits whose previous bit is a space
+*/
+static void countSse2(const unsigned char *p, size_t n, bool words, struct counts *c, unsigned int *prevSpace)
+{
+	const __m128i nl = _mm_set1_epi8('\n'), blank = _mm_set1_epi8(' ');
+	const __m128i tab = _mm_set1_epi8('\t'), range = _mm_set1_epi8('\r' - '\t');
+	unsigned long long lines = 0, starts = 0;
+	unsigned int carry = *prevSpace;
+	size_t i = 0;
+	while (i + 16 <= n) {
+		__m128i acc = _mm_setzero_si128();
+		for (int k = 0; k < 255 && i + 16 <= n; ++k, i += 16) {
+			__m128i v = _mm_loadu_si128((const __m128i*) (p + i));
+			acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(v, nl));
+			if (words) {
+				__m128i t = _mm_sub_epi8(v, tab);
+				__m128i space = _mm_or_si128(_mm_cmpeq_epi8(v, blank), _mm_cmpeq_epi8(_mm_min_epu8(t, range), t));
+				unsigned int s = _mm_movemask_epi8(space);
+				starts += __builtin_popcount(~s & ((s << 1) | carry) & 0xFFFF);
+				carry = s >> 15;
+			}
+		}
+		__m128i sum = _mm_sad_epu8(acc, _mm_setzero_si128());
+		lines += _mm_cvtsi128_si64(sum) + _mm_extract_epi16(sum, 4);
+	}
+	c->lines += lines;
+	if (words) {
+		c->words += starts;
+		*prevSpace = carry;
+	}
+	else if (i > 0)
+		*prevSpace = spaceTable[p[i - 1]];
+	countScalar(p + i, n - i, words, c, prevSpace);
+}
+
+/* Same as countSse2, 32 bytes at a time */
+__attribute__((target("avx2,popcnt")))
+static void countAvx2(const unsigned char *p, size_t n, bool words, struct counts *c, unsigned int *prevSpace)
+{
+	const __m256i nl = _mm256_set1_epi8('\n'), blank = _mm256_set1_epi8(' ');
+	const __m256i tab = _mm256_set1_epi8('\t'), range = _mm256_set1_epi8('\r' - '\t');
+	unsigned long long lines = 0, starts = 0;
+	unsigned int carry = *prevSpace;
+	size_t i = 0;
+	while (i + 32 <= n) {
+		__m256i acc = _mm256_setzero_si256();
+		for (int k = 0; k < 255 && i + 32 <= n; ++k, i += 32) {
+			__m256i v = _mm256_loadu_si256((const __m256i*) (p + i));
+			acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(v, nl));
+			if (words) {
+				__m256i t = _mm256_sub_epi8(v, tab);
+				__m256i space = _mm256_or_si256(_mm256_cmpeq_epi8(v, blank), _mm256_cmpeq_epi8(_mm256_min_epu8(t, range), t));
+				unsigned int s = _mm256_movemask_epi8(space);
+				starts += __builtin_popcount(~s & ((s << 1) | carry));
+				carry = s >> 31;
+			}
+		}
+		__m256i sum = _mm256_sad_epu8(acc, _mm256_setzero_si256());
+		lines += _mm256_extract_epi64(sum, 0) + _mm256_extract_epi64(sum, 1) + _mm256_extract_epi64(sum, 2) + _mm256_extract_epi64(sum, 3);
+	}
+	c->lines += lines;
+	if (words) {
+		c->words += starts;
+		*prevSpace = carry;
+	}
+	else if (i > 0)
+		*prevSpace = spaceTable[p[i - 1]];
+	countScalar(p + i, n - i, words, c, prevSpace);
+}
+#endif
+
+/* Best kernel for the CPU we're running on */
+static countFn pickKernel(void)
+{
+#ifdef __x86_64__
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return countAvx2;
+	return countSse2;
+#else
+	return countScalar;
+#endif
+}
+
+static countFn countBlock;
+static bool countWords;
+
+/* Count one input, "-" being stdin */
+static void countFile(struct wcFile *f)
+{
+	bool isStdin = strcmp(f->path, "-") == 0;
+	int fd = isStdin ? STDIN_FILENO : open(f->path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		f->err = errno;
+		return;
+	}
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	struct soyReader r;
+	if (srInit(&r, fd, BLOCK_SIZE) == -1)
+		f->err = errno;
+	else {
+		unsigned int prevSpace = 1;
+		while (1) {
+			const char *data;
+			ssize_t n = srNext(&r, &data);
+			if (n <= 0) {
+				if (n == -1)
+					f->err = errno;
+				break;
+			}
+			countBlock((const unsigned char*) data, n, countWords, &f->c, &prevSpace);
+			f->c.bytes += n;
+		}
+		srFree(&r);
+	}
+	if (!isStdin)
+		close(fd);
+}
+
+/* Files for the -j workers to claim one at a time */
+struct wcJob {
+	struct wcFile *files;
+	size_t num;
+	atomic_size_t next;
+};
+
+static void* countWorker(void *arg)
+{
+	struct wcJob *job = arg;
+	size_t i;
+	while ((i = atomic_fetch_add(&job->next, 1)) < job->num)
+		countFile(&job->files[i]);
+	return NULL;
+}
+
+/* Count every file, with up to threads files at a time */
+static void countAll(struct wcFile *files, size_t num, unsigned int threads)
+{
+	struct wcJob job = { .files = files, .num = num };
+	atomic_init(&job.next, 0);
+	if (threads > num)
+		threads = num;
+	pthread_t tids[MAX_THREADS];
+	unsigned int started = 0;
+	while (started + 1 < threads && pthread_create(&tids[started], NULL, countWorker, &job) == 0)
+		++started;
+	countWorker(&job);
+	for (unsigned int i = 0; i < started; ++i)
+		pthread_join(tids[i], NULL);
+}
+
+static int digits(unsigned long long v)
+{
+	int d = 1;
+	while (v >= 10) {
+		v /= 10;
+		++d;
+	}
+	return d;
+}
+
+int main(int argc, char **argv)
+{
+	bool lines = false, words = false, bytes = false;
+	unsigned int threads = 1;
+	static struct option longOpts[] = {
+		{ "lines", no_argument, NULL, 'l' },
+		{ "words", no_argument, NULL, 'w' },
+		{ "bytes", no_argument, NULL, 'c' },
+		{ "jobs", required_argument, NULL, 'j' },
+		{ NULL, 0, NULL, 0 }
+	};
+	int c;
+	while ((c = getopt_long(argc, argv, "lwcj:", longOpts, NULL)) != -1) {
+		switch (c) {
+		case 'l':
+			lines = true;
+			break;
+		case 'w':
+			words = true;
+			break;
+		case 'c':
+			bytes = true;
+			break;
+		case 'j':
+			threads = atoi(optarg);
+			if (threads < 1 || threads > MAX_THREADS) {
+				fprintf(stderr, "wc: number of threads must be between 1 and %d\n", MAX_THREADS);
+				return 1;
+			}
+			break;
+		default:
+			return 1;
+		}
+	}
+	if (!lines && !words && !bytes)
+		lines = words = bytes = true;
+	countWords = words;
+	countBlock = pickKernel();
+
+	char *dash[] = { "-" };
+	char **paths = argv + optind;
+	size_t num = argc - optind;
+	if (num == 0) {
+		paths = dash;
+		num = 1;
+	}
+	struct wcFile *files = calloc(num, sizeof(struct wcFile));
+	for (size_t i = 0; i < num; ++i)
+		files[i].path = paths[i];
+	countAll(files, num, threads);
+
+	struct counts total = { 0, 0, 0 };
+	for (size_t i = 0; i < num; ++i) {
+		total.lines += files[i].c.lines;
+		total.words += files[i].c.words;
+		total.bytes += files[i].c.bytes;
+	}
+	/* Columns are as wide as the byte total, which no other count can exceed */
+	int fields = lines + words + bytes;
+	int width = fields == 1 && num == 1 ? 1 : digits(total.bytes);
+
+	struct soyWriter out;
+	swInit(&out, STDOUT_FILENO, OUT_BUF);
+	int ret = 0;
+	for (size_t i = 0; i <= num; ++i) {
+		if (i == num && num == 1)
+			break;
+		const struct counts *cnt = i < num ? &files[i].c : &total;
+		if (i < num && files[i].err != 0) {
+			swFlush(&out);
+			fprintf(stderr, "wc: %s: %s\n", files[i].path, strerror(files[i].err));
+			ret = 1;
+			continue;
+		}
+		const char *sep = "";
+		if (lines) {
+			swPrintf(&out, "%*llu", width, cnt->lines);
+			sep = " ";
+		}
+		if (words) {
+			swPrintf(&out, "%s%*llu", sep, width, cnt->words);
+			sep = " ";
+		}
+		if (bytes)
+			swPrintf(&out, "%s%*llu", sep, width, cnt->bytes);
+		if (i == num)
+			swLine(&out, " total");
+		else if (paths != dash) {
+			swWrite(&out, " ", 1);
+			swLine(&out, files[i].path);
+		}
+		else
+			swWrite(&out, "\n", 1);
+	}
+	swFlush(&out);
+	free(files);
+	return ret;
+}
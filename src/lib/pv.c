@@ -0,0 +1,315 @@
+#define _GNU_SOURCE
+#include "pv.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define CHUNK (1 << 20) /* Most bytes moved per call */
+#define PIPE_SIZE (1 << 20) /* Pipes are grown to this, so each splice() moves more. Best effort */
+#define REPORT_MAX 256
+
+/*
+  Parse pv's options from argv[1]... Returns the index of the first operand
+  (argc if there's none), or -1 after printing an error. Flags can be combined
+  as in -lq, and an option's value can follow in the same argument (-i0.5,
+  -lqi 0.5) or the next one. Doesn't use getopt(), whose state is global, so
+  the shell can call it on any thread
+*/
+int pvParseArgs(struct pvOptions *o, int argc, char **argv)
+{
+    memset(o, 0, sizeof(*o));
+    o->interval = 1;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; ++i)
+    {
+        if (strcmp(argv[i], "--") == 0)
+            return i + 1;
+        for (const char *opt = argv[i] + 1; *opt != '\0'; ++opt)
+        {
+            if (*opt == 'l' || *opt == 'q')
+            {
+                *(*opt == 'l' ? &o->lines : &o->quiet) = true;
+                continue;
+            }
+            if (strchr("isN", *opt) == NULL || (opt[1] == '\0' && i + 1 == argc))
+            {
+                fprintf(stderr, "pv: -%c: %s\n", *opt, strchr("isN", *opt) == NULL ? "unknown option" : "missing argument");
+                return -1;
+            }
+            const char *val = opt[1] != '\0' ? opt + 1 : argv[++i]; /* The rest of the argument is the value */
+            char *end;
+            switch (*opt)
+            {
+            case 'i':
+                o->interval = strtod(val, &end);
+                if (*end != '\0' || !(o->interval > 0))
+                {
+                    fprintf(stderr, "pv: invalid interval: %s\n", val);
+                    return -1;
+                }
+                break;
+            case 's':
+                errno = 0;
+                o->size = strtoull(val, &end, 10);
+                const char *units = "KMGT", *u = *end != '\0' ? strchr(units, *end) : NULL;
+                if (u != NULL) /* Binary suffix */
+                {
+                    unsigned int shift = 10 * (u - units + 1);
+                    if (o->size > ULLONG_MAX >> shift)
+                        errno = ERANGE;
+                    o->size <<= shift;
+                    ++end;
+                }
+                if (end == val || *end != '\0' || errno != 0 || *val == '-')
+                {
+                    fprintf(stderr, "pv: invalid size: %s\n", val);
+                    return -1;
+                }
+                break;
+            case 'N':
+                o->name = val;
+                break;
+            }
+            break; /* The value used up the argument */
+        }
+    }
+    return i;
+}
+
+/*
+  What an error of pvCopy() means for the stage, the same whether pv runs as
+  a command or in the shell. EPIPE is the reader having all it wants, e.g.
+  head, so the stage just stops. Anything else is printed, with the input's
+  name if it's given, and fails the stage. Returns true for a failure
+*/
+bool pvFailed(const char *name, int err)
+{
+    if (err == 0 || err == EPIPE)
+        return false;
+    if (name != NULL)
+        fprintf(stderr, "pv: %s: %s\n", name, strerror(err));
+    else
+        fprintf(stderr, "pv: %s\n", strerror(err));
+    return true;
+}
+
+static double elapsed(const struct timespec *from, const struct timespec *to)
+{ return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9; }
+
+/* Append a byte count with a binary unit */
+static int formatBytes(char *buf, size_t len, double bytes)
+{
+    static const char *units[] = { "B", "KiB", "MiB", "GiB", "TiB", "PiB" };
+    unsigned int u = 0;
+    while (bytes >= 1024 && u < sizeof(units) / sizeof(units[0]) - 1)
+    {
+        bytes /= 1024;
+        ++u;
+    }
+    return snprintf(buf, len, u == 0 ? "%.0f%s" : "%.2f%s", bytes, units[u]);
+}
+
+static int formatTime(char *buf, size_t len, double secs)
+{
+    unsigned long long s = secs;
+    return snprintf(buf, len, "%llu:%02llu:%02llu", s / 3600, s / 60 % 60, s % 60);
+}
+
+/*
+  Print a report to stderr in one write(), so reports from several meters
+  don't tear. Interim reports show the rate since the previous one, the
+  totals show the average over the whole run
+*/
+static void report(struct pvMeter *m, bool final)
+{
+    const struct pvOptions *o = m->opts;
+    if (o->quiet)
+        return;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double total = elapsed(&m->start, &now);
+    double span = final ? total : elapsed(&m->last, &now);
+    if (span <= 0)
+        span = 1e-9;
+    double avg = total > 0 ? m->bytes / total : 0;
+    double rate = final ? avg : (m->bytes - m->lastBytes) / span;
+    double lineRate = final ? m->lines / span : (m->lines - m->lastLines) / span;
+
+    char buf[REPORT_MAX];
+    size_t n = 0;
+#define APPEND(call) n += (call), n = n < sizeof(buf) ? n : sizeof(buf) - 1
+    if (m->tty)
+        APPEND(snprintf(buf + n, sizeof(buf) - n, "\r"));
+    if (o->name != NULL)
+        APPEND(snprintf(buf + n, sizeof(buf) - n, "%s: ", o->name));
+    APPEND(formatBytes(buf + n, sizeof(buf) - n, m->bytes));
+    APPEND(snprintf(buf + n, sizeof(buf) - n, final ? " in " : " "));
+    APPEND(formatTime(buf + n, sizeof(buf) - n, total));
+    APPEND(snprintf(buf + n, sizeof(buf) - n, " ["));
+    APPEND(formatBytes(buf + n, sizeof(buf) - n, rate));
+    APPEND(snprintf(buf + n, sizeof(buf) - n, "/s]"));
+    if (o->lines)
+        APPEND(snprintf(buf + n, sizeof(buf) - n, " %llu lines [%.0f/s]", m->lines, lineRate));
+    if (!final && o->size > 0)
+    {
+        APPEND(snprintf(buf + n, sizeof(buf) - n, " %3.0f%%", m->bytes < o->size ? 100.0 * m->bytes / o->size : 100.0));
+        if (avg > 0 && m->bytes < o->size)
+        {
+            APPEND(snprintf(buf + n, sizeof(buf) - n, " ETA "));
+            APPEND(formatTime(buf + n, sizeof(buf) - n, (o->size - m->bytes) / avg));
+        }
+    }
+    APPEND(snprintf(buf + n, sizeof(buf) - n, m->tty ? "\033[K%s" : "%s", final || !m->tty ? "\n" : ""));
+#undef APPEND
+    while (write(STDERR_FILENO, buf, n) == -1 && errno == EINTR);
+    m->last = now;
+    m->lastBytes = m->bytes;
+    m->lastLines = m->lines;
+}
+
+void pvStart(struct pvMeter *m, const struct pvOptions *o)
+{
+    memset(m, 0, sizeof(*m));
+    m->opts = o;
+    m->tty = isatty(STDERR_FILENO);
+    clock_gettime(CLOCK_MONOTONIC, &m->start);
+    m->last = m->start;
+}
+
+/* Milliseconds until the next report is due, 0 if it's overdue, -1 if there are no reports */
+static int untilReport(struct pvMeter *m)
+{
+    if (m->opts->quiet)
+        return -1;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double left = m->opts->interval - elapsed(&m->last, &now);
+    return left > 0 ? (int) (left * 1000) + 1 : 0;
+}
+
+/* Sleep until in has data, reporting whenever one is due in the meantime, so a stalled stage still shows up */
+static void waitInput(struct pvMeter *m, int in)
+{
+    struct pollfd p = { in, POLLIN, 0 };
+    while (1)
+    {
+        int wait = untilReport(m);
+        if (wait == 0)
+            report(m, false);
+        else if (poll(&p, 1, wait) != 0) /* Readable, hung up or an error: the next read tells which */
+            return;
+    }
+}
+
+static int writeAll(int fd, const char *buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, buf, len);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static unsigned long long countLines(const char *p, size_t len)
+{
+    unsigned long long n = 0;
+    for (const char *end = p + len; (p = memchr(p, '\n', end - p)) != NULL; ++p)
+        ++n;
+    return n;
+}
+
+/*
+  Copy in to out until in runs out, counting as it goes. Neither fd is
+  closed. Returns 0, or an errno value (EPIPE when out's reader went away)
+*/
+int pvCopy(struct pvMeter *m, int in, int out)
+{
+    struct stat st;
+    bool inPipe = fstat(in, &st) == 0 && S_ISFIFO(st.st_mode);
+    bool outPipe = fstat(out, &st) == 0 && S_ISFIFO(st.st_mode);
+    if (inPipe)
+        fcntl(in, F_SETPIPE_SZ, PIPE_SIZE);
+    if (outPipe)
+        fcntl(out, F_SETPIPE_SZ, PIPE_SIZE);
+    /* splice() needs a pipe on one side, tee() on both */
+    bool zeroCopy = m->opts->lines ? inPipe && outPipe : inPipe || outPipe;
+    char *buf = NULL;
+    int err = 0;
+    while (1)
+    {
+        waitInput(m, in);
+        if (buf == NULL && (m->opts->lines || !zeroCopy) && (buf = malloc(CHUNK)) == NULL)
+        {
+            err = ENOMEM;
+            break;
+        }
+        ssize_t n;
+        if (zeroCopy && !m->opts->lines)
+            n = splice(in, NULL, out, NULL, CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE);
+        else if (zeroCopy)
+            n = tee(in, out, CHUNK, 0);
+        else
+            n = read(in, buf, CHUNK);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1 && zeroCopy && errno == EINVAL) /* An fd splice() doesn't support, e.g. O_APPEND output */
+        {
+            zeroCopy = false;
+            continue;
+        }
+        if (n == -1)
+        {
+            err = errno;
+            break;
+        }
+        if (n == 0)
+            break;
+        if (zeroCopy && m->opts->lines)
+        {
+            /* The tee()d bytes are still in the input pipe: read them out to count them */
+            for (ssize_t got = 0, r; got < n; got += r)
+            {
+                r = read(in, buf, n - got);
+                if (r == -1 && errno == EINTR)
+                    r = 0;
+                else if (r <= 0)
+                {
+                    err = r == 0 ? EIO : errno;
+                    break;
+                }
+                m->lines += countLines(buf, r);
+            }
+        }
+        else if (!zeroCopy)
+        {
+            if (m->opts->lines)
+                m->lines += countLines(buf, n);
+            if (writeAll(out, buf, n) == -1)
+                err = errno;
+        }
+        if (err != 0)
+            break;
+        m->bytes += n;
+        if (untilReport(m) == 0)
+            report(m, false);
+    }
+    free(buf);
+    return err;
+}
+
+void pvFinish(struct pvMeter *m)
+{ report(m, true); }
@@ -0,0 +1,45 @@
+/*
+  Throughput meter for a pipeline stage, shared by the pv command and the
+  shell, which runs pv in a thread when it sits between two other stages
+
+  Data is moved with splice() when either end is a pipe, so it never comes
+  up to user space. Counting lines needs to see the bytes: then tee() copies
+  them to the output pipe in the kernel and only the copy that's counted is
+  read(). Anything splice() can't handle falls back to read()/write()
+
+  Usage: pvParseArgs() or fill in the options, pvStart(), pvCopy() once per
+  input, with pvFailed() on what it returns, then pvFinish() for the totals.
+  A meter is only used by one thread, but any number of meters can run at once
+*/
+#ifndef PV_H
+#define PV_H
+
+#include <stdbool.h>
+#include <time.h>
+
+struct pvOptions {
+    double interval; /* Seconds between reports */
+    bool lines; /* Count lines as well as bytes */
+    bool quiet; /* No reports and no totals */
+    unsigned long long size; /* Bytes expected, for the percentage and ETA. 0 when unknown */
+    const char *name; /* Printed before each report, may be NULL */
+};
+
+struct pvMeter {
+    const struct pvOptions *opts;
+    unsigned long long bytes;
+    unsigned long long lines;
+    struct timespec start;
+    struct timespec last; /* Time of the last report */
+    unsigned long long lastBytes; /* Counts at the last report, for the current rate */
+    unsigned long long lastLines;
+    bool tty; /* stderr is a terminal: reports overwrite each other */
+};
+
+int pvParseArgs(struct pvOptions *o, int argc, char **argv);
+void pvStart(struct pvMeter *m, const struct pvOptions *o);
+int pvCopy(struct pvMeter *m, int in, int out);
+bool pvFailed(const char *name, int err);
+void pvFinish(struct pvMeter *m);
+
+#endif
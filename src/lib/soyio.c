@@ -0,0 +1,288 @@
+#include "soyio.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define MIN_GROW 4096 /* First allocation of a memory-only writer */
+#define MAP_MIN (64 << 10) /* Files smaller than this are cheaper to read() than to map */
+
+/* writev() until everything is out. Returns 0, or -1 with errno set */
+static int writevAll(int fd, struct iovec *iov, int cnt)
+{
+    while (cnt > 0)
+    {
+        ssize_t n = writev(fd, iov, cnt);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        while (cnt > 0 && (size_t) n >= iov->iov_len)
+        {
+            n -= iov->iov_len;
+            ++iov;
+            --cnt;
+        }
+        if (cnt > 0)
+        {
+            iov->iov_base = (char*) iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+/* Set up a writer to fd (-1 for memory only) with a cap byte buffer */
+void swInit(struct soyWriter *w, int fd, size_t cap)
+{
+    w->fd = fd;
+    w->buf = cap > 0 ? malloc(cap) : NULL;
+    w->cap = w->buf != NULL ? cap : 0;
+    w->len = 0;
+    w->err = 0;
+}
+
+/* Write out whatever is buffered plus len bytes of extra data in one go */
+static int swFlushWith(struct soyWriter *w, const void *extra, size_t len)
+{
+    struct iovec iov[2] = { { w->buf, w->len }, { (void*) extra, len } };
+    int r = 0;
+    if (w->err == 0 && w->len + len > 0 && writevAll(w->fd, w->len > 0 ? iov : iov + 1, w->len > 0 ? 2 : 1) == -1)
+        w->err = errno;
+    if (w->err != 0)
+    {
+        errno = w->err;
+        r = -1;
+    }
+    w->len = 0;
+    return r;
+}
+
+/* Append len bytes. Returns 0, or -1 if output to the fd has failed */
+int swWrite(struct soyWriter *w, const void *data, size_t len)
+{
+    if (w->len + len <= w->cap)
+    {
+        memcpy(w->buf + w->len, data, len);
+        w->len += len;
+        return 0;
+    }
+    if (w->fd == -1)
+    {
+        size_t cap = w->cap > 0 ? w->cap : MIN_GROW;
+        while (w->len + len > cap)
+            cap *= 2;
+        char *buf = realloc(w->buf, cap);
+        if (buf == NULL)
+            return -1;
+        w->buf = buf;
+        w->cap = cap;
+        memcpy(w->buf + w->len, data, len);
+        w->len += len;
+        return 0;
+    }
+    if (len >= w->cap / 2) /* Too big to be worth copying, send it along with the buffer */
+        return swFlushWith(w, data, len);
+    int r = swFlushWith(w, NULL, 0);
+    memcpy(w->buf, data, len);
+    w->len = len;
+    return r;
+}
+
+/* Append s and a newline */
+int swLine(struct soyWriter *w, const char *s)
+{
+    size_t len = strlen(s);
+    if (w->len + len + 1 <= w->cap) /* Common case, no need for two calls */
+    {
+        memcpy(w->buf + w->len, s, len);
+        w->buf[w->len + len] = '\n';
+        w->len += len + 1;
+        return 0;
+    }
+    int r = swWrite(w, s, len);
+    return swWrite(w, "\n", 1) == 0 ? r : -1;
+}
+
+/* Append printf output, formatted straight into the buffer when it fits */
+int swVprintf(struct soyWriter *w, const char *fmt, va_list ap)
+{
+    va_list again;
+    va_copy(again, ap);
+    int n = vsnprintf(w->buf != NULL ? w->buf + w->len : NULL, w->cap - w->len, fmt, ap);
+    int r = 0;
+    if (n < 0)
+        r = -1;
+    else if (w->len + n < w->cap) /* vsnprintf also wants room for the terminator */
+        w->len += n;
+    else
+    {
+        char *tmp = malloc(n + 1);
+        if (tmp == NULL)
+            r = -1;
+        else
+        {
+            vsnprintf(tmp, n + 1, fmt, again);
+            r = swWrite(w, tmp, n);
+            free(tmp);
+        }
+    }
+    va_end(again);
+    return r;
+}
+
+int swPrintf(struct soyWriter *w, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    int r = swVprintf(w, fmt, ap);
+    va_end(ap);
+    return r;
+}
+
+/* Write out everything buffered. Memory-only writers have nothing to flush */
+int swFlush(struct soyWriter *w)
+{
+    if (w->fd == -1)
+        return 0;
+    return swFlushWith(w, NULL, 0);
+}
+
+/* Release the buffer without flushing it */
+void swFree(struct soyWriter *w)
+{
+    free(w->buf);
+    w->buf = NULL;
+    w->len = w->cap = 0;
+}
+
+/* Set up a reader over fd handing out up to block bytes at a time. Returns 0, or -1 with errno set */
+int srInit(struct soyReader *r, int fd, size_t block)
+{
+    memset(r, 0, sizeof(*r));
+    r->fd = fd;
+    r->block = block;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size >= MAP_MIN)
+    {
+        off_t start = lseek(fd, 0, SEEK_CUR); /* Pick up wherever the fd is, like read() would */
+        if (start != -1 && start < st.st_size)
+        {
+            void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map != MAP_FAILED)
+            {
+                madvise(map, st.st_size, MADV_SEQUENTIAL);
+                r->map = map;
+                r->mapLen = st.st_size;
+                r->pos = start;
+                return 0;
+            }
+        }
+    }
+    r->buf = malloc(block);
+    return r->buf != NULL ? 0 : -1;
+}
+
+/* Point data at the next block. Returns its length, 0 at end of file, or -1 with errno set */
+ssize_t srNext(struct soyReader *r, const char **data)
+{
+    if (r->map != NULL)
+    {
+        size_t len = r->mapLen - r->pos < r->block ? r->mapLen - r->pos : r->block;
+        *data = r->map + r->pos;
+        r->pos += len;
+        return len;
+    }
+    while (1)
+    {
+        ssize_t n = read(r->fd, r->buf, r->block);
+        if (n == -1 && errno == EINTR)
+            continue;
+        *data = r->buf;
+        return n;
+    }
+}
+
+void srFree(struct soyReader *r)
+{
+    if (r->map != NULL)
+    {
+        munmap(r->map, r->mapLen);
+        lseek(r->fd, r->pos, SEEK_SET); /* Leave the fd where reading stopped */
+    }
+    free(r->buf);
+    memset(r, 0, sizeof(*r));
+}
+
+struct soyPool {
+    size_t size;
+    size_t align;
+    pthread_mutex_t lock;
+    void **free; /* Buffers handed back */
+    size_t numFree;
+    size_t maxFree;
+};
+
+/* Pool of size byte buffers aligned to align (a power of two at least sizeof(void*)) */
+struct soyPool* spCreate(size_t size, size_t align)
+{
+    struct soyPool *p = calloc(1, sizeof(struct soyPool));
+    if (p == NULL)
+        return NULL;
+    p->size = size;
+    p->align = align;
+    pthread_mutex_init(&p->lock, NULL);
+    return p;
+}
+
+/* A buffer from the pool, allocating one if none is free. NULL if out of memory */
+void* spGet(struct soyPool *p)
+{
+    void *buf = NULL;
+    pthread_mutex_lock(&p->lock);
+    if (p->numFree > 0)
+        buf = p->free[--p->numFree];
+    pthread_mutex_unlock(&p->lock);
+    if (buf == NULL && posix_memalign(&buf, p->align, p->size) != 0)
+        return NULL;
+    return buf;
+}
+
+/* Hand a buffer from spGet() back for reuse */
+void spPut(struct soyPool *p, void *buf)
+{
+    pthread_mutex_lock(&p->lock);
+    if (p->numFree == p->maxFree)
+    {
+        size_t max = p->maxFree > 0 ? 2 * p->maxFree : 8;
+        void **list = realloc(p->free, max * sizeof(void*));
+        if (list == NULL)
+        {
+            pthread_mutex_unlock(&p->lock);
+            free(buf);
+            return;
+        }
+        p->free = list;
+        p->maxFree = max;
+    }
+    p->free[p->numFree++] = buf;
+    pthread_mutex_unlock(&p->lock);
+}
+
+/* Free the pool and every buffer that was handed back */
+void spDestroy(struct soyPool *p)
+{
+    for (size_t i = 0; i < p->numFree; ++i)
+        free(p->free[i]);
+    free(p->free);
+    pthread_mutex_destroy(&p->lock);
+    free(p);
+}
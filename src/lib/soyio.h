@@ -0,0 +1,61 @@
+/*
+  Buffered I/O shared by the commands, so they don't each go through stdio
+
+  soyWriter: a large output buffer. Writes too big to be worth copying go out
+  together with what's buffered in a single writev(). With fd -1 the buffer
+  just grows, for output that has to be held back and written out later
+  (e.g. swWrite() of one writer's buf/len into another). Not thread safe
+
+  soyReader: hands out a file block by block. Regular files are mmap'd and the
+  blocks point straight into the mapping; pipes, ttys and small files are
+  read() into a buffer. The data is only valid until the next srNext()
+
+  soyPool: a free list of equally sized, aligned buffers (O_DIRECT, copy
+  buffers, ...), so hot loops don't malloc and free megabytes per file.
+  Thread safe
+*/
+#ifndef SOYIO_H
+#define SOYIO_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <sys/types.h>
+
+struct soyWriter {
+    int fd; /* -1: memory only, grow instead of flushing */
+    char *buf;
+    size_t len;
+    size_t cap;
+    int err; /* errno of the first failed write, later writes are dropped */
+};
+
+void swInit(struct soyWriter *w, int fd, size_t cap);
+int swWrite(struct soyWriter *w, const void *data, size_t len);
+int swLine(struct soyWriter *w, const char *s);
+int swVprintf(struct soyWriter *w, const char *fmt, va_list ap);
+int swPrintf(struct soyWriter *w, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+int swFlush(struct soyWriter *w);
+void swFree(struct soyWriter *w);
+
+struct soyReader {
+    int fd;
+    char *map; /* Whole file when it's mapped, else NULL */
+    size_t mapLen;
+    size_t pos; /* Offset of the next block in the map */
+    char *buf; /* read() buffer when not mapped */
+    size_t block;
+};
+
+int srInit(struct soyReader *r, int fd, size_t block);
+ssize_t srNext(struct soyReader *r, const char **data);
+void srFree(struct soyReader *r);
+
+struct soyPool;
+
+struct soyPool* spCreate(size_t size, size_t align);
+void* spGet(struct soyPool *p);
+void spPut(struct soyPool *p, void *buf);
+void spDestroy(struct soyPool *p);
+
+#endif
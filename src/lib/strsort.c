@@ -0,0 +1,79 @@
+#include "strsort.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define INSERTION_MAX 32 /* Buckets this small are finished with insertion sort */
+
+/* Sort strs[0, n) whose first depth bytes are known to be equal */
+static void insertionSort(const char **strs, size_t n, size_t depth)
+{
+    for (size_t i = 1; i < n; ++i)
+    {
+        const char *s = strs[i];
+        size_t j = i;
+        while (j > 0 && strcmp(strs[j - 1] + depth, s + depth) > 0)
+        {
+            strs[j] = strs[j - 1];
+            --j;
+        }
+        strs[j] = s;
+    }
+}
+
+/* Sort strs[0, n) on byte depth and beyond, using aux (same size) as scratch */
+static void msdSort(const char **strs, const char **aux, size_t n, size_t depth)
+{
+    while (n > INSERTION_MAX)
+    {
+        size_t count[256] = { 0 };
+        for (size_t i = 0; i < n; ++i)
+            ++count[(unsigned char) strs[i][depth]];
+        if (count[0] == n) /* Every string ends here, they're all equal */
+            return;
+
+        size_t start[256];
+        size_t pos = 0;
+        for (int b = 0; b < 256; ++b)
+        {
+            start[b] = pos;
+            pos += count[b];
+        }
+        size_t next[256];
+        memcpy(next, start, sizeof(next));
+        for (size_t i = 0; i < n; ++i)
+            aux[next[(unsigned char) strs[i][depth]]++] = strs[i];
+        memcpy(strs, aux, n * sizeof(char*));
+
+        /* Bucket 0 holds strings that ended, which are already in place. Recurse on
+           every bucket but the largest, then loop on that one to bound the stack */
+        int big = 1;
+        for (int b = 2; b < 256; ++b)
+            if (count[b] > count[big])
+                big = b;
+        for (int b = 1; b < 256; ++b)
+            if (b != big && count[b] > 1)
+                msdSort(strs + start[b], aux, count[b], depth + 1);
+        strs += start[big];
+        n = count[big];
+        ++depth;
+    }
+    insertionSort(strs, n, depth);
+}
+
+static int compareStrs(const void *a, const void *b)
+{ return strcmp(*(const char**) a, *(const char**) b); }
+
+/* Sort the array of strings in strcmp order */
+void radixSort(const char **strs, size_t n)
+{
+    if (n < 2)
+        return;
+    const char **aux = malloc(n * sizeof(char*));
+    if (aux == NULL) /* No room for scratch space, sort in place the slow way rather than fail */
+    {
+        qsort(strs, n, sizeof(char*), compareStrs);
+        return;
+    }
+    msdSort(strs, aux, n, 0);
+    free(aux);
+}
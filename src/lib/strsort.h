@@ -0,0 +1,17 @@
+/*
+  Sorting of C strings in byte (strcmp) order for the commands that need to
+  order lots of names or lines
+
+  radixSort() is an MSD radix sort: it buckets the strings by one byte at a
+  time and only compares whole strings once a bucket is small, so common
+  prefixes (spool-style names like msg-000001, msg-000002, ...) are scanned
+  once per level instead of once per comparison
+*/
+#ifndef STRSORT_H
+#define STRSORT_H
+
+#include <stddef.h>
+
+void radixSort(const char **strs, size_t n);
+
+#endif
@@ -0,0 +1,159 @@
+#include "uring.h"
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/* The ring indices are shared with the kernel, so they need acquire/release ordering */
+#define loadAcquire(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define storeRelease(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+/* Set up a ring with room for entries submissions. Returns 0, or -1 with errno set */
+int uringInit(struct uring *r, unsigned int entries)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    memset(r, 0, sizeof(*r));
+#ifdef __NR_io_uring_setup
+    r->fd = syscall(__NR_io_uring_setup, entries, &p);
+#else
+    errno = ENOSYS;
+    r->fd = -1;
+#endif
+    if (r->fd == -1)
+        return -1;
+    r->entries = p.sq_entries;
+
+    r->sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    r->cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    r->sqRing = mmap(NULL, r->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    r->cqRing = mmap(NULL, r->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+    r->sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqRing == MAP_FAILED || r->cqRing == MAP_FAILED || r->sqes == MAP_FAILED)
+    {
+        int err = errno;
+        uringExit(r);
+        errno = err;
+        return -1;
+    }
+
+    r->sqHead = (unsigned int*) ((char*) r->sqRing + p.sq_off.head);
+    r->sqTail = (unsigned int*) ((char*) r->sqRing + p.sq_off.tail);
+    r->sqMask = (unsigned int*) ((char*) r->sqRing + p.sq_off.ring_mask);
+    r->sqArray = (unsigned int*) ((char*) r->sqRing + p.sq_off.array);
+    r->cqHead = (unsigned int*) ((char*) r->cqRing + p.cq_off.head);
+    r->cqTail = (unsigned int*) ((char*) r->cqRing + p.cq_off.tail);
+    r->cqMask = (unsigned int*) ((char*) r->cqRing + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe*) ((char*) r->cqRing + p.cq_off.cqes);
+    return 0;
+}
+
+void uringExit(struct uring *r)
+{
+    if (r->sqes != NULL && r->sqes != MAP_FAILED)
+        munmap(r->sqes, r->sqesSize);
+    if (r->cqRing != NULL && r->cqRing != MAP_FAILED)
+        munmap(r->cqRing, r->cqRingSize);
+    if (r->sqRing != NULL && r->sqRing != MAP_FAILED)
+        munmap(r->sqRing, r->sqRingSize);
+    if (r->fd != -1)
+        close(r->fd);
+    r->fd = -1;
+}
+
+/* Next free submission entry, zeroed, or NULL if the ring is full */
+struct io_uring_sqe* uringGetSqe(struct uring *r)
+{
+    unsigned int head = loadAcquire(r->sqHead);
+    unsigned int tail = *r->sqTail + r->unsubmitted;
+    if (tail - head >= r->entries)
+        return NULL;
+    unsigned int idx = tail & *r->sqMask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sqArray[idx] = idx;
+    ++r->unsubmitted;
+    return sqe;
+}
+
+/* Hand everything prepared so far to the kernel and wait until waitFor completions are ready */
+int uringSubmit(struct uring *r, unsigned int waitFor)
+{
+    unsigned int toSubmit = r->unsubmitted;
+    storeRelease(r->sqTail, *r->sqTail + toSubmit);
+    r->unsubmitted = 0;
+    while (1)
+    {
+        int n = syscall(__NR_io_uring_enter, r->fd, toSubmit, waitFor, waitFor > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (n == -1 && errno == EINTR)
+        {
+            /* Anything already taken is counted in the ring head, only wait for the rest */
+            toSubmit = 0;
+            continue;
+        }
+        return n;
+    }
+}
+
+/* Oldest unconsumed completion, or NULL if none are ready */
+struct io_uring_cqe* uringPeek(struct uring *r)
+{
+    unsigned int head = *r->cqHead;
+    if (head == loadAcquire(r->cqTail))
+        return NULL;
+    return &r->cqes[head & *r->cqMask];
+}
+
+/* Mark the completion returned by uringPeek() as consumed */
+void uringSeen(struct uring *r)
+{ storeRelease(r->cqHead, *r->cqHead + 1); }
+
+void uringPrepOpenat(struct io_uring_sqe *sqe, int dirFd, const char *path, int flags, mode_t mode, unsigned long long data)
+{
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = dirFd;
+    sqe->addr = (unsigned long) path;
+    sqe->len = mode;
+    sqe->open_flags = flags;
+    sqe->user_data = data;
+}
+
+void uringPrepStatx(struct io_uring_sqe *sqe, int dirFd, const char *path, int flags, unsigned int mask, struct statx *buf, unsigned long long data)
+{
+    sqe->opcode = IORING_OP_STATX;
+    sqe->fd = dirFd;
+    sqe->addr = (unsigned long) path;
+    sqe->off = (unsigned long) buf;
+    sqe->len = mask;
+    sqe->statx_flags = flags;
+    sqe->user_data = data;
+}
+
+void uringPrepRead(struct io_uring_sqe *sqe, int fd, void *buf, unsigned int len, off_t off, unsigned long long data)
+{
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long) buf;
+    sqe->len = len;
+    sqe->off = off;
+    sqe->user_data = data;
+}
+
+void uringPrepWrite(struct io_uring_sqe *sqe, int fd, const void *buf, unsigned int len, off_t off, unsigned long long data)
+{
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long) buf;
+    sqe->len = len;
+    sqe->off = off;
+    sqe->user_data = data;
+}
+
+void uringPrepClose(struct io_uring_sqe *sqe, int fd, unsigned long long data)
+{
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = fd;
+    sqe->user_data = data;
+}
@@ -0,0 +1,58 @@
+/*
+  Minimal io_uring wrapper on top of the raw syscalls, so the commands don't
+  need liburing installed
+
+  Usage: uringInit() a ring, uringGetSqe() and one of the uringPrep* helpers per
+  operation, uringSubmit() them all with one syscall waiting for the completions,
+  then uringPeek()/uringSeen() to consume the results. uringInit() fails with
+  errno ENOSYS (or EPERM under seccomp) on kernels without io_uring, and callers
+  are expected to fall back to plain syscalls
+*/
+#ifndef URING_H
+#define URING_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* For struct statx */
+#endif
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <linux/io_uring.h>
+
+struct uring {
+    int fd;
+    unsigned int entries;
+    unsigned int unsubmitted; /* SQEs filled in since the last uringSubmit() */
+    /* Submission ring */
+    unsigned int *sqHead;
+    unsigned int *sqTail;
+    unsigned int *sqMask;
+    unsigned int *sqArray;
+    struct io_uring_sqe *sqes;
+    /* Completion ring */
+    unsigned int *cqHead;
+    unsigned int *cqTail;
+    unsigned int *cqMask;
+    struct io_uring_cqe *cqes;
+    /* Mappings to undo in uringExit() */
+    void *sqRing;
+    size_t sqRingSize;
+    void *cqRing;
+    size_t cqRingSize;
+    size_t sqesSize;
+};
+
+int uringInit(struct uring *r, unsigned int entries);
+void uringExit(struct uring *r);
+struct io_uring_sqe* uringGetSqe(struct uring *r);
+int uringSubmit(struct uring *r, unsigned int waitFor);
+struct io_uring_cqe* uringPeek(struct uring *r);
+void uringSeen(struct uring *r);
+
+void uringPrepOpenat(struct io_uring_sqe *sqe, int dirFd, const char *path, int flags, mode_t mode, unsigned long long data);
+void uringPrepStatx(struct io_uring_sqe *sqe, int dirFd, const char *path, int flags, unsigned int mask, struct statx *buf, unsigned long long data);
+void uringPrepRead(struct io_uring_sqe *sqe, int fd, void *buf, unsigned int len, off_t off, unsigned long long data);
+void uringPrepWrite(struct io_uring_sqe *sqe, int fd, const void *buf, unsigned int len, off_t off, unsigned long long data);
+void uringPrepClose(struct io_uring_sqe *sqe, int fd, unsigned long long data);
+
+#endif
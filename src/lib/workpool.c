@@ -0,0 +1,217 @@
+#include "workpool.h"
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define INIT_DEQUE 64 /* Initial capacity of each worker's deque */
+
+/* Growable ring buffer of tasks, protected by its own lock */
+struct deque {
+    pthread_mutex_t lock;
+    void **tasks;
+    size_t cap;
+    size_t head; /* Index of the oldest task */
+    size_t len;
+};
+
+struct workpool {
+    workFn fn;
+    void *arg;
+    unsigned int threads;
+    struct deque *deques; /* One per worker */
+    atomic_size_t pending; /* Tasks pushed but not yet finished */
+    atomic_size_t queued; /* Tasks sitting in a deque */
+    atomic_uint idle; /* Workers asleep waiting for work */
+    pthread_mutex_t idleLock;
+    pthread_cond_t idleCond;
+};
+
+/* Which worker the current thread is, so wpPush() knows whose deque to use */
+static __thread struct workpool *curPool = NULL;
+static __thread unsigned int curWorker = 0;
+
+static void dequePushBack(struct deque *d, void *task)
+{
+    pthread_mutex_lock(&d->lock);
+    if (d->len == d->cap) /* Grow and unwrap the ring */
+    {
+        void **tasks = malloc(2 * d->cap * sizeof(void*));
+        for (size_t i = 0; i < d->len; ++i)
+            tasks[i] = d->tasks[(d->head + i) % d->cap];
+        free(d->tasks);
+        d->tasks = tasks;
+        d->cap *= 2;
+        d->head = 0;
+    }
+    d->tasks[(d->head + d->len) % d->cap] = task;
+    ++d->len;
+    pthread_mutex_unlock(&d->lock);
+}
+
+/* Owner end: newest task first */
+static void* dequePopBack(struct deque *d)
+{
+    void *task = NULL;
+    pthread_mutex_lock(&d->lock);
+    if (d->len > 0)
+    {
+        --d->len;
+        task = d->tasks[(d->head + d->len) % d->cap];
+    }
+    pthread_mutex_unlock(&d->lock);
+    return task;
+}
+
+/* Thief end: oldest task first */
+static void* dequePopFront(struct deque *d)
+{
+    void *task = NULL;
+    pthread_mutex_lock(&d->lock);
+    if (d->len > 0)
+    {
+        task = d->tasks[d->head];
+        d->head = (d->head + 1) % d->cap;
+        --d->len;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return task;
+}
+
+struct workpool* wpCreate(unsigned int threads, workFn fn, void *arg)
+{
+    if (threads < 1)
+        threads = 1;
+    struct workpool *pool = malloc(sizeof(struct workpool));
+    pool->fn = fn;
+    pool->arg = arg;
+    pool->threads = threads;
+    pool->deques = malloc(threads * sizeof(struct deque));
+    for (unsigned int i = 0; i < threads; ++i)
+    {
+        pthread_mutex_init(&pool->deques[i].lock, NULL);
+        pool->deques[i].tasks = malloc(INIT_DEQUE * sizeof(void*));
+        pool->deques[i].cap = INIT_DEQUE;
+        pool->deques[i].head = 0;
+        pool->deques[i].len = 0;
+    }
+    atomic_init(&pool->pending, 0);
+    atomic_init(&pool->queued, 0);
+    atomic_init(&pool->idle, 0);
+    pthread_mutex_init(&pool->idleLock, NULL);
+    pthread_cond_init(&pool->idleCond, NULL);
+    return pool;
+}
+
+/* Add a task. From a worker it goes to that worker's deque, otherwise to worker 0's */
+void wpPush(struct workpool *pool, void *task)
+{
+    unsigned int w = curPool == pool ? curWorker : 0;
+    atomic_fetch_add(&pool->pending, 1);
+    dequePushBack(&pool->deques[w], task);
+    atomic_fetch_add(&pool->queued, 1);
+    if (atomic_load(&pool->idle) > 0) /* Wake a sleeping worker so it can steal this */
+    {
+        pthread_mutex_lock(&pool->idleLock);
+        pthread_cond_signal(&pool->idleCond);
+        pthread_mutex_unlock(&pool->idleLock);
+    }
+}
+
+/* Own deque first, then try every other worker once */
+static void* findTask(struct workpool *pool, unsigned int w)
+{
+    void *task = dequePopBack(&pool->deques[w]);
+    for (unsigned int i = 1; task == NULL && i < pool->threads; ++i)
+        task = dequePopFront(&pool->deques[(w + i) % pool->threads]);
+    if (task != NULL)
+        atomic_fetch_sub(&pool->queued, 1);
+    return task;
+}
+
+/* Main loop of each worker. Returns once no task is pending anywhere */
+static void workLoop(struct workpool *pool, unsigned int w)
+{
+    curPool = pool;
+    curWorker = w;
+    while (1)
+    {
+        void *task = findTask(pool, w);
+        if (task != NULL)
+        {
+            pool->fn(pool, task, pool->arg);
+            if (atomic_fetch_sub(&pool->pending, 1) == 1) /* That was the last one, wake everybody to exit */
+            {
+                pthread_mutex_lock(&pool->idleLock);
+                pthread_cond_broadcast(&pool->idleCond);
+                pthread_mutex_unlock(&pool->idleLock);
+            }
+            continue;
+        }
+        pthread_mutex_lock(&pool->idleLock);
+        if (atomic_load(&pool->pending) == 0)
+        {
+            pthread_mutex_unlock(&pool->idleLock);
+            break;
+        }
+        /* Announce we're going to sleep before the last look, so a concurrent push either sees us or we see it */
+        atomic_fetch_add(&pool->idle, 1);
+        if (atomic_load(&pool->queued) == 0)
+            pthread_cond_wait(&pool->idleCond, &pool->idleLock);
+        atomic_fetch_sub(&pool->idle, 1);
+        pthread_mutex_unlock(&pool->idleLock);
+    }
+    curPool = NULL;
+}
+
+struct workerArg {
+    struct workpool *pool;
+    unsigned int w;
+};
+
+static void* workThread(void *p)
+{
+    struct workerArg *a = p;
+    workLoop(a->pool, a->w);
+    return NULL;
+}
+
+/* Run until all tasks are done. The calling thread works as worker 0 */
+void wpRun(struct workpool *pool)
+{
+    pthread_t *tids = malloc(pool->threads * sizeof(pthread_t));
+    struct workerArg *args = malloc(pool->threads * sizeof(struct workerArg));
+    unsigned int started = 0;
+    for (unsigned int i = 1; i < pool->threads; ++i)
+    {
+        args[started].pool = pool;
+        args[started].w = i;
+        if (pthread_create(&tids[started], NULL, workThread, &args[started]) != 0)
+            break; /* Run with fewer threads, the others' deques just get stolen from */
+        ++started;
+    }
+    workLoop(pool, 0);
+    for (unsigned int i = 0; i < started; ++i)
+        pthread_join(tids[i], NULL);
+    free(args);
+    free(tids);
+}
+
+void wpDestroy(struct workpool *pool)
+{
+    for (unsigned int i = 0; i < pool->threads; ++i)
+    {
+        pthread_mutex_destroy(&pool->deques[i].lock);
+        free(pool->deques[i].tasks);
+    }
+    free(pool->deques);
+    pthread_mutex_destroy(&pool->idleLock);
+    pthread_cond_destroy(&pool->idleCond);
+    free(pool);
+}
+
+/* Index of the calling worker in [0, wpThreads()), for per-thread state */
+unsigned int wpWorker(struct workpool *pool)
+{ return curPool == pool ? curWorker : 0; }
+
+unsigned int wpThreads(struct workpool *pool)
+{ return pool->threads; }
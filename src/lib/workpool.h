@@ -0,0 +1,30 @@
+/*
+  Work-stealing thread pool for the commands that walk directory trees
+
+  Every worker owns a deque of tasks. A worker pushes the tasks it discovers to
+  the back of its own deque and pops from the back, so each thread walks its
+  part of the tree depth first and the directory fds it needs stay hot. A worker
+  whose deque is empty steals from the front of another worker's deque, which
+  hands it the oldest (usually largest) piece of outstanding work.
+
+  Usage: wpCreate(), wpPush() the root task(s), wpRun() until every task and
+  every task they pushed has finished, then wpDestroy()
+*/
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+
+#include <stdbool.h>
+
+struct workpool;
+
+/* Called once per task on some worker thread. May call wpPush() to add more work */
+typedef void (*workFn)(struct workpool *pool, void *task, void *arg);
+
+struct workpool* wpCreate(unsigned int threads, workFn fn, void *arg);
+void wpPush(struct workpool *pool, void *task);
+void wpRun(struct workpool *pool);
+void wpDestroy(struct workpool *pool);
+unsigned int wpWorker(struct workpool *pool);
+unsigned int wpThreads(struct workpool *pool);
+
+#endif
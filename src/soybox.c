@@ -0,0 +1,63 @@
+/*
+  Multi-call binary holding every command in src/commands (make box)
+
+  Each command is compiled with -Dmain=<name>_main and linked in here, and
+  bin/<name> becomes a symlink to bin/soybox. The command to run is picked
+  from the name it was invoked as, so there's one executable to map and link
+  instead of one per command. "soybox <name> args..." runs a command directly
+
+  The Makefile passes the command list as -DBOX_COMMANDS='X(cd) X(cp) ...'
+*/
+#include <stdio.h>
+#include <string.h>
+
+#ifndef BOX_COMMANDS
+#error "BOX_COMMANDS must list the commands, see the box target in the Makefile"
+#endif
+
+#define X(name) int name##_main(int argc, char **argv);
+BOX_COMMANDS
+#undef X
+
+struct boxCommand {
+    const char *name;
+    int (*main)(int argc, char **argv);
+};
+
+static const struct boxCommand commands[] = {
+#define X(name) { #name, name##_main },
+    BOX_COMMANDS
+#undef X
+};
+
+#define NUM_COMMANDS (sizeof(commands) / sizeof(commands[0]))
+
+static const struct boxCommand* findCommand(const char *path)
+{
+    const char *name = strrchr(path, '/');
+    name = name == NULL ? path : name + 1;
+    for (size_t i = 0; i < NUM_COMMANDS; ++i)
+        if (strcmp(commands[i].name, name) == 0)
+            return &commands[i];
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    const struct boxCommand *cmd = findCommand(argv[0]);
+    if (cmd == NULL && argc > 1) /* soybox <name> args... */
+    {
+        ++argv;
+        --argc;
+        cmd = findCommand(argv[0]);
+    }
+    if (cmd == NULL)
+    {
+        printf("Usage: soybox COMMAND [ARGS]...\nCommands:");
+        for (size_t i = 0; i < NUM_COMMANDS; ++i)
+            printf(" %s", commands[i].name);
+        putchar('\n');
+        return 1;
+    }
+    return cmd->main(argc, argv);
+}
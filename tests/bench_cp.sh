@@ -0,0 +1,25 @@
+#!/bin/bash
+# Benchmark bin/cp against GNU cp on a large file
+# Usage: ./bench_cp.sh [size in MB] (default 1024)
+BIN=../bin # Folder that contains the binaries for all tests
+SIZE=${1:-1024}
+mkdir -p bench_temp
+head -c $((SIZE * 1024 * 1024)) /dev/urandom > bench_temp/src.bin # Incompressible source file
+
+# Time a copy command with a cold page cache for the destination
+run() {
+    rm -f bench_temp/dst.bin
+    sync
+    TIMEFORMAT="$1: %R s real, %S s sys for ${SIZE} MB"
+    time "$@" bench_temp/src.bin bench_temp/dst.bin
+    $BIN/cmp -s bench_temp/src.bin bench_temp/dst.bin || echo "$1: copy differs from source"
+}
+
+echo "Copying a ${SIZE} MB file..."
+for i in 1 2 3; do
+    run $BIN/cp
+    run /bin/cp
+done
+
+# Clean up
+rm -r bench_temp
@@ -0,0 +1,28 @@
+#!/bin/bash
+# Show how much page cache bin/cp leaves behind in its default, --drop-cache and --direct modes
+# Usage: ./bench_cp_cache.sh [size in MB] (default 1024)
+# Run a cache-sensitive reader alongside to see its hit rate; this only reports what the copy itself caches
+BIN=../bin # Folder that contains the binaries for all tests
+SIZE=${1:-1024}
+mkdir -p bench_temp
+head -c $((SIZE * 1024 * 1024)) /dev/urandom > bench_temp/src.bin # Incompressible source file
+
+# Size of the page cache in MB
+cached() {
+    awk '/^Cached:/ { print int($2 / 1024) }' /proc/meminfo
+}
+
+for mode in "" --drop-cache --direct; do
+    rm -f bench_temp/dst.bin
+    sync
+    echo 1 > /proc/sys/vm/drop_caches 2> /dev/null # Needs root, otherwise the numbers include the source file
+    before=$(cached)
+    TIMEFORMAT="cp ${mode:-(default)}: %R s real"
+    time $BIN/cp --reflink=never $mode bench_temp/src.bin bench_temp/dst.bin
+    sync
+    echo "cp ${mode:-(default)}: page cache grew by $(( $(cached) - before )) MB"
+    $BIN/cmp -s bench_temp/src.bin bench_temp/dst.bin || echo "cp $mode: copy differs from source"
+done
+
+# Clean up
+rm -r bench_temp
@@ -0,0 +1,21 @@
+#!/bin/bash
+# Benchmark how bin/cp -j scales with the number of threads on one large file
+# Usage: ./bench_cp_threads.sh [size in MB] [directory for the test files] (defaults 1024, bench_temp)
+# Point the directory at an NVMe or tmpfs mount to measure the device rather than the page cache
+BIN=../bin # Folder that contains the binaries for all tests
+SIZE=${1:-1024}
+DIR=${2:-bench_temp}
+mkdir -p "$DIR"
+head -c $((SIZE * 1024 * 1024)) /dev/urandom > "$DIR"/src.bin # Incompressible source file
+
+echo "Copying a ${SIZE} MB file..."
+for j in 1 2 4 8 16; do
+    rm -f "$DIR"/dst.bin
+    sync
+    TIMEFORMAT="-j $j: %R s real, %U s user, %S s sys"
+    time $BIN/cp --reflink=never -j $j "$DIR"/src.bin "$DIR"/dst.bin
+    $BIN/cmp -s "$DIR"/src.bin "$DIR"/dst.bin || echo "-j $j: copy differs from source"
+done
+
+# Clean up
+rm -r "$DIR"
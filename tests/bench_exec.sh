@@ -0,0 +1,49 @@
+#!/bin/bash
+# Benchmark exec latency of the separate command binaries against the soybox multi-call binary
+# Cold runs drop the executable from the page cache first (all caches when run as root)
+# Usage: ./bench_exec.sh [warm runs] (default 2000)
+# Rebuilds bin/ with make, and leaves the separate binaries in place afterwards
+ROOT=..
+RUNS=${1:-2000}
+COLD_RUNS=50
+mkdir -p bench_temp/separate bench_temp/box bench_temp/static
+
+make -s -C $ROOT commands
+cp $ROOT/bin/pwd $ROOT/bin/ls bench_temp/separate
+rm -f $ROOT/bin/soybox
+make -s -C $ROOT box
+cp $ROOT/bin/soybox bench_temp/box
+rm -f $ROOT/bin/soybox
+make -s -C $ROOT box STATIC=1 2> /dev/null
+cp $ROOT/bin/soybox bench_temp/static
+rm -f $ROOT/bin/soybox
+make -s -C $ROOT commands
+for dir in box static; do
+    ln -sf soybox bench_temp/$dir/pwd
+    ln -sf soybox bench_temp/$dir/ls
+done
+mkdir -p bench_temp/empty
+
+# Evict a file's pages, or everything if we're allowed to
+drop() {
+    sync
+    echo 3 2> /dev/null > /proc/sys/vm/drop_caches || dd if="$1" iflag=nocache count=0 status=none
+}
+
+# Time runs of "<dir>/<command> args" with a warm cache, then with a cold one
+run() {
+    local dir=$1
+    shift
+    TIMEFORMAT="$dir $1 warm: %R s for $RUNS runs"
+    time for ((i = 0; i < RUNS; i++)); do bench_temp/$dir/"$@" > /dev/null; done
+    TIMEFORMAT="$dir $1 cold: %R s for $COLD_RUNS runs"
+    time for ((i = 0; i < COLD_RUNS; i++)); do drop "$(readlink -f bench_temp/$dir/$1)"; bench_temp/$dir/"$@" > /dev/null; done
+}
+
+for dir in separate box static; do
+    run $dir pwd
+    run $dir ls bench_temp/empty
+done
+
+# Clean up
+rm -r bench_temp
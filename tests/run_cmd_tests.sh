@@ -19,6 +19,38 @@ $BIN/cp temp/foo.txt temp/bar2.txt notRealDir/notRealFile.txt >> log.txt
 [[ $? == 1 ]] && echo "PASSED" || echo "FAILED"
 $BIN/cp temp/"foo 1.txt" temp/bar.txt >> log.txt
 [[ $? == 0 ]] && diff -s temp/"foo 1.txt" temp/bar.txt >> log.txt && echo "PASSED" || echo "FAILED"
+printf 'bin\xff\x00ary\xff' > temp/bin.dat && chmod 751 temp/bin.dat # Set up binary test file with 0xFF bytes
+$BIN/cp temp/bin.dat temp/bin2.dat >> log.txt
+[[ $? == 0 ]] && cmp temp/bin.dat temp/bin2.dat >> log.txt && [[ $(stat -c %a temp/bin2.dat) == 751 ]] && echo "PASSED" || echo "FAILED"
+$BIN/cp --reflink=auto temp/foo.txt temp/bar3.txt >> log.txt
+[[ $? == 0 ]] && diff -s temp/foo.txt temp/bar3.txt >> log.txt && echo "PASSED" || echo "FAILED"
+$BIN/cp --reflink=sometimes temp/foo.txt temp/bar3.txt >> log.txt
+[[ $? == 1 ]] && echo "PASSED" || echo "FAILED"
+truncate -s 64M temp/sparse.img && echo "data" >> temp/sparse.img # Set up sparse test file
+$BIN/cp temp/sparse.img temp/sparse2.img >> log.txt
+[[ $? == 0 ]] && cmp temp/sparse.img temp/sparse2.img >> log.txt && (( $(stat -c %b temp/sparse2.img) < 1024 )) && echo "PASSED" || echo "FAILED"
+head -c 100M /dev/urandom > temp/big.bin # Set up file large enough to be split across threads
+$BIN/cp -j 4 temp/big.bin temp/big2.bin >> log.txt
+[[ $? == 0 ]] && cmp temp/big.bin temp/big2.bin >> log.txt && echo "PASSED" || echo "FAILED"
+$BIN/cp -j 0 temp/foo.txt temp/bar.txt >> log.txt
+[[ $? == 1 ]] && echo "PASSED" || echo "FAILED"
+$BIN/cp --direct temp/big.bin temp/big3.bin >> log.txt
+[[ $? == 0 ]] && cmp temp/big.bin temp/big3.bin >> log.txt && echo "PASSED" || echo "FAILED"
+$BIN/cp --direct temp/bin.dat temp/bin3.dat >> log.txt
+[[ $? == 0 ]] && cmp temp/bin.dat temp/bin3.dat >> log.txt && echo "PASSED" || echo "FAILED"
+$BIN/cp --drop-cache temp/big.bin temp/big4.bin >> log.txt
+[[ $? == 0 ]] && cmp temp/big.bin temp/big4.bin >> log.txt && echo "PASSED" || echo "FAILED"
+mkdir -p temp/tree/a/b temp/tree/c && echo "leaf" > temp/tree/a/b/leaf.txt && ln -s a temp/tree/link # Set up directory tree
+$BIN/cp -r temp/tree temp/tree2 >> log.txt
+[[ $? == 0 ]] && diff -r temp/tree temp/tree2 >> log.txt && [ -L temp/tree2/link ] && echo "PASSED" || echo "FAILED"
+$BIN/cp -r --no-uring temp/tree temp/tree4 >> log.txt
+[[ $? == 0 ]] && diff -r temp/tree temp/tree4 >> log.txt && [ -L temp/tree4/link ] && echo "PASSED" || echo "FAILED"
+$BIN/cp temp/tree temp/tree3 >> log.txt
+[[ $? == 1 ]] && ! [ -d temp/tree3 ] && echo "PASSED" || echo "FAILED"
+$BIN/cp -r temp/tree temp/tree/a >> log.txt
+[[ $? == 1 ]] && ! [ -d temp/tree/a/tree ] && echo "PASSED" || echo "FAILED"
+$BIN/cp temp/foo.txt temp/bin.dat temp/tree2 >> log.txt
+[[ $? == 0 ]] && diff -s temp/foo.txt temp/tree2/foo.txt >> log.txt && cmp temp/bin.dat temp/tree2/bin.dat >> log.txt && echo "PASSED" || echo "FAILED"
 
 # Test ls
 echo "Testing ls..."
@@ -34,6 +66,17 @@ $BIN/ls temp/temp2 >> log.txt
 [[ $? == 0 ]] && echo "PASSED" || echo "FAILED"
 $BIN/ls temp/notRealDir >> log.txt
 [[ $? == 1 ]] && echo "PASSED" || echo "FAILED"
+mkdir temp/spool && (cd temp/spool && seq -f "msg-%05g" 5000 -1 1 | xargs touch) # Set up large directory
+[[ $($BIN/ls temp/spool | wc -l) == 5002 ]] && echo "PASSED" || echo "FAILED"
+$BIN/ls --sort temp/spool > temp/sorted.txt
+[[ $? == 0 ]] && LC_ALL=C sort -c temp/sorted.txt && [[ $(wc -l < temp/sorted.txt) == 5002 ]] && echo "PASSED" || echo "FAILED"
+$BIN/ls -l temp/spool > temp/long.txt
+[[ $? == 0 ]] && [[ $(grep -c '^-rw' temp/long.txt) == 5000 ]] && grep -q ' msg-00001$' temp/long.txt && echo "PASSED" || echo "FAILED"
+[[ $(head -n 1 temp/long.txt) == $(ls -la temp/spool | head -n 1) ]] && echo "PASSED" || echo "FAILED"
+[[ $($BIN/ls -F temp | grep -c '^temp2/$') == 1 ]] && echo "PASSED" || echo "FAILED"
+mkdir -p temp/rtree/a/b temp/rtree/c && touch temp/rtree/a/b/x temp/rtree/c/y # Set up tree for recursive listing
+$BIN/ls -R --sort -j 1 temp/rtree > temp/r1.txt && $BIN/ls -R --sort -j 8 temp/rtree > temp/r8.txt
+[[ $? == 0 ]] && cmp temp/r1.txt temp/r8.txt >> log.txt && [[ $(grep -c ':$' temp/r8.txt) == 4 ]] && echo "PASSED" || echo "FAILED"
 
 # Test mkdir
 echo "Testing mkdir..."
@@ -49,6 +92,15 @@ $BIN/mkdir temp/"test dir" >> log.txt
 [[ $? == 0 ]] && [ -d temp/"test dir" ] && echo "PASSED" || echo "FAILED"
 $BIN/mkdir >> log.txt
 [[ $? == 1 ]] && echo "PASSED" || echo "FAILED"
+$BIN/mkdir -p temp/deep/x/y temp/deep/x/z temp/deep/w >> log.txt
+[[ $? == 0 ]] && [ -d temp/deep/x/y ] && [ -d temp/deep/x/z ] && [ -d temp/deep/w ] && echo "PASSED" || echo "FAILED"
+$BIN/mkdir -p temp/deep/x/y >> log.txt
+[[ $? == 0 ]] && echo "PASSED" || echo "FAILED"
+$BIN/mkdir -m 750 temp/moded >> log.txt
+[[ $? == 0 ]] && [[ $(stat -c %a temp/moded) == 750 ]] && echo "PASSED" || echo "FAILED"
+[[ $(umask 022 && $BIN/mkdir -p -m 700 temp/pmode/a/b && stat -c %a temp/pmode/a temp/pmode/a/b) == $'755\n700' ]] && echo "PASSED" || echo "FAILED"
+touch temp/zfile temp/afile # Files that block -p, reported in argument order
+[[ $($BIN/mkdir -p temp/zfile/x temp/afile/x) == $'Error: temp/zfile/x: Not a directory\nError: temp/afile/x: Not a directory' ]] && echo "PASSED" || echo "FAILED"
 
 # Test rmdir
 echo "Testing rmdir..."
@@ -67,6 +119,138 @@ $BIN/rmdir temp/"test dir" >> log.txt
 $BIN/rmdir ../fake_dir2 >> log.txt
 [[ $? == 1 ]] && ! [ -d ../"fake_dir2" ] && echo "PASSED" || echo "FAILED"
 
+# Test rm
+echo "Testing rm..."
+mkdir -p temp/rmtree/a/b temp/rmtree/c && touch temp/rmtree/a/b/x temp/rmtree/c/y temp/rmtree/z && ln -s ../.. temp/rmtree/up # Set up tree to delete
+$BIN/rm -r -j 4 temp/rmtree >> log.txt
+[[ $? == 0 ]] && ! [ -e temp/rmtree ] && [ -d temp ] && echo "PASSED" || echo "FAILED"
+$BIN/rm -r temp/fake_tree >> log.txt
+[[ $? == 1 ]] && echo "PASSED" || echo "FAILED"
+$BIN/rm -rf temp/fake_tree >> log.txt
+[[ $? == 0 ]] && echo "PASSED" || echo "FAILED"
+mkdir -p temp/deferred/a && touch temp/deferred/a/x # Set up tree to delete in the background
+$BIN/rm --defer temp/deferred >> log.txt
+[[ $? == 0 ]] && ! [ -e temp/deferred ] && [ -d temp ] && echo "PASSED" || echo "FAILED"
+for i in $(seq 50); do [ -e temp/.soytrash ] && sleep 0.1; done # The reaper removes the trash once it has emptied it
+! [ -e temp/.soytrash ] && echo "PASSED" || echo "FAILED"
+mkdir -p temp/trash/t1/a && touch temp/trash/t1/a/x temp/trash/t2 # Set up a trash directory to empty
+$BIN/rm --reap temp/trash >> log.txt
+[[ $? == 0 ]] && [ -d temp/trash ] && [ -z "$(ls -A temp/trash)" ] && echo "PASSED" || echo "FAILED"
+mkdir -p temp/trash/t3/a && touch temp/trash/t3/a/x temp/trash/t4 && chattr +i temp/trash/t3/a/x # An entry that can't be removed
+timeout 10 $BIN/rm --reap temp/trash >> log.txt
+[[ $? == 1 ]] && [ -e temp/trash/t3/a/x ] && ! [ -e temp/trash/t4 ] && echo "PASSED" || echo "FAILED"
+chattr -i temp/trash/t3/a/x
+
+# Test cat
+echo "Testing cat..."
+$BIN/cat temp/foo.txt > temp/cat1.txt
+[[ $? == 0 ]] && diff -s temp/foo.txt temp/cat1.txt >> log.txt && echo "PASSED" || echo "FAILED"
+echo "from stdin" | $BIN/cat temp/foo.txt - temp/"foo 1.txt" > temp/cat2.txt
+[[ $? == 0 ]] && [[ $(cat temp/cat2.txt) == $(printf "This is a test file\nfrom stdin\nThis is a second test file") ]] && echo "PASSED" || echo "FAILED"
+$BIN/cat temp/bin.dat temp/foo.txt | $BIN/cat > temp/cat3.txt # Through pipes on both sides
+[[ $? == 0 ]] && cat temp/bin.dat temp/foo.txt | cmp - temp/cat3.txt >> log.txt && echo "PASSED" || echo "FAILED"
+$BIN/cat temp/fake.txt >> log.txt 2>&1
+[[ $? == 1 ]] && echo "PASSED" || echo "FAILED"
+
+# Test wc
+echo "Testing wc..."
+printf 'one two\tthree\n  four\n\nfive' > temp/words.txt # Set up file with 3 newlines, 5 words and 26 bytes
+[[ $($BIN/wc temp/words.txt) == " 3  5 26 temp/words.txt" ]] && echo "PASSED" || echo "FAILED"
+[[ $($BIN/wc -l < temp/words.txt) == "3" ]] && echo "PASSED" || echo "FAILED"
+seq 1 100000 > temp/seq.txt # Set up file large enough for the vector kernels and mmap
+[[ $($BIN/wc -j 2 temp/seq.txt temp/words.txt | tail -n 1) == "100003 100005 588921 total" ]] && echo "PASSED" || echo "FAILED"
+$BIN/wc temp/fake.txt >> log.txt 2>&1
+[[ $? == 1 ]] && echo "PASSED" || echo "FAILED"
+
+# Test grep
+echo "Testing grep..."
+printf 'alpha beta\nGamma delta\nbeta gamma\nepsilon' > temp/grep.txt # Set up file with 4 lines, the last without a newline
+[[ $($BIN/grep -n beta temp/grep.txt) == $'1:alpha beta\n3:beta gamma' ]] && echo "PASSED" || echo "FAILED"
+[[ $($BIN/grep -i -c -E '^(gamma|eps)' < temp/grep.txt) == "2" ]] && echo "PASSED" || echo "FAILED"
+[[ $($BIN/grep -v -E 'a$' temp/grep.txt) == "epsilon" ]] && echo "PASSED" || echo "FAILED"
+[[ $($BIN/grep -j 2 -c 99999 temp/seq.txt temp/grep.txt) == $'temp/seq.txt:1\ntemp/grep.txt:0' ]] && echo "PASSED" || echo "FAILED"
+$BIN/grep beta temp/fake.txt >> log.txt 2>&1
+[[ $? == 2 ]] && echo "PASSED" || echo "FAILED"
+[[ $($BIN/grep -E 'l{2}|^\w+ d' temp/grep.txt) == "Gamma delta" ]] && [[ $($BIN/grep -c '\<beta\>' temp/grep.txt) == "2" ]] && echo "PASSED" || echo "FAILED"
+$BIN/grep 'a\{1' temp/grep.txt >> log.txt 2>&1
+[[ $? == 2 ]] && echo "PASSED" || echo "FAILED"
+[[ $(printf 'a^b\na$b\nab' | $BIN/grep -c 'a^b\|a$b') == "2" ]] && [[ $(printf 'a^b\nab' | $BIN/grep -c -E 'a^b') == "0" ]] && echo "PASSED" || echo "FAILED"
+
+# Test sort
+echo "Testing sort..."
+printf 'pear 3\napple 10\nfig 2' > temp/fruit.txt # Set up file with 3 lines, the last without a newline
+[[ $($BIN/sort temp/fruit.txt) == $'apple 10\nfig 2\npear 3' ]] && echo "PASSED" || echo "FAILED"
+[[ $($BIN/sort -k 2 -n -r < temp/fruit.txt) == $'apple 10\npear 3\nfig 2' ]] && echo "PASSED" || echo "FAILED"
+seq 1 100000 | sort -R > temp/shuffled.txt # Set up file that spills many runs under a small budget
+$BIN/sort -n -S 16K -j 2 -T temp -o temp/sorted.txt temp/shuffled.txt
+cmp -s temp/sorted.txt temp/seq.txt && echo "PASSED" || echo "FAILED"
+$BIN/sort temp/fake.txt >> log.txt 2>&1
+[[ $? == 2 ]] && echo "PASSED" || echo "FAILED"
+
+# Test tail
+echo "Testing tail..."
+[[ $($BIN/tail -n 2 temp/seq.txt) == $'99999\n100000' ]] && echo "PASSED" || echo "FAILED"
+[[ $(cat temp/grep.txt | $BIN/tail -n 1) == "epsilon" ]] && echo "PASSED" || echo "FAILED"
+[[ $($BIN/tail -n +99999 temp/seq.txt) == $'99999\n100000' ]] && [[ $(cat temp/grep.txt | $BIN/tail -c +3 | $BIN/tail -n +3) == $'beta gamma\nepsilon' ]] && echo "PASSED" || echo "FAILED"
+echo "first" > temp/follow.txt # Set up file to follow through a rotation
+timeout 1 $BIN/tail -n 1 -f temp/follow.txt > temp/followed.txt 2>> log.txt &
+sleep 0.2; echo "second" >> temp/follow.txt; mv temp/follow.txt temp/follow.old; echo "third" > temp/follow.txt
+wait
+[[ $(cat temp/followed.txt) == $'first\nsecond\nthird' ]] && echo "PASSED" || echo "FAILED"
+$BIN/tail temp/fake.txt >> log.txt 2>&1
+[[ $? == 1 ]] && echo "PASSED" || echo "FAILED"
+
+# Test find
+echo "Testing find..."
+mkdir -p temp/walk/a/b && echo "x" > temp/walk/a/one.c && echo "x" > temp/walk/a/b/two.c && seq 1 1000 > temp/walk/a/b/big.txt # Set up a small tree
+[[ $($BIN/find temp/walk -name '*.c' | sort) == $'temp/walk/a/b/two.c\ntemp/walk/a/one.c' ]] && echo "PASSED" || echo "FAILED"
+[[ $($BIN/find temp/walk -maxdepth 1 -type d | sort) == $'temp/walk\ntemp/walk/a' ]] && echo "PASSED" || echo "FAILED"
+[[ $($BIN/find temp/walk -j 2 -type f -size +2 -o -name 'b' | sort) == $'temp/walk/a/b\ntemp/walk/a/b/big.txt' ]] && echo "PASSED" || echo "FAILED"
+[[ $($BIN/find temp/walk ! -type d -mtime -1 | wc -l) == "3" ]] && echo "PASSED" || echo "FAILED"
+$BIN/find temp/fake >> log.txt 2>&1
+[[ $? == 1 ]] && echo "PASSED" || echo "FAILED"
+
+# Test du
+echo "Testing du..."
+mkdir -p temp/usage/sub && seq 1 100000 > temp/usage/sub/data.txt && ln temp/usage/sub/data.txt temp/usage/link.txt # Set up tree with a hard link
+[[ $($BIN/du -s temp/usage | cut -f 1) == $(du -s temp/usage | cut -f 1) ]] && echo "PASSED" || echo "FAILED"
+[[ $($BIN/du -j 2 -d 1 temp/usage | cut -f 2) == $'temp/usage/sub\ntemp/usage' ]] && echo "PASSED" || echo "FAILED"
+[[ $($BIN/du -h temp/usage/link.txt) == $(du -h temp/usage/link.txt) ]] && echo "PASSED" || echo "FAILED"
+[[ $($BIN/du -c temp/usage temp/usage/sub) == $(du -c temp/usage temp/usage/sub) ]] && [[ $($BIN/du -c temp/usage/sub temp/usage) == $(du -c temp/usage/sub temp/usage) ]] && echo "PASSED" || echo "FAILED"
+$BIN/du temp/fake >> log.txt 2>&1
+[[ $? == 1 ]] && echo "PASSED" || echo "FAILED"
+
+# Test sum
+echo "Testing sum..."
+head -c 10000000 /dev/urandom > temp/random.bin && cp temp/random.bin temp/copy.bin # Set up a file spanning several chunks and its copy
+[[ $($BIN/sum temp/random.bin | cut -d ' ' -f 1) == $(cat temp/copy.bin | $BIN/sum -j 1 | cut -d ' ' -f 1) ]] && echo "PASSED" || echo "FAILED"
+[[ $($BIN/sum -a xxh64 -j 3 temp/random.bin | cut -d ' ' -f 1) == $($BIN/sum -a xxh64 -j 1 temp/copy.bin | cut -d ' ' -f 1) ]] && echo "PASSED" || echo "FAILED"
+$BIN/sum temp/random.bin temp/copy.bin > temp/sums.txt && [[ $($BIN/sum -c temp/sums.txt) == $'temp/random.bin: OK\ntemp/copy.bin: OK' ]] && echo "PASSED" || echo "FAILED"
+printf x | dd of=temp/copy.bin bs=1 seek=5000000 conv=notrunc status=none && $BIN/sum -c temp/sums.txt >> log.txt 2>&1
+[[ $? == 1 ]] && echo "PASSED" || echo "FAILED"
+$BIN/sum temp/fake >> log.txt 2>&1
+[[ $? == 1 ]] && echo "PASSED" || echo "FAILED"
+
+# Test cmp
+echo "Testing cmp..."
+$BIN/cmp temp/random.bin temp/copy.bin >> log.txt # copy.bin had one byte changed in the sum tests
+[[ $? == 1 && $($BIN/cmp temp/random.bin temp/copy.bin) == "temp/random.bin temp/copy.bin differ: byte 5000001, line $(( $(head -c 5000000 temp/random.bin | tr -cd '\n' | wc -c) + 1 ))" ]] && echo "PASSED" || echo "FAILED"
+cp temp/random.bin temp/copy.bin && $BIN/cmp -s temp/random.bin temp/copy.bin && cat temp/copy.bin | $BIN/cmp temp/random.bin - && echo "PASSED" || echo "FAILED"
+[[ $($BIN/cmp temp/seq.txt <(head -n 5 temp/seq.txt) 2>&1 >/dev/null) == "cmp: EOF on /dev/fd/63 after byte 10, line 5" ]] && echo "PASSED" || echo "FAILED"
+truncate -s 10M temp/sparse.bin && cp --sparse=never temp/sparse.bin temp/filled.bin && $BIN/cmp temp/sparse.bin temp/filled.bin && ! $BIN/cmp -s -x temp/sparse.bin temp/filled.bin && echo "PASSED" || echo "FAILED"
+$BIN/cmp temp/random.bin temp/fake >> log.txt 2>&1
+[[ $? == 2 ]] && echo "PASSED" || echo "FAILED"
+
+# Test pv
+echo "Testing pv..."
+$BIN/pv -q temp/seq.txt | $BIN/cmp -s - temp/seq.txt && echo "PASSED" || echo "FAILED"
+cat temp/seq.txt | $BIN/pv -q -l > temp/pv.txt && $BIN/cmp -s temp/seq.txt temp/pv.txt && echo "PASSED" || echo "FAILED"
+[[ $($BIN/pv -l -N seq temp/seq.txt 2>&1 >/dev/null) == "seq: "*" 100000 lines "* ]] && echo "PASSED" || echo "FAILED"
+$BIN/pv -i 0 temp/seq.txt >> log.txt 2>&1
+[[ $? == 1 ]] && echo "PASSED" || echo "FAILED"
+$BIN/pv -lq temp/seq.txt | head -n 1 > /dev/null
+[[ ${PIPESTATUS[0]} == 0 ]] && echo "PASSED" || echo "FAILED"
+
 # Test pwd
 echo "Testing pwd..."
 [[ $($BIN/pwd) == $PWD ]] && echo "PASSED" || echo "FAILED"
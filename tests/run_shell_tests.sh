@@ -13,5 +13,8 @@ echo "Testing braces..."
 [ -d temp/brace_test1 ] && [ -d temp/brace_test2 ] && ! [ -d temp/brace_test3 ] && [ -d temp/brace_test4 ] && echo "PASSED" || echo "FAILED"
 echo "Testing quotes..."
 [ -d temp/dir\ with\ space ] && echo "PASSED" || echo "FAILED"
+echo "Testing pv between pipeline stages..."
+[[ $(cat temp/pv_test.txt) == $(../bin/wc -l < shell_test.txt) ]] && echo "PASSED" || echo "FAILED"
+! [ -d temp/pv_fail_test ] && echo "PASSED" || echo "FAILED"
 # Cleanup
 rm -r temp